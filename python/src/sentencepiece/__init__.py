@@ -170,6 +170,12 @@ class SentencePieceProcessor(object):
     def LoadFromFile(self, arg):
         return _sentencepiece.SentencePieceProcessor_LoadFromFile(self, arg)
 
+    def _EncodeAsIdsBatch(self, inputs, num_threads, add_bos, add_eos, reverse):
+        return _sentencepiece.SentencePieceProcessor__EncodeAsIdsBatch(self, inputs, num_threads, add_bos, add_eos, reverse)
+
+    def _EncodeAsIdsBatchPadded(self, inputs, num_threads, add_bos, add_eos, reverse, pad_id):
+        return _sentencepiece.SentencePieceProcessor__EncodeAsIdsBatchPadded(self, inputs, num_threads, add_bos, add_eos, reverse, pad_id)
+
     def DecodeIdsWithCheck(self, ids):
         return _sentencepiece.SentencePieceProcessor_DecodeIdsWithCheck(self, ids)
 
@@ -304,6 +310,58 @@ class SentencePieceProcessor(object):
       return _encode(input)
 
 
+    def EncodeAsIdsArray(self,
+                         input,
+                         num_threads=None,
+                         add_bos=None,
+                         add_eos=None,
+                         reverse=None,
+                         pad_id=None):
+      """Encode a list of strings into NumPy int32 arrays in parallel.
+
+      The GIL is released while encoding, and no Python object is created
+      per token. Sampling is not supported.
+
+        Args:
+        input: list of strings.
+        num_threads: number of threads (Default = the number of CPUs)
+        add_bos: Add <s> to the result (Default = false)
+        add_eos: Add </s> to the result (Default = false) <s>/</s> is added after
+          reversing (if enabled).
+        reverse: Reverses the tokenized sequence (Default = false)
+        pad_id: When specified, returns a 2-D array padded with pad_id.
+
+        Returns:
+        (ids, offsets) where ids[offsets[i]:offsets[i + 1]] are the ids of
+        input[i], or a 2-D array of shape (len(input), max_length) when pad_id
+        is specified.
+      """
+
+      import multiprocessing
+      import numpy as np
+
+      if num_threads is None:
+        num_threads = multiprocessing.cpu_count()
+      if add_bos is None:
+        add_bos = self._add_bos
+      if add_eos is None:
+        add_eos = self._add_eos
+      if reverse is None:
+        reverse = self._reverse
+      add_bos, add_eos, reverse = bool(add_bos), bool(add_eos), bool(reverse)
+
+      if pad_id is None:
+        ids, offsets = self._EncodeAsIdsBatch(input, num_threads, add_bos,
+                                              add_eos, reverse)
+        return np.frombuffer(ids, dtype=np.int32), np.frombuffer(
+            offsets, dtype=np.int64)
+
+      ids, max_length = self._EncodeAsIdsBatchPadded(input, num_threads,
+                                                     add_bos, add_eos, reverse,
+                                                     pad_id)
+      return np.frombuffer(ids, dtype=np.int32).reshape(len(input), max_length)
+
+
     def Decode(self, input):
       """Decode processed id or token sequences."""
 
@@ -2,7 +2,10 @@
 %include exception.i
 
 %{
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <sentencepiece_processor.h>
 #include <sentencepiece_trainer.h>
 
@@ -84,6 +87,135 @@ PyObject* MakePyOutputBytes(const std::string& output) {
 #endif
 }
 
+// Python object which owns the result of EncodeAsIdsArray() and exports
+// it through the buffer protocol, so that numpy.frombuffer() wraps the
+// vector without copying it.
+struct PyOutputArray {
+  PyObject_HEAD
+  void *owner;
+  void (*deleter)(void *);
+  void *data;
+  Py_ssize_t shape[1];
+  Py_ssize_t strides[1];
+  char *format;
+};
+
+template <typename T>
+void DeleteVector(void *v) {
+  delete static_cast<std::vector<T> *>(v);
+}
+
+// struct module format of the elements.
+inline char *GetArrayFormat(int32_t) {
+  static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bit.");
+  return const_cast<char *>("i");
+}
+
+inline char *GetArrayFormat(int64_t) {
+  static_assert(sizeof(long long) == sizeof(int64_t),
+                "long long must be 64 bit.");
+  return const_cast<char *>("q");
+}
+
+int PyOutputArrayGetBuffer(PyObject *obj, Py_buffer *view, int flags) {
+  auto *self = reinterpret_cast<PyOutputArray *>(obj);
+  view->obj = obj;
+  Py_INCREF(obj);
+  view->buf = self->data;
+  view->len = self->shape[0] * self->strides[0];
+  view->readonly = 0;
+  view->itemsize = self->strides[0];
+  view->format = (flags & PyBUF_FORMAT) ? self->format : nullptr;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+  view->strides =
+      ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+void PyOutputArrayDealloc(PyObject *obj) {
+  auto *self = reinterpret_cast<PyOutputArray *>(obj);
+  self->deleter(self->owner);
+  Py_TYPE(obj)->tp_free(obj);
+}
+
+PyTypeObject *GetPyOutputArrayType() {
+  static PyBufferProcs buffer_procs;
+  static PyTypeObject type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+  if (!(type.tp_flags & Py_TPFLAGS_READY)) {
+    buffer_procs.bf_getbuffer = PyOutputArrayGetBuffer;
+    type.tp_name = "sentencepiece._OutputArray";
+    type.tp_basicsize = sizeof(PyOutputArray);
+    type.tp_dealloc = PyOutputArrayDealloc;
+    type.tp_as_buffer = &buffer_procs;
+#if PY_VERSION_HEX >= 0x03000000
+    type.tp_flags = Py_TPFLAGS_DEFAULT;
+#else
+    type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+    type.tp_doc = "Array of ids exported through the buffer protocol.";
+    if (PyType_Ready(&type) < 0) return nullptr;
+  }
+  return &type;
+}
+
+// Moves `output` to a new PyOutputArray.
+template <typename T>
+PyObject* MakePyOutputArray(std::vector<T> *output) {
+  PyTypeObject *type = GetPyOutputArrayType();
+  if (type == nullptr) return nullptr;
+  auto *self = PyObject_New(PyOutputArray, type);
+  if (self == nullptr) return nullptr;
+  auto *owner = new std::vector<T>(std::move(*output));
+  // The buffer of an empty array must not be null.
+  static T empty;
+  self->owner = owner;
+  self->deleter = &DeleteVector<T>;
+  self->data = owner->empty() ? &empty : owner->data();
+  self->shape[0] = owner->size();
+  self->strides[0] = sizeof(T);
+  self->format = GetArrayFormat(T());
+  return reinterpret_cast<PyObject *>(self);
+}
+
+// Encodes `inputs` in parallel while the GIL is released. `add_bos`,
+// `add_eos` and `reverse` are applied in the same way as
+// SentencePieceProcessor.Encode() in Python.
+sentencepiece::util::Status EncodeBatchWithoutGIL(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<std::string> &inputs, int num_threads,
+    bool add_bos, bool add_eos, bool reverse,
+    std::vector<int32_t> *ids, std::vector<int64_t> *offsets) {
+  static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bit.");
+  sentencepiece::util::Status status;
+  Py_BEGIN_ALLOW_THREADS;
+  const std::vector<absl::string_view> views(inputs.begin(), inputs.end());
+  std::vector<int> flat_ids;
+  std::vector<size_t> flat_offsets;
+  status = sp.EncodeBatch(views, num_threads, &flat_ids, &flat_offsets);
+  if (status.ok()) {
+    const int bos_id = sp.bos_id();
+    const int eos_id = sp.eos_id();
+    ids->reserve(flat_ids.size() + (add_bos + add_eos) * inputs.size());
+    offsets->reserve(flat_offsets.size());
+    offsets->push_back(0);
+    for (size_t i = 0; i + 1 < flat_offsets.size(); ++i) {
+      const auto begin = flat_ids.begin() + flat_offsets[i];
+      const auto end = flat_ids.begin() + flat_offsets[i + 1];
+      if (add_bos) ids->push_back(bos_id);
+      const size_t pos = ids->size();
+      ids->insert(ids->end(), begin, end);
+      if (reverse) std::reverse(ids->begin() + pos, ids->end());
+      if (add_eos) ids->push_back(eos_id);
+      offsets->push_back(ids->size());
+    }
+  }
+  Py_END_ALLOW_THREADS;
+  return status;
+}
+
 int ToSwigError(sentencepiece::util::StatusCode code) {
   switch (code) {
     case sentencepiece::util::StatusCode::kNotFound:
@@ -98,11 +230,17 @@ int ToSwigError(sentencepiece::util::StatusCode code) {
   return SWIG_RuntimeError;
 }
 
+// Adapts a Python iterator to SentenceIterator. The iterator may yield
+// either a single sentence (str/bytes) or a chunk of sentences, i.e., a
+// sequence (list, tuple, numpy array) of str/bytes, or a bytearray or
+// memoryview buffer with newline separators. A str/bytes item is always
+// one sentence, even if it contains newlines. Chunks are copied into C++
+// strings in bulk, so that the GIL is only acquired once per chunk.
 class PySentenceIterator : public sentencepiece::SentenceIterator {
   public:
+  // The GIL is held when the iterator is constructed in the typemap.
   PySentenceIterator(PyObject *iter) : iter_(iter) {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    FetchChunk();
   }
 
   ~PySentenceIterator() {
@@ -110,16 +248,19 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
   }
 
   bool done() const override {
-    return item_ == nullptr;
+    return !status_.ok() || pos_ >= sentences_.size();
   }
 
+  // Next() is called from the trainer while the GIL is released.
   void Next() override {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    if (++pos_ < sentences_.size()) return;
+    const PyGILState_STATE state = PyGILState_Ensure();
+    FetchChunk();
+    PyGILState_Release(state);
   }
 
   const std::string &value() const override {
-    return value_;
+    return sentences_[pos_];
   }
 
   sentencepiece::util::Status status() const override {
@@ -127,28 +268,97 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
   }
 
   private:
-   void CopyValue() {
-     if (item_ == nullptr) return;
-     const PyInputString ustring(item_);
-     if (ustring.IsAvalable()) {
-       const char *data = ustring.data();
-       size_t size = ustring.size();
-       while (size > 0) {
-         if (data[size - 1] == '\r' || data[size - 1] == '\n')
-           --size;
-         else
-           break;
+   // Pulls items until at least one sentence is available or the
+   // iterator is exhausted.
+   void FetchChunk() {
+     sentences_.clear();
+     pos_ = 0;
+     while (status_.ok() && sentences_.empty()) {
+       PyObject *item = PyIter_Next(iter_);
+       if (item == nullptr) {
+         if (PyErr_Occurred()) {
+           PyErr_Clear();
+           status_ = sentencepiece::util::Status(
+               sentencepiece::util::StatusCode::kInternal,
+               "sentence_iterator raised an exception.");
+         }
+         return;
+       }
+       AddItem(item);
+       Py_XDECREF(item);
+     }
+   }
+
+   void AddItem(PyObject *item) {
+     if (AddSentence(item)) return;
+     if (PyByteArray_Check(item) || PyMemoryView_Check(item)) {
+       AddBuffer(item);
+       return;
+     }
+     PyObject *seq = PySequence_Fast(item, "");
+     if (seq == nullptr) {
+       PyErr_Clear();
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, "Not a string.");
+       return;
+     }
+     const Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+     PyObject **items = PySequence_Fast_ITEMS(seq);
+     for (Py_ssize_t i = 0; i < size; ++i) {
+       if (!AddSentence(items[i])) {
+         status_ = sentencepiece::util::Status(
+             sentencepiece::util::StatusCode::kInternal, "Not a string.");
+         break;
        }
-       value_.assign(data, size);
-     } else {
-       status_ = sentencepiece::util::Status(sentencepiece::util::StatusCode::kInternal,
-                                             "Not a string.");
      }
-     Py_XDECREF(item_);
+     Py_DECREF(seq);
+   }
+
+   // Adds a str/bytes object as one sentence without the trailing
+   // newlines. Returns false if |obj| is not a string.
+   bool AddSentence(PyObject *obj) {
+     const PyInputString ustring(obj);
+     if (!ustring.IsAvalable()) return false;
+     const char *data = ustring.data();
+     size_t size = ustring.size();
+     while (size > 0) {
+       if (data[size - 1] == '\r' || data[size - 1] == '\n')
+         --size;
+       else
+         break;
+     }
+     sentences_.emplace_back(data, size);
+     ReleaseResultObject(ustring.input_type());
+     return true;
+   }
+
+   // Splits a bytearray/memoryview into lines. '\r' before '\n' is
+   // removed as in the file reader.
+   void AddBuffer(PyObject *obj) {
+     Py_buffer view;
+     if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+       PyErr_Clear();
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, "Not a string.");
+       return;
+     }
+     const char *begin = static_cast<const char *>(view.buf);
+     const char *end = begin + view.len;
+     while (begin < end) {
+       const char *eol = static_cast<const char *>(
+           memchr(begin, '\n', end - begin));
+       const char *next = eol == nullptr ? end : eol + 1;
+       if (eol == nullptr) eol = end;
+       while (eol > begin && eol[-1] == '\r') --eol;
+       sentences_.emplace_back(begin, eol - begin);
+       begin = next;
+     }
+     PyBuffer_Release(&view);
    }
+
    PyObject *iter_ = nullptr;
-   PyObject *item_ = nullptr;
-   std::string value_;
+   std::vector<std::string> sentences_;
+   size_t pos_ = 0;
    sentencepiece::util::Status status_;
 };
 }
@@ -164,6 +374,49 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
   }
 }
 
+// Releases the GIL while running the C++ function, so that Python threads
+// can encode/decode/train concurrently. The wrapped function must not call
+// the Python API without acquiring the GIL.
+%define SPM_RELEASE_GIL(name)
+%exception name {
+  {
+    sentencepiece::util::Status _gil_status;
+    Py_BEGIN_ALLOW_THREADS;
+    try {
+      $action
+    }
+    catch (const sentencepiece::util::Status &status) {
+      _gil_status = status;
+    }
+    Py_END_ALLOW_THREADS;
+    ReleaseResultObject(resultobj);
+    if (!_gil_status.ok()) {
+      SWIG_exception(ToSwigError(_gil_status.code()),
+                     _gil_status.ToString().c_str());
+    }
+  }
+}
+%enddef
+
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::EncodeAsPieces)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::EncodeAsIds)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::NBestEncodeAsPieces)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::NBestEncodeAsIds)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::SampleEncodeAsPieces)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::SampleEncodeAsIds)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::EncodeAsSerializedProto)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::SampleEncodeAsSerializedProto)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::NBestEncodeAsSerializedProto)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::DecodePieces)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::DecodePiecesAsSerializedProto)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::DecodeIdsWithCheck)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceProcessor::DecodeIdsAsSerializedProtoWithCheck)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceTrainer::_TrainFromString)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceTrainer::_TrainFromMap)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceTrainer::_TrainFromMap2)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceTrainer::_TrainFromMap3)
+SPM_RELEASE_GIL(sentencepiece::SentencePieceTrainer::_TrainFromMap4)
+
 %ignore sentencepiece::util::Status;
 %ignore sentencepiece::util::StatusCode;
 %ignore absl::string_view;
@@ -177,6 +430,10 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
 %ignore sentencepiece::SentencePieceProcessor::NBestEncode;
 %ignore sentencepiece::SentencePieceProcessor::Decode;
 %ignore sentencepiece::SentencePieceProcessor::DecodeIds;
+%ignore sentencepiece::SentencePieceProcessor::EncodeBatch;
+%ignore sentencepiece::SentencePieceProcessor::CountTokens;
+%ignore sentencepiece::SentencePieceProcessor::CountTokensBatch;
+%ignore sentencepiece::SentencePieceProcessor::DecodeBatch;
 %ignore sentencepiece::SentencePieceProcessor::DecodeIdsAsSerializedProto;
 %ignore sentencepiece::SentencePieceProcessor::model_proto;
 %ignore sentencepiece::SentencePieceProcessor::Load;
@@ -198,6 +455,40 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
     return $self->Load(arg);
   }
 
+  PyObject *_EncodeAsIdsBatch(const std::vector<std::string> &inputs,
+                              int num_threads, bool add_bos, bool add_eos,
+                              bool reverse) const {
+    std::vector<int32_t> ids;
+    std::vector<int64_t> offsets;
+    const auto _status = EncodeBatchWithoutGIL(
+        *$self, inputs, num_threads, add_bos, add_eos, reverse, &ids, &offsets);
+    if (!_status.ok()) throw _status;
+    return Py_BuildValue("(NN)", MakePyOutputArray(&ids),
+                         MakePyOutputArray(&offsets));
+  }
+
+  PyObject *_EncodeAsIdsBatchPadded(const std::vector<std::string> &inputs,
+                                    int num_threads, bool add_bos,
+                                    bool add_eos, bool reverse,
+                                    int pad_id) const {
+    std::vector<int32_t> ids;
+    std::vector<int64_t> offsets;
+    const auto _status = EncodeBatchWithoutGIL(
+        *$self, inputs, num_threads, add_bos, add_eos, reverse, &ids, &offsets);
+    if (!_status.ok()) throw _status;
+    size_t max_length = 0;
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+      max_length = std::max<size_t>(max_length, offsets[i + 1] - offsets[i]);
+    }
+    std::vector<int32_t> padded(inputs.size() * max_length, pad_id);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+      std::copy(ids.begin() + offsets[i], ids.begin() + offsets[i + 1],
+                padded.begin() + i * max_length);
+    }
+    return Py_BuildValue("(Nn)", MakePyOutputArray(&padded),
+                         static_cast<Py_ssize_t>(max_length));
+  }
+
   std::string DecodeIdsWithCheck(
       const std::vector<int> &ids) const {
     for (int id : ids)
@@ -347,6 +638,58 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
     return _encode(input)
 
 
+  def EncodeAsIdsArray(self,
+                       input,
+                       num_threads=None,
+                       add_bos=None,
+                       add_eos=None,
+                       reverse=None,
+                       pad_id=None):
+    """Encode a list of strings into NumPy int32 arrays in parallel.
+
+    The GIL is released while encoding, and no Python object is created
+    per token. Sampling is not supported.
+
+      Args:
+      input: list of strings.
+      num_threads: number of threads (Default = the number of CPUs)
+      add_bos: Add <s> to the result (Default = false)
+      add_eos: Add </s> to the result (Default = false) <s>/</s> is added after
+        reversing (if enabled).
+      reverse: Reverses the tokenized sequence (Default = false)
+      pad_id: When specified, returns a 2-D array padded with pad_id.
+
+      Returns:
+      (ids, offsets) where ids[offsets[i]:offsets[i + 1]] are the ids of
+      input[i], or a 2-D array of shape (len(input), max_length) when pad_id
+      is specified.
+    """
+
+    import multiprocessing
+    import numpy as np
+
+    if num_threads is None:
+      num_threads = multiprocessing.cpu_count()
+    if add_bos is None:
+      add_bos = self._add_bos
+    if add_eos is None:
+      add_eos = self._add_eos
+    if reverse is None:
+      reverse = self._reverse
+    add_bos, add_eos, reverse = bool(add_bos), bool(add_eos), bool(reverse)
+
+    if pad_id is None:
+      ids, offsets = self._EncodeAsIdsBatch(input, num_threads, add_bos,
+                                            add_eos, reverse)
+      return np.frombuffer(ids, dtype=np.int32), np.frombuffer(
+          offsets, dtype=np.int64)
+
+    ids, max_length = self._EncodeAsIdsBatchPadded(input, num_threads,
+                                                   add_bos, add_eos, reverse,
+                                                   pad_id)
+    return np.frombuffer(ids, dtype=np.int32).reshape(len(input), max_length)
+
+
   def Decode(self, input):
     """Decode processed id or token sequences."""
 
@@ -2773,7 +2773,10 @@ namespace swig {
 }
 
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <sentencepiece_processor.h>
 #include <sentencepiece_trainer.h>
 
@@ -2855,6 +2858,135 @@ PyObject* MakePyOutputBytes(const std::string& output) {
 #endif
 }
 
+// Python object which owns the result of EncodeAsIdsArray() and exports
+// it through the buffer protocol, so that numpy.frombuffer() wraps the
+// vector without copying it.
+struct PyOutputArray {
+  PyObject_HEAD
+  void *owner;
+  void (*deleter)(void *);
+  void *data;
+  Py_ssize_t shape[1];
+  Py_ssize_t strides[1];
+  char *format;
+};
+
+template <typename T>
+void DeleteVector(void *v) {
+  delete static_cast<std::vector<T> *>(v);
+}
+
+// struct module format of the elements.
+inline char *GetArrayFormat(int32_t) {
+  static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bit.");
+  return const_cast<char *>("i");
+}
+
+inline char *GetArrayFormat(int64_t) {
+  static_assert(sizeof(long long) == sizeof(int64_t),
+                "long long must be 64 bit.");
+  return const_cast<char *>("q");
+}
+
+int PyOutputArrayGetBuffer(PyObject *obj, Py_buffer *view, int flags) {
+  auto *self = reinterpret_cast<PyOutputArray *>(obj);
+  view->obj = obj;
+  Py_INCREF(obj);
+  view->buf = self->data;
+  view->len = self->shape[0] * self->strides[0];
+  view->readonly = 0;
+  view->itemsize = self->strides[0];
+  view->format = (flags & PyBUF_FORMAT) ? self->format : nullptr;
+  view->ndim = 1;
+  view->shape = (flags & PyBUF_ND) ? self->shape : nullptr;
+  view->strides =
+      ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) ? self->strides : nullptr;
+  view->suboffsets = nullptr;
+  view->internal = nullptr;
+  return 0;
+}
+
+void PyOutputArrayDealloc(PyObject *obj) {
+  auto *self = reinterpret_cast<PyOutputArray *>(obj);
+  self->deleter(self->owner);
+  Py_TYPE(obj)->tp_free(obj);
+}
+
+PyTypeObject *GetPyOutputArrayType() {
+  static PyBufferProcs buffer_procs;
+  static PyTypeObject type = {PyVarObject_HEAD_INIT(nullptr, 0)};
+  if (!(type.tp_flags & Py_TPFLAGS_READY)) {
+    buffer_procs.bf_getbuffer = PyOutputArrayGetBuffer;
+    type.tp_name = "sentencepiece._OutputArray";
+    type.tp_basicsize = sizeof(PyOutputArray);
+    type.tp_dealloc = PyOutputArrayDealloc;
+    type.tp_as_buffer = &buffer_procs;
+#if PY_VERSION_HEX >= 0x03000000
+    type.tp_flags = Py_TPFLAGS_DEFAULT;
+#else
+    type.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+    type.tp_doc = "Array of ids exported through the buffer protocol.";
+    if (PyType_Ready(&type) < 0) return nullptr;
+  }
+  return &type;
+}
+
+// Moves `output` to a new PyOutputArray.
+template <typename T>
+PyObject* MakePyOutputArray(std::vector<T> *output) {
+  PyTypeObject *type = GetPyOutputArrayType();
+  if (type == nullptr) return nullptr;
+  auto *self = PyObject_New(PyOutputArray, type);
+  if (self == nullptr) return nullptr;
+  auto *owner = new std::vector<T>(std::move(*output));
+  // The buffer of an empty array must not be null.
+  static T empty;
+  self->owner = owner;
+  self->deleter = &DeleteVector<T>;
+  self->data = owner->empty() ? &empty : owner->data();
+  self->shape[0] = owner->size();
+  self->strides[0] = sizeof(T);
+  self->format = GetArrayFormat(T());
+  return reinterpret_cast<PyObject *>(self);
+}
+
+// Encodes `inputs` in parallel while the GIL is released. `add_bos`,
+// `add_eos` and `reverse` are applied in the same way as
+// SentencePieceProcessor.Encode() in Python.
+sentencepiece::util::Status EncodeBatchWithoutGIL(
+    const sentencepiece::SentencePieceProcessor &sp,
+    const std::vector<std::string> &inputs, int num_threads,
+    bool add_bos, bool add_eos, bool reverse,
+    std::vector<int32_t> *ids, std::vector<int64_t> *offsets) {
+  static_assert(sizeof(int) == sizeof(int32_t), "int must be 32 bit.");
+  sentencepiece::util::Status status;
+  Py_BEGIN_ALLOW_THREADS;
+  const std::vector<absl::string_view> views(inputs.begin(), inputs.end());
+  std::vector<int> flat_ids;
+  std::vector<size_t> flat_offsets;
+  status = sp.EncodeBatch(views, num_threads, &flat_ids, &flat_offsets);
+  if (status.ok()) {
+    const int bos_id = sp.bos_id();
+    const int eos_id = sp.eos_id();
+    ids->reserve(flat_ids.size() + (add_bos + add_eos) * inputs.size());
+    offsets->reserve(flat_offsets.size());
+    offsets->push_back(0);
+    for (size_t i = 0; i + 1 < flat_offsets.size(); ++i) {
+      const auto begin = flat_ids.begin() + flat_offsets[i];
+      const auto end = flat_ids.begin() + flat_offsets[i + 1];
+      if (add_bos) ids->push_back(bos_id);
+      const size_t pos = ids->size();
+      ids->insert(ids->end(), begin, end);
+      if (reverse) std::reverse(ids->begin() + pos, ids->end());
+      if (add_eos) ids->push_back(eos_id);
+      offsets->push_back(ids->size());
+    }
+  }
+  Py_END_ALLOW_THREADS;
+  return status;
+}
+
 int ToSwigError(sentencepiece::util::StatusCode code) {
   switch (code) {
     case sentencepiece::util::StatusCode::kNotFound:
@@ -2869,11 +3001,17 @@ int ToSwigError(sentencepiece::util::StatusCode code) {
   return SWIG_RuntimeError;
 }
 
+// Adapts a Python iterator to SentenceIterator. The iterator may yield
+// either a single sentence (str/bytes) or a chunk of sentences, i.e., a
+// sequence (list, tuple, numpy array) of str/bytes, or a bytearray or
+// memoryview buffer with newline separators. A str/bytes item is always
+// one sentence, even if it contains newlines. Chunks are copied into C++
+// strings in bulk, so that the GIL is only acquired once per chunk.
 class PySentenceIterator : public sentencepiece::SentenceIterator {
   public:
+  // The GIL is held when the iterator is constructed in the typemap.
   PySentenceIterator(PyObject *iter) : iter_(iter) {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    FetchChunk();
   }
 
   ~PySentenceIterator() {
@@ -2881,16 +3019,19 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
   }
 
   bool done() const override {
-    return item_ == nullptr;
+    return !status_.ok() || pos_ >= sentences_.size();
   }
 
+  // Next() is called from the trainer while the GIL is released.
   void Next() override {
-    item_ = PyIter_Next(iter_);
-    CopyValue();
+    if (++pos_ < sentences_.size()) return;
+    const PyGILState_STATE state = PyGILState_Ensure();
+    FetchChunk();
+    PyGILState_Release(state);
   }
 
   const std::string &value() const override {
-    return value_;
+    return sentences_[pos_];
   }
 
   sentencepiece::util::Status status() const override {
@@ -2898,28 +3039,97 @@ class PySentenceIterator : public sentencepiece::SentenceIterator {
   }
 
   private:
-   void CopyValue() {
-     if (item_ == nullptr) return;
-     const PyInputString ustring(item_);
-     if (ustring.IsAvalable()) {
-       const char *data = ustring.data();
-       size_t size = ustring.size();
-       while (size > 0) {
-         if (data[size - 1] == '\r' || data[size - 1] == '\n')
-           --size;
-         else
-           break;
+   // Pulls items until at least one sentence is available or the
+   // iterator is exhausted.
+   void FetchChunk() {
+     sentences_.clear();
+     pos_ = 0;
+     while (status_.ok() && sentences_.empty()) {
+       PyObject *item = PyIter_Next(iter_);
+       if (item == nullptr) {
+         if (PyErr_Occurred()) {
+           PyErr_Clear();
+           status_ = sentencepiece::util::Status(
+               sentencepiece::util::StatusCode::kInternal,
+               "sentence_iterator raised an exception.");
+         }
+         return;
        }
-       value_.assign(data, size);
-     } else {
-       status_ = sentencepiece::util::Status(sentencepiece::util::StatusCode::kInternal,
-                                             "Not a string.");
+       AddItem(item);
+       Py_XDECREF(item);
+     }
+   }
+
+   void AddItem(PyObject *item) {
+     if (AddSentence(item)) return;
+     if (PyByteArray_Check(item) || PyMemoryView_Check(item)) {
+       AddBuffer(item);
+       return;
+     }
+     PyObject *seq = PySequence_Fast(item, "");
+     if (seq == nullptr) {
+       PyErr_Clear();
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, "Not a string.");
+       return;
      }
-     Py_XDECREF(item_);
+     const Py_ssize_t size = PySequence_Fast_GET_SIZE(seq);
+     PyObject **items = PySequence_Fast_ITEMS(seq);
+     for (Py_ssize_t i = 0; i < size; ++i) {
+       if (!AddSentence(items[i])) {
+         status_ = sentencepiece::util::Status(
+             sentencepiece::util::StatusCode::kInternal, "Not a string.");
+         break;
+       }
+     }
+     Py_DECREF(seq);
    }
+
+   // Adds a str/bytes object as one sentence without the trailing
+   // newlines. Returns false if |obj| is not a string.
+   bool AddSentence(PyObject *obj) {
+     const PyInputString ustring(obj);
+     if (!ustring.IsAvalable()) return false;
+     const char *data = ustring.data();
+     size_t size = ustring.size();
+     while (size > 0) {
+       if (data[size - 1] == '\r' || data[size - 1] == '\n')
+         --size;
+       else
+         break;
+     }
+     sentences_.emplace_back(data, size);
+     ReleaseResultObject(ustring.input_type());
+     return true;
+   }
+
+   // Splits a bytearray/memoryview into lines. '\r' before '\n' is
+   // removed as in the file reader.
+   void AddBuffer(PyObject *obj) {
+     Py_buffer view;
+     if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) != 0) {
+       PyErr_Clear();
+       status_ = sentencepiece::util::Status(
+           sentencepiece::util::StatusCode::kInternal, "Not a string.");
+       return;
+     }
+     const char *begin = static_cast<const char *>(view.buf);
+     const char *end = begin + view.len;
+     while (begin < end) {
+       const char *eol = static_cast<const char *>(
+           memchr(begin, '\n', end - begin));
+       const char *next = eol == nullptr ? end : eol + 1;
+       if (eol == nullptr) eol = end;
+       while (eol > begin && eol[-1] == '\r') --eol;
+       sentences_.emplace_back(begin, eol - begin);
+       begin = next;
+     }
+     PyBuffer_Release(&view);
+   }
+
    PyObject *iter_ = nullptr;
-   PyObject *item_ = nullptr;
-   std::string value_;
+   std::vector<std::string> sentences_;
+   size_t pos_ = 0;
    sentencepiece::util::Status status_;
 };
 }
@@ -3282,9 +3492,49 @@ SWIGINTERNINLINE PyObject*
   return PyBool_FromLong(value ? 1 : 0);
 }
 
+SWIGINTERN int
+SWIG_AsVal_bool (PyObject *obj, bool *val)
+{
+  int r;
+  if (!PyBool_Check(obj))
+    return SWIG_ERROR;
+  r = PyObject_IsTrue(obj);
+  if (r == -1)
+    return SWIG_ERROR;
+  if (val) *val = r ? true : false;
+  return SWIG_OK;
+}
+
 SWIGINTERN sentencepiece::util::Status sentencepiece_SentencePieceProcessor_LoadFromFile(sentencepiece::SentencePieceProcessor *self,absl::string_view arg){
     return self->Load(arg);
   }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeAsIdsBatch(sentencepiece::SentencePieceProcessor const *self,std::vector< std::string > const &inputs,int num_threads,bool add_bos,bool add_eos,bool reverse){
+    std::vector<int32_t> ids;
+    std::vector<int64_t> offsets;
+    const auto _status = EncodeBatchWithoutGIL(
+        *self, inputs, num_threads, add_bos, add_eos, reverse, &ids, &offsets);
+    if (!_status.ok()) throw _status;
+    return Py_BuildValue("(NN)", MakePyOutputArray(&ids),
+                         MakePyOutputArray(&offsets));
+  }
+SWIGINTERN PyObject *sentencepiece_SentencePieceProcessor__EncodeAsIdsBatchPadded(sentencepiece::SentencePieceProcessor const *self,std::vector< std::string > const &inputs,int num_threads,bool add_bos,bool add_eos,bool reverse,int pad_id){
+    std::vector<int32_t> ids;
+    std::vector<int64_t> offsets;
+    const auto _status = EncodeBatchWithoutGIL(
+        *self, inputs, num_threads, add_bos, add_eos, reverse, &ids, &offsets);
+    if (!_status.ok()) throw _status;
+    size_t max_length = 0;
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+      max_length = std::max<size_t>(max_length, offsets[i + 1] - offsets[i]);
+    }
+    std::vector<int32_t> padded(inputs.size() * max_length, pad_id);
+    for (size_t i = 0; i + 1 < offsets.size(); ++i) {
+      std::copy(ids.begin() + offsets[i], ids.begin() + offsets[i + 1],
+                padded.begin() + i * max_length);
+    }
+    return Py_BuildValue("(Nn)", MakePyOutputArray(&padded),
+                         static_cast<Py_ssize_t>(max_length));
+  }
 SWIGINTERN std::string sentencepiece_SentencePieceProcessor_DecodeIdsWithCheck(sentencepiece::SentencePieceProcessor const *self,std::vector< int > const &ids){
     for (int id : ids)
       if (id < 0 || id >= self->GetPieceSize())
@@ -3832,12 +4082,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_EncodeAsPieces(PyObject *SWIGU
     arg2 = absl::string_view(ustring.data(), ustring.size());
   }
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsPieces(arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsPieces(arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -3878,12 +4137,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_EncodeAsIds(PyObject *SWIGUNUS
     arg2 = absl::string_view(ustring.data(), ustring.size());
   }
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsIds(arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsIds(arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -3931,12 +4199,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_NBestEncodeAsPieces(PyObject *
   } 
   arg3 = static_cast< int >(val3);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsPieces(arg2,arg3);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsPieces(arg2,arg3);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -3989,12 +4266,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_NBestEncodeAsIds(PyObject *SWI
   } 
   arg3 = static_cast< int >(val3);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsIds(arg2,arg3);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsIds(arg2,arg3);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4054,12 +4340,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SampleEncodeAsPieces(PyObject
   } 
   arg4 = static_cast< float >(val4);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsPieces(arg2,arg3,arg4);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsPieces(arg2,arg3,arg4);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4116,12 +4411,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SampleEncodeAsIds(PyObject *SW
   } 
   arg4 = static_cast< float >(val4);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsIds(arg2,arg3,arg4);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsIds(arg2,arg3,arg4);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4173,12 +4477,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_DecodePieces(PyObject *SWIGUNU
     arg2 = out;
   }
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->DecodePieces((std::vector< std::string > const &)*arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->DecodePieces((std::vector< std::string > const &)*arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4222,12 +4535,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_EncodeAsSerializedProto(PyObje
     arg2 = absl::string_view(ustring.data(), ustring.size());
   }
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsSerializedProto(arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->EncodeAsSerializedProto(arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4280,12 +4602,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_SampleEncodeAsSerializedProto(
   } 
   arg4 = static_cast< float >(val4);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsSerializedProto(arg2,arg3,arg4);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->SampleEncodeAsSerializedProto(arg2,arg3,arg4);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4330,12 +4661,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_NBestEncodeAsSerializedProto(P
   } 
   arg3 = static_cast< int >(val3);
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsSerializedProto(arg2,arg3);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->NBestEncodeAsSerializedProto(arg2,arg3);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4384,12 +4724,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_DecodePiecesAsSerializedProto(
     arg2 = out;
   }
   {
-    try {
-      result = ((sentencepiece::SentencePieceProcessor const *)arg1)->DecodePiecesAsSerializedProto((std::vector< std::string > const &)*arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = ((sentencepiece::SentencePieceProcessor const *)arg1)->DecodePiecesAsSerializedProto((std::vector< std::string > const &)*arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -4911,6 +5260,194 @@ fail:
 }
 
 
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsIdsBatch(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  std::vector< std::string > *arg2 = 0 ;
+  int arg3 ;
+  bool arg4 ;
+  bool arg5 ;
+  bool arg6 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val3 ;
+  int ecode3 = 0 ;
+  bool val4 ;
+  int ecode4 = 0 ;
+  bool val5 ;
+  int ecode5 = 0 ;
+  bool val6 ;
+  int ecode6 = 0 ;
+  PyObject *swig_obj[6] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeAsIdsBatch", 6, 6, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeAsIdsBatch" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    std::vector<std::string> *out = nullptr;
+    if (PyList_Check(swig_obj[1])) {
+      const size_t size = PyList_Size(swig_obj[1]);
+      out = new std::vector<std::string>(size);
+      for (size_t i = 0; i < size; ++i) {
+        const PyInputString ustring(PyList_GetItem(swig_obj[1], i));
+        if (ustring.IsAvalable()) {
+          (*out)[i] = std::string(ustring.data(), ustring.size());
+        } else {
+          PyErr_SetString(PyExc_TypeError, "list must contain strings");
+          SWIG_fail;
+        }
+        resultobj = ustring.input_type();
+      }
+    } else {
+      PyErr_SetString(PyExc_TypeError, "not a list");
+      SWIG_fail;
+    }
+    arg2 = out;
+  }
+  ecode3 = SWIG_AsVal_int(swig_obj[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "SentencePieceProcessor__EncodeAsIdsBatch" "', argument " "3"" of type '" "int""'");
+  } 
+  arg3 = static_cast< int >(val3);
+  ecode4 = SWIG_AsVal_bool(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeAsIdsBatch" "', argument " "4"" of type '" "bool""'");
+  } 
+  arg4 = static_cast< bool >(val4);
+  ecode5 = SWIG_AsVal_bool(swig_obj[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "SentencePieceProcessor__EncodeAsIdsBatch" "', argument " "5"" of type '" "bool""'");
+  } 
+  arg5 = static_cast< bool >(val5);
+  ecode6 = SWIG_AsVal_bool(swig_obj[5], &val6);
+  if (!SWIG_IsOK(ecode6)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode6), "in method '" "SentencePieceProcessor__EncodeAsIdsBatch" "', argument " "6"" of type '" "bool""'");
+  } 
+  arg6 = static_cast< bool >(val6);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeAsIdsBatch((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::string > const &)*arg2,arg3,arg4,arg5,arg6);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  {
+    delete arg2;
+  }
+  return resultobj;
+fail:
+  {
+    delete arg2;
+  }
+  return NULL;
+}
+
+
+SWIGINTERN PyObject *_wrap_SentencePieceProcessor__EncodeAsIdsBatchPadded(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
+  PyObject *resultobj = 0;
+  sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
+  std::vector< std::string > *arg2 = 0 ;
+  int arg3 ;
+  bool arg4 ;
+  bool arg5 ;
+  bool arg6 ;
+  int arg7 ;
+  void *argp1 = 0 ;
+  int res1 = 0 ;
+  int val3 ;
+  int ecode3 = 0 ;
+  bool val4 ;
+  int ecode4 = 0 ;
+  bool val5 ;
+  int ecode5 = 0 ;
+  bool val6 ;
+  int ecode6 = 0 ;
+  int val7 ;
+  int ecode7 = 0 ;
+  PyObject *swig_obj[7] ;
+  PyObject *result = 0 ;
+  
+  if (!SWIG_Python_UnpackTuple(args, "SentencePieceProcessor__EncodeAsIdsBatchPadded", 7, 7, swig_obj)) SWIG_fail;
+  res1 = SWIG_ConvertPtr(swig_obj[0], &argp1,SWIGTYPE_p_sentencepiece__SentencePieceProcessor, 0 |  0 );
+  if (!SWIG_IsOK(res1)) {
+    SWIG_exception_fail(SWIG_ArgError(res1), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "1"" of type '" "sentencepiece::SentencePieceProcessor const *""'"); 
+  }
+  arg1 = reinterpret_cast< sentencepiece::SentencePieceProcessor * >(argp1);
+  {
+    std::vector<std::string> *out = nullptr;
+    if (PyList_Check(swig_obj[1])) {
+      const size_t size = PyList_Size(swig_obj[1]);
+      out = new std::vector<std::string>(size);
+      for (size_t i = 0; i < size; ++i) {
+        const PyInputString ustring(PyList_GetItem(swig_obj[1], i));
+        if (ustring.IsAvalable()) {
+          (*out)[i] = std::string(ustring.data(), ustring.size());
+        } else {
+          PyErr_SetString(PyExc_TypeError, "list must contain strings");
+          SWIG_fail;
+        }
+        resultobj = ustring.input_type();
+      }
+    } else {
+      PyErr_SetString(PyExc_TypeError, "not a list");
+      SWIG_fail;
+    }
+    arg2 = out;
+  }
+  ecode3 = SWIG_AsVal_int(swig_obj[2], &val3);
+  if (!SWIG_IsOK(ecode3)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode3), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "3"" of type '" "int""'");
+  } 
+  arg3 = static_cast< int >(val3);
+  ecode4 = SWIG_AsVal_bool(swig_obj[3], &val4);
+  if (!SWIG_IsOK(ecode4)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode4), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "4"" of type '" "bool""'");
+  } 
+  arg4 = static_cast< bool >(val4);
+  ecode5 = SWIG_AsVal_bool(swig_obj[4], &val5);
+  if (!SWIG_IsOK(ecode5)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode5), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "5"" of type '" "bool""'");
+  } 
+  arg5 = static_cast< bool >(val5);
+  ecode6 = SWIG_AsVal_bool(swig_obj[5], &val6);
+  if (!SWIG_IsOK(ecode6)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode6), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "6"" of type '" "bool""'");
+  } 
+  arg6 = static_cast< bool >(val6);
+  ecode7 = SWIG_AsVal_int(swig_obj[6], &val7);
+  if (!SWIG_IsOK(ecode7)) {
+    SWIG_exception_fail(SWIG_ArgError(ecode7), "in method '" "SentencePieceProcessor__EncodeAsIdsBatchPadded" "', argument " "7"" of type '" "int""'");
+  } 
+  arg7 = static_cast< int >(val7);
+  {
+    try {
+      result = (PyObject *)sentencepiece_SentencePieceProcessor__EncodeAsIdsBatchPadded((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< std::string > const &)*arg2,arg3,arg4,arg5,arg6,arg7);
+      ReleaseResultObject(resultobj);
+    }
+    catch (const sentencepiece::util::Status &status) {
+      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+    }
+  }
+  resultobj = result;
+  {
+    delete arg2;
+  }
+  return resultobj;
+fail:
+  {
+    delete arg2;
+  }
+  return NULL;
+}
+
+
 SWIGINTERN PyObject *_wrap_SentencePieceProcessor_DecodeIdsWithCheck(PyObject *SWIGUNUSEDPARM(self), PyObject *args) {
   PyObject *resultobj = 0;
   sentencepiece::SentencePieceProcessor *arg1 = (sentencepiece::SentencePieceProcessor *) 0 ;
@@ -4947,12 +5484,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_DecodeIdsWithCheck(PyObject *S
     arg2 = out;
   }
   {
-    try {
-      result = sentencepiece_SentencePieceProcessor_DecodeIdsWithCheck((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = sentencepiece_SentencePieceProcessor_DecodeIdsWithCheck((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -5007,12 +5553,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceProcessor_DecodeIdsAsSerializedProtoWith
     arg2 = out;
   }
   {
-    try {
-      result = sentencepiece_SentencePieceProcessor_DecodeIdsAsSerializedProtoWithCheck((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = sentencepiece_SentencePieceProcessor_DecodeIdsAsSerializedProtoWithCheck((sentencepiece::SentencePieceProcessor const *)arg1,(std::vector< int > const &)*arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -5088,12 +5643,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromString(PyObject *SWIGU
     arg1 = absl::string_view(ustring.data(), ustring.size());
   }
   {
-    try {
-      sentencepiece_SentencePieceTrainer__TrainFromString(arg1);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        sentencepiece_SentencePieceTrainer__TrainFromString(arg1);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   resultobj = SWIG_Py_Void();
@@ -5135,12 +5699,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromMap(PyObject *SWIGUNUS
     arg1 = out;
   }
   {
-    try {
-      sentencepiece_SentencePieceTrainer__TrainFromMap((std::unordered_map< std::string,std::string > const &)*arg1);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        sentencepiece_SentencePieceTrainer__TrainFromMap((std::unordered_map< std::string,std::string > const &)*arg1);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   resultobj = SWIG_Py_Void();
@@ -5198,12 +5771,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromMap2(PyObject *SWIGUNU
     arg2 = out;
   }
   {
-    try {
-      sentencepiece_SentencePieceTrainer__TrainFromMap2((std::unordered_map< std::string,std::string > const &)*arg1,arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        sentencepiece_SentencePieceTrainer__TrainFromMap2((std::unordered_map< std::string,std::string > const &)*arg1,arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   resultobj = SWIG_Py_Void();
@@ -5258,12 +5840,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromMap3(PyObject *SWIGUNU
     arg1 = out;
   }
   {
-    try {
-      result = sentencepiece_SentencePieceTrainer__TrainFromMap3((std::unordered_map< std::string,std::string > const &)*arg1);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = sentencepiece_SentencePieceTrainer__TrainFromMap3((std::unordered_map< std::string,std::string > const &)*arg1);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -5324,12 +5915,21 @@ SWIGINTERN PyObject *_wrap_SentencePieceTrainer__TrainFromMap4(PyObject *SWIGUNU
     arg2 = out;
   }
   {
-    try {
-      result = sentencepiece_SentencePieceTrainer__TrainFromMap4((std::unordered_map< std::string,std::string > const &)*arg1,arg2);
+    {
+      sentencepiece::util::Status _gil_status;
+      Py_BEGIN_ALLOW_THREADS;
+      try {
+        result = sentencepiece_SentencePieceTrainer__TrainFromMap4((std::unordered_map< std::string,std::string > const &)*arg1,arg2);
+      }
+      catch (const sentencepiece::util::Status &status) {
+        _gil_status = status;
+      }
+      Py_END_ALLOW_THREADS;
       ReleaseResultObject(resultobj);
-    }
-    catch (const sentencepiece::util::Status &status) {
-      SWIG_exception(ToSwigError(status.code()), status.ToString().c_str());
+      if (!_gil_status.ok()) {
+        SWIG_exception(ToSwigError(_gil_status.code()),
+          _gil_status.ToString().c_str());
+      }
     }
   }
   {
@@ -5397,6 +5997,8 @@ static PyMethodDef SwigMethods[] = {
 	 { "SentencePieceProcessor_pad_id", _wrap_SentencePieceProcessor_pad_id, METH_O, NULL},
 	 { "SentencePieceProcessor_serialized_model_proto", _wrap_SentencePieceProcessor_serialized_model_proto, METH_O, NULL},
 	 { "SentencePieceProcessor_LoadFromFile", _wrap_SentencePieceProcessor_LoadFromFile, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__EncodeAsIdsBatch", _wrap_SentencePieceProcessor__EncodeAsIdsBatch, METH_VARARGS, NULL},
+	 { "SentencePieceProcessor__EncodeAsIdsBatchPadded", _wrap_SentencePieceProcessor__EncodeAsIdsBatchPadded, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_DecodeIdsWithCheck", _wrap_SentencePieceProcessor_DecodeIdsWithCheck, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_DecodeIdsAsSerializedProtoWithCheck", _wrap_SentencePieceProcessor_DecodeIdsAsSerializedProtoWithCheck, METH_VARARGS, NULL},
 	 { "SentencePieceProcessor_swigregister", SentencePieceProcessor_swigregister, METH_O, NULL},
@@ -16,8 +16,12 @@
 # limitations under the License.!
 
 import codecs
+import faulthandler
 import io
 import sentencepiece as spm
+import shutil
+import tempfile
+import threading
 import unittest
 import sys
 import os
@@ -188,6 +192,35 @@ class TestSentencepieceProcessor(unittest.TestCase):
     self.assertEqual([sp1.id_to_piece(i) for i in range(sp1.get_piece_size())],
                      [sp2.id_to_piece(i) for i in range(sp2.get_piece_size())])
 
+  def test_train_with_chunked_iterator(self):
+    with open(os.path.join(data_dir, 'botchan.txt'), 'rb') as f:
+      data = f.read()
+    lines = data.decode('utf-8').splitlines()
+
+    def _chunks(size):
+      for i in range(0, len(lines), size):
+        yield lines[i:i + size]
+
+    def _buffers(size):
+      begin = 0
+      while begin < len(data):
+        end = data.find(b'\n', begin + size)
+        end = len(data) if end < 0 else end + 1
+        yield memoryview(data)[begin:end]
+        begin = end
+
+    def _train(iterator):
+      model = io.BytesIO()
+      spm.SentencePieceTrainer.train(
+          sentence_iterator=iterator, model_writer=model, vocab_size=1000)
+      sp = spm.SentencePieceProcessor(model_proto=model.getvalue())
+      return [sp.id_to_piece(i) for i in range(sp.get_piece_size())]
+
+    expected = _train(iter(lines))
+    self.assertEqual(expected, _train(_chunks(1000)))
+    self.assertEqual(expected, _train(iter([bytearray(data)])))
+    self.assertEqual(expected, _train(_buffers(10000)))
+
   def test_train_kwargs(self):
     spm.SentencePieceTrainer.train(
         input=[os.path.join(data_dir, 'botchan.txt')],
@@ -372,6 +405,135 @@ class TestSentencepieceProcessor(unittest.TestCase):
       ++ids2[' '.join(sp.encode('hello world', enable_sampling=False))]
     self.assertEqual(len(ids2), 1)
 
+  def test_encode_as_ids_array_buffer(self):
+    # The arrays passed to numpy.frombuffer() by EncodeAsIdsArray(), checked
+    # through memoryview so that numpy is not needed.
+    texts = [
+        'hello world', '', 'this is a test.', 'I saw a girl with a telescope.'
+    ] * 10
+    expected = self.sp_.encode(texts, out_type=int)
+
+    ids, offsets = self.sp_._EncodeAsIdsBatch(texts, 4, False, False, False)
+    ids, offsets = memoryview(ids), memoryview(offsets)
+    self.assertEqual('i', ids.format)
+    self.assertEqual(4, ids.itemsize)
+    self.assertEqual('q', offsets.format)
+    self.assertEqual(8, offsets.itemsize)
+    self.assertFalse(ids.readonly)
+    self.assertEqual(sum(len(v) for v in expected), len(ids))
+    self.assertEqual(len(texts) + 1, len(offsets))
+    for i, v in enumerate(expected):
+      self.assertEqual(v, ids[offsets[i]:offsets[i + 1]].tolist())
+
+    padded, max_length = self.sp_._EncodeAsIdsBatchPadded(
+        texts, 4, True, False, False, -1)
+    padded = memoryview(padded)
+    self.assertEqual('i', padded.format)
+    self.assertEqual(max(len(v) for v in expected) + 1, max_length)
+    self.assertEqual(len(texts) * max_length, len(padded))
+    for i, v in enumerate(expected):
+      row = [self.sp_.bos_id()] + v
+      self.assertEqual(row + [-1] * (max_length - len(row)),
+                       padded[i * max_length:(i + 1) * max_length].tolist())
+
+    ids, offsets = self.sp_._EncodeAsIdsBatch([], 4, False, False, False)
+    self.assertEqual([], memoryview(ids).tolist())
+    self.assertEqual([0], memoryview(offsets).tolist())
+
+  def test_encode_as_ids_array(self):
+    try:
+      import numpy as np
+    except ImportError:
+      self.skipTest('numpy is not available.')
+
+    texts = [
+        'hello world', '', 'this is a test.', 'I saw a girl with a telescope.'
+    ] * 10
+    expected = self.sp_.encode(texts, out_type=int)
+
+    ids, offsets = self.sp_.encode_as_ids_array(texts, num_threads=4)
+    self.assertEqual(np.int32, ids.dtype)
+    self.assertEqual(len(texts) + 1, len(offsets))
+    for i, v in enumerate(expected):
+      self.assertEqual(v, ids[offsets[i]:offsets[i + 1]].tolist())
+
+    ids, offsets = self.sp_.encode_as_ids_array(
+        texts, add_bos=True, add_eos=True, reverse=True)
+    expected = self.sp_.encode(
+        texts, out_type=int, add_bos=True, add_eos=True, reverse=True)
+    for i, v in enumerate(expected):
+      self.assertEqual(v, ids[offsets[i]:offsets[i + 1]].tolist())
+
+    padded = self.sp_.encode_as_ids_array(texts, pad_id=-1)
+    max_length = max(len(v) for v in expected) - 2
+    self.assertEqual((len(texts), max_length), padded.shape)
+    for i, v in enumerate(self.sp_.encode(texts, out_type=int)):
+      self.assertEqual(v + [-1] * (max_length - len(v)), padded[i].tolist())
+
+  def test_encode_decode_in_threads(self):
+    # Checks that concurrent calls give the same results as serial calls.
+    # This does not verify that encode and decode release the GIL, as
+    # neither of them calls back into Python, so no handshake with another
+    # thread can be made during the call. Only training is verified by
+    # test_train_releases_gil below.
+    texts = []
+    with codecs.open(os.path.join(data_dir, 'botchan.txt'), 'r', 'utf-8') as f:
+      for line in f:
+        texts.append(line.rstrip())
+    expected = [self.sp_.encode(text) for text in texts]
+    expected_texts = [self.sp_.decode(ids) for ids in expected]
+
+    num_threads = 4
+    results = [None] * num_threads
+    decoded = [None] * num_threads
+
+    def _target(n):
+      results[n] = [
+          self.sp_.encode(texts[i]) for i in range(n, len(texts), num_threads)
+      ]
+      decoded[n] = [self.sp_.decode(ids) for ids in results[n]]
+
+    threads = [
+        threading.Thread(target=_target, args=(n,)) for n in range(num_threads)
+    ]
+    for t in threads:
+      t.start()
+    for t in threads:
+      t.join()
+    for n in range(num_threads):
+      self.assertEqual(expected[n::num_threads], results[n])
+      self.assertEqual(expected_texts[n::num_threads], decoded[n])
+
+  @unittest.skipIf(not hasattr(os, 'mkfifo'), 'os.mkfifo is not available.')
+  def test_train_releases_gil(self):
+    # The trainer reads its input from a FIFO written by another Python
+    # thread, which can only run while the trainer does not hold the GIL.
+    with open(os.path.join(data_dir, 'botchan.txt'), 'rb') as f:
+      data = f.read()
+    tmp_dir = tempfile.mkdtemp()
+    fifo = os.path.join(tmp_dir, 'input.txt')
+    os.mkfifo(fifo)
+
+    def _write():
+      with open(fifo, 'wb') as f:
+        f.write(data)
+
+    writer = threading.Thread(target=_write)
+    writer.daemon = True
+    writer.start()
+    # Aborts with a traceback instead of hanging when the GIL is held.
+    faulthandler.dump_traceback_later(300, exit=True)
+    try:
+      model = io.BytesIO()
+      spm.SentencePieceTrainer.train(
+          input=fifo, model_writer=model, vocab_size=1000)
+    finally:
+      faulthandler.cancel_dump_traceback_later()
+      writer.join()
+      shutil.rmtree(tmp_dir)
+    sp = spm.SentencePieceProcessor(model_proto=model.getvalue())
+    self.assertEqual(1000, sp.get_piece_size())
+
   def test_valid_range(self):
     size = self.sp_.piece_size()
     funcs = [
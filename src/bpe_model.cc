@@ -35,8 +35,10 @@ Model::Model(const ModelProto &model_proto) {
 
 Model::~Model() {}
 
-std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
-    absl::string_view normalized, float alpha) const {
+EncodeResult Model::SampleEncodeInternal(
+    absl::string_view normalized, float alpha,
+    random::PhiloxRandomGenerator *rand_gen,
+    const VocabularyMask *mask) const {
   if (!status().ok() || normalized.empty()) {
     return {};
   }
@@ -46,6 +48,7 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     int right;    // right index of this pair
     float score;  // score of this pair. large is better.
     size_t size;  // length of this piece
+    int id;       // vocab id of this piece
   };
 
   class SymbolPairComparator {
@@ -60,12 +63,15 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     int prev;     // prev index of this symbol. -1 for BOS.
     int next;     // next index of tihs symbol. -1 for EOS.
     bool freeze;  // this symbol is never be merged.
+    int id;       // vocab id of a merged symbol. -1 if not looked up yet.
     absl::string_view piece;
   };
 
   using Agenda = std::priority_queue<SymbolPair *, std::vector<SymbolPair *>,
                                      SymbolPairComparator>;
-  Agenda agenda;
+  std::vector<SymbolPair *> agenda_storage;
+  agenda_storage.reserve(normalized.size());
+  Agenda agenda(SymbolPairComparator(), std::move(agenda_storage));
   std::vector<Symbol> symbols;
   symbols.reserve(normalized.size());
 
@@ -81,8 +87,8 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
   model::FreeList<SymbolPair> symbol_pair_allocator(kPreallocateSymbolPairSize);
 
   // Lookup new symbol pair at [left, right] and inserts it to agenda.
-  auto MaybeAddNewSymbolPair = [this, &symbol_pair_allocator, &symbols, &agenda,
-                                &rev_merge](int left, int right) {
+  auto MaybeAddNewSymbolPair = [this, mask, &symbol_pair_allocator, &symbols,
+                                &agenda, &rev_merge](int left, int right) {
     if (left == -1 || right == -1 || symbols[left].freeze ||
         symbols[right].freeze)
       return;
@@ -98,10 +104,11 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     h->right = right;
     h->score = GetScore(it->second);
     h->size = piece.size();
+    h->id = it->second;
     agenda.push(h);
 
     // Makes `rev_merge` for resegmentation.
-    if (IsUnusedInlined(it->second)) {
+    if (IsUnusedInlined(it->second, mask)) {
       rev_merge[piece] =
           std::make_pair(symbols[left].piece, symbols[right].piece);
     }
@@ -112,6 +119,7 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
   while (!normalized.empty()) {
     Symbol s;
     const int mblen = matcher_->PrefixMatch(normalized, &s.freeze);
+    s.id = -1;
     s.piece = absl::string_view(normalized.data(), mblen);
     s.prev = index == 0 ? -1 : index - 1;
     normalized.remove_prefix(mblen);
@@ -130,14 +138,26 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
   }
 
   // BPE-dropout: https://arxiv.org/pdf/1910.13267.pdf
-  std::mt19937 *rand_gen = nullptr;
-  auto skip_merge = [&]() {
-    if (alpha <= 0.0) return false;
-    if (alpha >= 1.0) return true;
-    if (rand_gen == nullptr) rand_gen = random::GetRandomGenerator();
-    std::uniform_real_distribution<> gen(0.0, 1.0);
-    return gen(*rand_gen) < alpha;
-  };
+  // A merge is skipped when a 32-bit random integer is below
+  // alpha * 2^32, which avoids constructing a distribution and converting
+  // to floating point per merge. The integers are drawn in blocks, so the
+  // merge loop only pays a load and a comparison per decision. Without
+  // `rand_gen`, a counter-based stream is keyed by one draw from the
+  // thread-local generator per sentence.
+  const bool dropout = alpha > 0.0 && alpha < 1.0;
+  const bool skip_all = alpha >= 1.0;
+  const uint32 dropout_threshold =
+      dropout ? static_cast<uint32>(alpha * 4294967296.0) : 0;
+  random::PhiloxRandomGenerator sentence_gen(0, 0);
+  if (dropout && rand_gen == nullptr) {
+    auto *mt = random::GetRandomGenerator();
+    const uint64 seed = (static_cast<uint64>((*mt)()) << 32) | (*mt)();
+    sentence_gen = random::PhiloxRandomGenerator(seed, 0);
+    rand_gen = &sentence_gen;
+  }
+  constexpr size_t kDropoutBlockSize = 64;
+  uint32 dropout_block[kDropoutBlockSize];
+  size_t dropout_index = kDropoutBlockSize;
 
   // Main loop.
   while (!agenda.empty()) {
@@ -154,12 +174,21 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     // Note that orignal BPE-dropout paper assumes that all merged symbols are
     // pre computed, but here we randomly skip merge opration inside this loop.
     // This implemenation is theoretically equivalent to the original one.
-    if (skip_merge()) continue;
+    if (dropout) {
+      if (dropout_index == kDropoutBlockSize) {
+        rand_gen->Fill(dropout_block, kDropoutBlockSize);
+        dropout_index = 0;
+      }
+      if (dropout_block[dropout_index++] < dropout_threshold) continue;
+    } else if (skip_all) {
+      continue;
+    }
 
     // Replaces symbols with `top` rule.
     symbols[top->left].piece = absl::string_view(
         symbols[top->left].piece.data(),
         symbols[top->left].piece.size() + symbols[top->right].piece.size());
+    symbols[top->left].id = top->id;
 
     // Updates prev/next pointers.
     symbols[top->left].next = symbols[top->right].next;
@@ -173,11 +202,12 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
     MaybeAddNewSymbolPair(top->left, symbols[top->left].next);
   }
 
-  std::function<void(absl::string_view, EncodeResult *)> resegment;
-  resegment = [this, &resegment, &rev_merge](absl::string_view w,
-                                             EncodeResult *output) -> void {
-    const int id = PieceToId(w);
-    if (id == -1 || !IsUnusedInlined(id)) {
+  // Resegments the pieces disallowed by `mask` or unused into the pieces
+  // they were merged from.
+  std::function<void(absl::string_view, int, EncodeResult *)> resegment;
+  resegment = [this, mask, &resegment, &rev_merge](
+                  absl::string_view w, int id, EncodeResult *output) -> void {
+    if (id == -1 || !IsUnusedInlined(id, mask)) {
       output->emplace_back(w, id);
       return;
     }
@@ -189,15 +219,23 @@ std::vector<std::pair<absl::string_view, int>> Model::SampleEncode(
       return;
     }
     // Recursively resegment left and right symbols.
-    resegment(p->second.first, output);
-    resegment(p->second.second, output);
+    resegment(p->second.first, PieceToId(p->second.first), output);
+    resegment(p->second.second, PieceToId(p->second.second), output);
   };
 
+  // The ids of the merged symbols are taken from the agenda, so only the
+  // symbols never merged are looked up again.
   EncodeResult output;
   for (int index = 0; index != -1; index = symbols[index].next) {
     CHECK_GE(index, 0);
     CHECK_LT(index, static_cast<int>(symbols.size()));
-    resegment(symbols[index].piece, &output);
+    const auto &s = symbols[index];
+    const int id = s.id >= 0 ? s.id : PieceToId(s.piece);
+    if (rev_merge.empty()) {
+      output.emplace_back(s.piece, id);
+    } else {
+      resegment(s.piece, id, &output);
+    }
   }
 
   return output;
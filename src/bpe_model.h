@@ -41,11 +41,47 @@ class Model : public ModelInterface {
   // Skips merge operation with `alpha` probability.
   // When alpha <= 0.0, no sampling is performed.
   EncodeResult SampleEncode(absl::string_view normalized,
-                            float alpha) const override;
+                            float alpha) const override {
+    return SampleEncode(normalized, alpha, nullptr);
+  }
+
+  // Same as above, but draws random numbers from `rand_gen`.
+  // Uses the thread-local generator when `rand_gen` is nullptr. Note that
+  // the thread-local generator only seeds a counter-based stream per
+  // sentence, so a seed given to SetRandomGeneratorSeed() samples different
+  // segmentations than 0.1.94 and earlier, with the same distribution.
+  EncodeResult SampleEncode(
+      absl::string_view normalized, float alpha,
+      random::PhiloxRandomGenerator *rand_gen) const override {
+    return SampleEncodeInternal(normalized, alpha, rand_gen, nullptr);
+  }
+
+  // The pieces disallowed by `mask` are merged as usual, and then
+  // resegmented into their parts, as UNUSED pieces are.
+  EncodeResult EncodeWithMask(absl::string_view normalized,
+                              const VocabularyMask &mask) const override {
+    return SampleEncodeInternal(normalized, 0.0, nullptr, &mask);
+  }
+
+  EncodeResult SampleEncodeWithMask(
+      absl::string_view normalized, float alpha,
+      random::PhiloxRandomGenerator *rand_gen,
+      const VocabularyMask &mask) const override {
+    return SampleEncodeInternal(normalized, alpha, rand_gen, &mask);
+  }
 
   bool IsSampleEncodeAvailable() const override { return true; }
 
   bool IsNBestEncodeAvailable() const override { return false; }
+
+  bool IsVocabularyMaskAvailable() const override { return true; }
+
+ private:
+  // Implementation of SampleEncode. `mask` is nullptr when the vocabulary is
+  // not restricted.
+  EncodeResult SampleEncodeInternal(absl::string_view normalized, float alpha,
+                                    random::PhiloxRandomGenerator *rand_gen,
+                                    const VocabularyMask *mask) const;
 };
 }  // namespace bpe
 }  // namespace sentencepiece
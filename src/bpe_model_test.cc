@@ -292,6 +292,41 @@ TEST(SampleModelTest, EncodeTest) {
       EXPECT_EQ(num, kTrial);
     }
   }
+
+  // Each merge is skipped with probability `alpha`.
+  {
+    ModelProto single_merge_proto = MakeBaseModelProto();
+    AddPiece(&single_merge_proto, "ab", 0.0);
+    const Model model(single_merge_proto);
+    for (const float alpha : {0.1, 0.5, 0.9}) {
+      constexpr int kTrial = 100000;
+      int num_merged = 0;
+      for (int n = 0; n < kTrial; ++n) {
+        if (model.SampleEncode("ab", alpha).size() == 1) ++num_merged;
+      }
+      EXPECT_NEAR(1.0 - alpha, 1.0 * num_merged / kTrial, 0.01);
+    }
+  }
+
+  // Counter-based random streams follow the same distribution.
+  {
+    const Model model(model_proto);
+    constexpr int kTrial = 10000;
+    int num_merged = 0;
+    int expected_num_merged = 0;
+    for (int n = 0; n < kTrial; ++n) {
+      random::PhiloxRandomGenerator gen1(1234, n);
+      random::PhiloxRandomGenerator gen2(1234, n);
+      const auto result = model.SampleEncode("abcd", 0.5, &gen1);
+      EXPECT_EQ(result, model.SampleEncode("abcd", 0.5, &gen2));
+      if (result.size() == 1) ++num_merged;
+      if (model.SampleEncode("abcd", 0.5).size() == 1) ++expected_num_merged;
+    }
+    EXPECT_GT(num_merged, 0);
+    EXPECT_LT(num_merged, kTrial);
+    EXPECT_NEAR(1.0 * expected_num_merged / kTrial, 1.0 * num_merged / kTrial,
+                0.03);
+  }
 }
 
 }  // namespace
@@ -190,17 +190,21 @@ util::Status Trainer::Train() {
   }
 
   // Initializes symbols_. symbols_[sid][i] stores an unary symbol.
-  symbols_.resize(sentences_.size());
-  for (size_t i = 0; i < sentences_.size(); ++i) {
-    for (const char32 c : string_util::UTF8ToUnicodeText(sentences_[i].first)) {
-      symbols_[i].push_back(GetCharSymbol(c));
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "init_symbols");
+    symbols_.resize(sentences_.size());
+    for (size_t i = 0; i < sentences_.size(); ++i) {
+      for (const char32 c :
+           string_util::UTF8ToUnicodeText(sentences_[i].first)) {
+        symbols_[i].push_back(GetCharSymbol(c));
+      }
     }
-  }
 
-  // Makes all bigram symbols.
-  for (size_t sid = 0; sid < symbols_.size(); ++sid) {
-    for (size_t i = 1; i < symbols_[sid].size(); ++i) {
-      AddNewPair(sid, i - 1, i);
+    // Makes all bigram symbols.
+    for (size_t sid = 0; sid < symbols_.size(); ++sid) {
+      for (size_t i = 1; i < symbols_[sid].size(); ++i) {
+        AddNewPair(sid, i - 1, i);
+      }
     }
   }
 
@@ -215,88 +219,91 @@ util::Status Trainer::Train() {
 
   // Main loop.
   CHECK_OR_RETURN(final_pieces_.empty());
-  while (final_pieces_.size() < static_cast<size_t>(vocab_size)) {
-    constexpr int kUpdateActiveSymbolsInteval = 100;
-    if (final_pieces_.size() % kUpdateActiveSymbolsInteval == 0) {
-      UpdateActiveSymbols();
-    }
-
-    // Scanning active symbols, finds the best_symbol with highest freq.
-    Symbol *best_symbol = nullptr;
-    for (auto &it : active_symbols_) {
-      Symbol *symbol = it;
-      ComputeFreq(symbol);
-      // If the frequency is the same, take shorter symbol.
-      // if the length is the same, use lexicographical comparison
-      if (best_symbol == nullptr ||
-          (symbol->freq > best_symbol->freq ||
-           (symbol->freq == best_symbol->freq &&
-            (symbol->chars.size() < best_symbol->chars.size() ||
-             (symbol->chars.size() == best_symbol->chars.size() &&
-              symbol->ToString() < best_symbol->ToString()))))) {
-        best_symbol = symbol;
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "merge_symbols");
+    while (final_pieces_.size() < static_cast<size_t>(vocab_size)) {
+      constexpr int kUpdateActiveSymbolsInteval = 100;
+      if (final_pieces_.size() % kUpdateActiveSymbolsInteval == 0) {
+        UpdateActiveSymbols();
       }
-    }
-
-    if (best_symbol == nullptr) {
-      LOG(WARNING) << "No valid symbol found";
-      break;
-    }
-
-    if (!dup.insert(best_symbol->ToString()).second) {
-      // Removes best_symbol so it is not selected again.
-      symbols_cache_.erase(best_symbol->fp);
-      active_symbols_.erase(best_symbol);
-      continue;
-    }
 
-    // Stores the best_symbol in the final output.
-    final_pieces_.emplace_back(best_symbol->ToString(),
-                               -static_cast<float>(final_pieces_.size()));
-
-    if (final_pieces_.size() % 20 == 0) {
-      LOG(INFO) << "Added: freq=" << best_symbol->freq
-                << " size=" << final_pieces_.size()
-                << " all=" << symbols_cache_.size()
-                << " active=" << active_symbols_.size()
-                << " piece=" << best_symbol->ToString();
-    }
+      // Scanning active symbols, finds the best_symbol with highest freq.
+      Symbol *best_symbol = nullptr;
+      for (auto &it : active_symbols_) {
+        Symbol *symbol = it;
+        ComputeFreq(symbol);
+        // If the frequency is the same, take shorter symbol.
+        // if the length is the same, use lexicographical comparison
+        if (best_symbol == nullptr ||
+            (symbol->freq > best_symbol->freq ||
+             (symbol->freq == best_symbol->freq &&
+              (symbol->chars.size() < best_symbol->chars.size() ||
+               (symbol->chars.size() == best_symbol->chars.size() &&
+                symbol->ToString() < best_symbol->ToString()))))) {
+          best_symbol = symbol;
+        }
+      }
 
-    // Add new bigrams which are created after symbol replacement.
-    // We do not need to scan all characters, but scan the neighbors in
-    // best_symbol.
-    for (const uint64 &encoded_pos : best_symbol->positions) {
-      const Position pos = DecodePos(encoded_pos);
+      if (best_symbol == nullptr) {
+        LOG(WARNING) << "No valid symbol found";
+        break;
+      }
 
-      if (symbols_[pos.sid][pos.left] == nullptr) {
-        // left index might be NULL (set in the previous iteration)
-        // when left_symbol == right_symbol.
+      if (!dup.insert(best_symbol->ToString()).second) {
+        // Removes best_symbol so it is not selected again.
+        symbols_cache_.erase(best_symbol->fp);
+        active_symbols_.erase(best_symbol);
         continue;
       }
-      CHECK_OR_RETURN(symbols_[pos.sid][pos.right]);
-
-      // We have three bigrams [prev, left], [left, right], [right, next],
-      // which are affected with this symbol replacement.
-      const int next = GetNextIndex(pos.sid, pos.right);
-      const int prev = GetPrevIndex(pos.sid, pos.left);
 
-      // Resets the frequencies of bigrams [prev, left] and [right, next].
-      ResetFreq(pos.sid, prev, pos.left, best_symbol);
-      ResetFreq(pos.sid, pos.right, next, best_symbol);
+      // Stores the best_symbol in the final output.
+      final_pieces_.emplace_back(best_symbol->ToString(),
+                                 -static_cast<float>(final_pieces_.size()));
 
-      // Merges two symbols.
-      symbols_[pos.sid][pos.left] = best_symbol;
-      symbols_[pos.sid][pos.right] = nullptr;
+      if (final_pieces_.size() % 20 == 0) {
+        LOG(INFO) << "Added: freq=" << best_symbol->freq
+                  << " size=" << final_pieces_.size()
+                  << " all=" << symbols_cache_.size()
+                  << " active=" << active_symbols_.size()
+                  << " piece=" << best_symbol->ToString();
+      }
 
-      // Makes new symbol bigrams [prev, left] and [left, next].
-      AddNewPair(pos.sid, prev, pos.left);
-      AddNewPair(pos.sid, pos.left, next);
-    }
+      // Add new bigrams which are created after symbol replacement.
+      // We do not need to scan all characters, but scan the neighbors in
+      // best_symbol.
+      for (const uint64 &encoded_pos : best_symbol->positions) {
+        const Position pos = DecodePos(encoded_pos);
+
+        if (symbols_[pos.sid][pos.left] == nullptr) {
+          // left index might be NULL (set in the previous iteration)
+          // when left_symbol == right_symbol.
+          continue;
+        }
+        CHECK_OR_RETURN(symbols_[pos.sid][pos.right]);
+
+        // We have three bigrams [prev, left], [left, right], [right, next],
+        // which are affected with this symbol replacement.
+        const int next = GetNextIndex(pos.sid, pos.right);
+        const int prev = GetPrevIndex(pos.sid, pos.left);
+
+        // Resets the frequencies of bigrams [prev, left] and [right, next].
+        ResetFreq(pos.sid, prev, pos.left, best_symbol);
+        ResetFreq(pos.sid, pos.right, next, best_symbol);
+
+        // Merges two symbols.
+        symbols_[pos.sid][pos.left] = best_symbol;
+        symbols_[pos.sid][pos.right] = nullptr;
+
+        // Makes new symbol bigrams [prev, left] and [left, next].
+        AddNewPair(pos.sid, prev, pos.left);
+        AddNewPair(pos.sid, pos.left, next);
+      }
 
-    // Removes best_symbol so it is not selected again.
-    symbols_cache_.erase(best_symbol->fp);
-    active_symbols_.erase(best_symbol);
-  }  // end of main loop
+      // Removes best_symbol so it is not selected again.
+      symbols_cache_.erase(best_symbol->fp);
+      active_symbols_.erase(best_symbol);
+    }  // end of main loop
+  }
 
   // Adds required_chars_
   for (const auto &w : Sorted(required_chars_)) {
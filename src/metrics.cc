@@ -0,0 +1,109 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "metrics.h"
+
+#include <functional>
+#include <sstream>
+#include <thread>
+
+namespace sentencepiece {
+
+double ProcessorMetrics::unknown_rate() const {
+  return output_tokens == 0 ? 0.0 : 1.0 * unknown_tokens / output_tokens;
+}
+
+double ProcessorMetrics::byte_fallback_rate() const {
+  return output_tokens == 0 ? 0.0
+                            : 1.0 * byte_fallback_tokens / output_tokens;
+}
+
+std::string ProcessorMetrics::DebugString() const {
+  auto to_msec = [](int64_t nanos) { return nanos / 1e6; };
+  std::ostringstream os;
+  os << "num_encodes: " << num_encodes << "\n"
+     << "input_bytes: " << input_bytes << "\n"
+     << "output_tokens: " << output_tokens << "\n"
+     << "unknown_tokens: " << unknown_tokens << " (" << unknown_rate()
+     << ")\n"
+     << "byte_fallback_tokens: " << byte_fallback_tokens << " ("
+     << byte_fallback_rate() << ")\n"
+     << "normalize_msec: " << to_msec(normalize_nanos) << "\n"
+     << "model_encode_msec: " << to_msec(model_encode_nanos) << "\n"
+     << "populate_msec: " << to_msec(populate_nanos) << "\n"
+     << "extra_options_msec: " << to_msec(extra_options_nanos) << "\n";
+  return os.str();
+}
+
+namespace metrics {
+
+constexpr int Collector::kNumShards;
+
+Collector::Shard::Shard() {
+  for (auto &value : values) value.store(0, std::memory_order_relaxed);
+}
+
+Collector::Collector() {}
+
+Collector::~Collector() {}
+
+// static
+int Collector::ShardIndex() {
+  auto compute = []() {
+    // std::hash of a thread id is often an aligned address, so the bits
+    // are mixed before taking the modulo.
+    uint64 h = std::hash<std::thread::id>()(std::this_thread::get_id());
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<int>(h % kNumShards);
+  };
+#ifdef SPM_NO_THREADLOCAL
+  return compute();
+#else
+  thread_local static const int index = compute();
+  return index;
+#endif
+}
+
+void Collector::Snapshot(ProcessorMetrics *metrics) const {
+  int64 values[kNumMetrics] = {};
+  for (const auto &shard : shards_) {
+    for (int m = 0; m < kNumMetrics; ++m) {
+      values[m] += shard.values[m].load(std::memory_order_relaxed);
+    }
+  }
+
+  *metrics = ProcessorMetrics();
+  metrics->num_encodes = values[kNumEncodes];
+  metrics->input_bytes = values[kInputBytes];
+  metrics->output_tokens = values[kOutputTokens];
+  metrics->unknown_tokens = values[kUnknownTokens];
+  metrics->byte_fallback_tokens = values[kByteFallbackTokens];
+  metrics->normalize_nanos = values[kNormalizeNanos];
+  metrics->model_encode_nanos = values[kModelEncodeNanos];
+  metrics->populate_nanos = values[kPopulateNanos];
+  metrics->extra_options_nanos = values[kExtraOptionsNanos];
+}
+
+void Collector::Reset() {
+  for (auto &shard : shards_) {
+    for (auto &value : shard.values) {
+      value.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace metrics
+}  // namespace sentencepiece
@@ -0,0 +1,116 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <chrono>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+
+namespace sentencepiece {
+namespace metrics {
+
+enum Metric {
+  kNumEncodes = 0,
+  kInputBytes,
+  kOutputTokens,
+  kUnknownTokens,
+  kByteFallbackTokens,
+  kNormalizeNanos,
+  kModelEncodeNanos,
+  kPopulateNanos,
+  kExtraOptionsNanos,
+  kNumMetrics
+};
+
+// Accumulates the metrics of one SentencePieceProcessor. The metrics are
+// striped over a fixed number of shards by the hash of the thread id, so
+// that threads rarely contend on a shared cache line, and the memory does
+// not grow with the number of threads ever used. The shards are merged when
+// a snapshot is taken.
+class Collector {
+ public:
+  Collector();
+  virtual ~Collector();
+
+  // Adds `value` to `metric` in the shard of the calling thread.
+  void Add(Metric metric, int64 value) {
+    shards_[ShardIndex()].values[metric].fetch_add(value,
+                                                   std::memory_order_relaxed);
+  }
+
+  // Merges the shards of all threads into `metrics`.
+  void Snapshot(ProcessorMetrics *metrics) const;
+
+  // Resets all metrics to zero.
+  void Reset();
+
+ private:
+  static constexpr int kNumShards = 32;
+
+  struct Shard {
+    Shard();
+    std::atomic<int64> values[kNumMetrics];
+    // Keeps the values of two shards off the same cache line.
+    char padding[64];
+  };
+
+  // Returns the shard index of the calling thread.
+  static int ShardIndex();
+
+  Shard shards_[kNumShards];
+};
+
+// Adds the elapsed wall time of the current scope to `metric`.
+class ScopedTimer {
+ public:
+  ScopedTimer(Collector *collector, Metric metric)
+      : collector_(collector),
+        metric_(metric),
+        start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    if (collector_ == nullptr) return;
+    const auto elapsed = std::chrono::steady_clock::now() - start_;
+    collector_->Add(
+        metric_,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+  }
+
+ private:
+  Collector *collector_ = nullptr;
+  const Metric metric_;
+  const std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace metrics
+}  // namespace sentencepiece
+
+// Metrics are compiled in only when built with -DSPM_ENABLE_METRICS=ON.
+#ifdef SPM_ENABLE_METRICS
+#define SPM_METRICS_TIMER(collector, metric) \
+  metrics::ScopedTimer metrics_timer_##metric((collector), metrics::metric)
+#define SPM_METRICS_ADD(collector, metric, value)                   \
+  do {                                                              \
+    if ((collector) != nullptr) (collector)->Add(metrics::metric, (value)); \
+  } while (0)
+#else
+#define SPM_METRICS_TIMER(collector, metric)
+#define SPM_METRICS_ADD(collector, metric, value)
+#endif
+
+#endif  // METRICS_H_
@@ -63,7 +63,25 @@ int ModelInterface::PieceToId(absl::string_view piece) const {
 void ModelInterface::InitializePieces() {
   pieces_.clear();
   reserved_id_map_.clear();
+  byte_to_id_.clear();
+  id_to_byte_.clear();
   unk_id_ = -1;
+  can_encode_words_independently_ = true;
+
+  // A piece does not span a word boundary when its whitespaces only appear
+  // at the beginning (or the end with `treat_whitespace_as_suffix`).
+  const bool treat_whitespace_as_suffix =
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+  const absl::string_view kSpaceSymbol = "\xe2\x96\x81";
+  auto SpansWordBoundary = [&](absl::string_view piece) {
+    for (size_t pos = piece.find(kSpaceSymbol); pos != absl::string_view::npos;
+         pos = piece.find(kSpaceSymbol, pos + 1)) {
+      if (treat_whitespace_as_suffix ? pos + kSpaceSymbol.size() != piece.size()
+                                     : pos != 0)
+        return true;
+    }
+    return false;
+  };
 
   std::set<absl::string_view> user_defined_symbols;
   std::vector<bool> byte_found(256, false);
@@ -89,6 +107,10 @@ void ModelInterface::InitializePieces() {
       user_defined_symbols.insert(sp.piece());
     }
 
+    if (is_normal_piece && SpansWordBoundary(sp.piece())) {
+      can_encode_words_independently_ = false;
+    }
+
     if (sp.type() == ModelProto::SentencePiece::UNKNOWN) {
       if (unk_id_ >= 0) {
         status_ = util::InternalError("unk is already defined.");
@@ -107,6 +129,12 @@ void ModelInterface::InitializePieces() {
       const int byte = PieceToByte(sp.piece());
       if (0 <= byte && byte < 256) {
         byte_found[byte] = true;
+        if (byte_to_id_.empty()) {
+          byte_to_id_.assign(256, -1);
+          id_to_byte_.assign(model_proto_->pieces_size(), -1);
+        }
+        byte_to_id_[byte] = i;
+        id_to_byte_[i] = byte;
       } else {
         status_ =
             util::InternalError("byte piece " + sp.piece() + " is invalid.");
@@ -169,8 +197,62 @@ std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
   return result;
 }
 
-std::string ByteToPiece(unsigned char c) {
-  return absl::StrFormat("<0x%02X>", c);
+int ModelInterface::CountTokens(absl::string_view normalized) const {
+  return CountOutputPieces(Encode(normalized)).pieces;
+}
+
+OutputPieceCounts ModelInterface::CountOutputPieces(
+    const EncodeResult &result) const {
+  const bool byte_fallback = ByteFallbackEnabled();
+  OutputPieceCounts counts;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const bool is_unk = IsUnknown(p.second);
+    switch (GetOutputPieceType(is_unk, is_prev_unk, byte_fallback)) {
+      case OutputPieceType::kNormal:
+        ++counts.pieces;
+        break;
+      case OutputPieceType::kUnknown:
+        ++counts.pieces;
+        ++counts.unknown;
+        break;
+      case OutputPieceType::kMergedUnknown:
+        break;
+      case OutputPieceType::kByteFallback:
+        counts.pieces += p.first.size();
+        counts.byte_fallback += p.first.size();
+        break;
+    }
+    is_prev_unk = is_unk;
+  }
+  return counts;
+}
+
+int ModelInterface::ByteToId(unsigned char c) const {
+  if (!byte_to_id_.empty()) return byte_to_id_[c];
+  // Models which do not call InitializePieces() have no table.
+  return ByteFallbackEnabled() ? PieceToId(ByteToPiece(c)) : -1;
+}
+
+int ModelInterface::IdToByte(int id) const {
+  if (!id_to_byte_.empty()) {
+    return (id >= 0 && id < static_cast<int>(id_to_byte_.size()))
+               ? id_to_byte_[id]
+               : -1;
+  }
+  return (ByteFallbackEnabled() && IsByte(id)) ? PieceToByte(IdToPiece(id))
+                                               : -1;
+}
+
+const std::string &ByteToPiece(unsigned char c) {
+  static const auto *const kPieces = []() -> std::vector<std::string> * {
+    auto *v = new std::vector<std::string>(256);
+    for (int i = 0; i < 256; ++i) {
+      (*v)[i] = absl::StrFormat("<0x%02X>", i);
+    }
+    return v;
+  }();
+  return (*kPieces)[c];
 }
 
 int PieceToByte(absl::string_view piece) {
@@ -37,7 +37,7 @@ std::vector<absl::string_view> SplitIntoWords(absl::string_view text,
                                               bool add_ws_as_suffix = false);
 
 // Converts byte (0-255) to piece (e.g., 58 -> "<0x3A>").
-std::string ByteToPiece(unsigned char c);
+const std::string &ByteToPiece(unsigned char c);
 
 // Converts piece to byte (e.g., "<0x3A>" -> 58). Returns -1 if `piece` is not
 // a valid byte piece.
@@ -46,6 +46,31 @@ int PieceToByte(absl::string_view piece);
 using EncodeResult = std::vector<std::pair<absl::string_view, int>>;
 using NBestEncodeResult = std::vector<std::pair<EncodeResult, float>>;
 
+// How a piece of the model output is emitted by SentencePieceProcessor.
+// A run of unknown pieces is merged into one piece, or each unknown piece
+// is decomposed into byte pieces when byte fallback is enabled.
+enum class OutputPieceType {
+  kNormal,         // Emitted as it is.
+  kUnknown,        // Starts a run of unknown pieces.
+  kMergedUnknown,  // Merged into the previous unknown piece.
+  kByteFallback,   // Emitted as one byte piece per byte.
+};
+
+inline OutputPieceType GetOutputPieceType(bool is_unk, bool is_prev_unk,
+                                          bool byte_fallback) {
+  if (!is_unk) return OutputPieceType::kNormal;
+  if (byte_fallback) return OutputPieceType::kByteFallback;
+  return is_prev_unk ? OutputPieceType::kMergedUnknown
+                     : OutputPieceType::kUnknown;
+}
+
+// Number of the pieces emitted for a model output.
+struct OutputPieceCounts {
+  int pieces = 0;         // All the emitted pieces.
+  int unknown = 0;        // Merged unknown pieces.
+  int byte_fallback = 0;  // Byte pieces of unknown characters.
+};
+
 class ModelProto;
 
 // Underlying model interface.
@@ -106,12 +131,66 @@ class ModelInterface {
     return EncodeResult();
   }
 
+  // Same as above, but draws random numbers from `rand_gen`.
+  virtual EncodeResult SampleEncode(
+      absl::string_view normalized, float alpha,
+      random::PhiloxRandomGenerator *rand_gen) const {
+    LOG(ERROR) << "Not implemented.";
+    return EncodeResult();
+  }
+
+  // Same as Encode(), NBestEncode() and SampleEncode(), but the pieces
+  // disallowed by `mask` are not used, as if they were UNUSED. Valid only when
+  // IsVocabularyMaskAvailable() returns true.
+  virtual EncodeResult EncodeWithMask(absl::string_view normalized,
+                                      const VocabularyMask &mask) const {
+    LOG(ERROR) << "Not implemented.";
+    return EncodeResult();
+  }
+
+  virtual NBestEncodeResult NBestEncodeWithMask(
+      absl::string_view normalized, int nbest_size,
+      const VocabularyMask &mask) const {
+    LOG(ERROR) << "Not implemented.";
+    return NBestEncodeResult();
+  }
+
+  // Uses the thread-local generator when `rand_gen` is nullptr.
+  virtual EncodeResult SampleEncodeWithMask(
+      absl::string_view normalized, float alpha,
+      random::PhiloxRandomGenerator *rand_gen,
+      const VocabularyMask &mask) const {
+    LOG(ERROR) << "Not implemented.";
+    return EncodeResult();
+  }
+
+  // Returns the number of pieces the processor emits for `normalized`, i.e.,
+  // a run of unknown pieces counts as one piece, or as one piece per byte
+  // when byte fallback is enabled. The default implementation counts the
+  // result of Encode().
+  virtual int CountTokens(absl::string_view normalized) const;
+
+  // Counts the pieces the processor emits for `result`, following
+  // GetOutputPieceType().
+  OutputPieceCounts CountOutputPieces(const EncodeResult &result) const;
+
+  // Returns true if no piece spans a boundary of SplitIntoWords(), so that
+  // encoding the words separately gives the same pieces as Encode(). Only
+  // segmentations whose scores tie within the float precision of the path
+  // score accumulated over the preceding words may be resolved differently.
+  virtual bool CanEncodeWordsIndependently() const {
+    return can_encode_words_independently_;
+  }
+
   // Return true if SampleEncode returns a valid result.
   virtual bool IsSampleEncodeAvailable() const { return false; }
 
   // Return true if NBestEncode returns a valid result.
   virtual bool IsNBestEncodeAvailable() const { return false; }
 
+  // Return true if the *WithMask variants return a valid result.
+  virtual bool IsVocabularyMaskAvailable() const { return false; }
+
   // Returns the vocab id of `piece`.
   // Returns UNK(0) if `piece` is unknown
   virtual int PieceToId(absl::string_view piece) const;
@@ -166,6 +245,13 @@ class ModelInterface {
     return model_proto_ && model_proto_->trainer_spec().byte_fallback();
   }
 
+  // Returns the id of the byte piece representing `c`, or -1 when byte
+  // fallback is disabled. Looked up from a table built in InitializePieces().
+  virtual int ByteToId(unsigned char c) const;
+
+  // Returns the byte represented by `id`, or -1 when `id` is not a byte piece.
+  virtual int IdToByte(int id) const;
+
   // Verifies if the `expected` and `actual` outputs are equivalent. `expected`
   // and `actual` are sentence pieces joined by space (` `). Normally it means
   // that the two strings are identical. In some model, due to float rounding
@@ -199,6 +285,12 @@ class ModelInterface {
             ModelProto::SentencePiece::UNUSED);
   }
 
+  // Returns true if `id` must not be used, i.e., it is unused or disallowed
+  // by `mask`. `mask` is nullptr when the vocabulary is not restricted.
+  inline bool IsUnusedInlined(int id, const VocabularyMask *mask) const {
+    return IsUnusedInlined(id) || (mask != nullptr && !mask->IsAllowed(id));
+  }
+
   inline bool IsUserDefinedInlined(int id) const {
     return (model_proto_->pieces(id).type() ==
             ModelProto::SentencePiece::USER_DEFINED);
@@ -222,6 +314,14 @@ class ModelInterface {
   // unknown id.
   int unk_id_ = 0;
 
+  // Whether no piece spans a word boundary. See CanEncodeWordsIndependently().
+  bool can_encode_words_independently_ = false;
+
+  // byte -> id and id -> byte tables for byte pieces. Both are empty when
+  // byte fallback is disabled.
+  std::vector<int> byte_to_id_;
+  std::vector<int> id_to_byte_;
+
   // The encoder version. Currently it is only effective for unigram model but
   // ignored by other models.
   EncoderVersion encoder_version_ = EncoderVersion::kOptimized;
@@ -275,6 +275,101 @@ TEST(ModelInterfaceTest, ByteFallbackModelTest) {
   }
 }
 
+TEST(ModelInterfaceTest, ByteToIdTest) {
+  ModelProto model_proto = MakeBaseModelProto(TrainerSpec::UNIGRAM, true);
+  AddPiece(&model_proto, "a");
+  for (int i = 0; i < 256; ++i) {
+    AddBytePiece(&model_proto, i);
+  }
+  auto model = ModelFactory::Create(model_proto);
+  EXPECT_TRUE(model->status().ok());
+
+  for (int i = 0; i < 256; ++i) {
+    const int id = model->ByteToId(i);
+    EXPECT_EQ(model->PieceToId(ByteToPiece(i)), id);
+    EXPECT_TRUE(model->IsByte(id));
+    EXPECT_EQ(i, model->IdToByte(id));
+  }
+
+  for (int id = 0; id < model->GetPieceSize(); ++id) {
+    if (!model->IsByte(id)) {
+      EXPECT_EQ(-1, model->IdToByte(id));
+    }
+  }
+  EXPECT_EQ(-1, model->IdToByte(-1));
+  EXPECT_EQ(-1, model->IdToByte(model->GetPieceSize()));
+
+  // No byte pieces without byte fallback.
+  model_proto = MakeBaseModelProto(TrainerSpec::UNIGRAM);
+  AddPiece(&model_proto, "a");
+  model = ModelFactory::Create(model_proto);
+  EXPECT_TRUE(model->status().ok());
+  EXPECT_EQ(-1, model->ByteToId('a'));
+  EXPECT_EQ(-1, model->IdToByte(0));
+}
+
+TEST(ModelInterfaceTest, CountOutputPiecesTest) {
+  for (const bool byte_fallback : {false, true}) {
+    ModelProto model_proto =
+        MakeBaseModelProto(TrainerSpec::UNIGRAM, byte_fallback);
+    AddPiece(&model_proto, "a");
+    if (byte_fallback) {
+      for (int i = 0; i < 256; ++i) AddBytePiece(&model_proto, i);
+    }
+    auto model = ModelFactory::Create(model_proto);
+    EXPECT_TRUE(model->status().ok());
+
+    const int a = model->PieceToId("a");
+    const EncodeResult result = {
+        {"a", a}, {"x", 0}, {"yz", 0}, {"a", a}, {"\xE3\x81\x82", 0}};
+    const auto counts = model->CountOutputPieces(result);
+    if (byte_fallback) {
+      EXPECT_EQ(8, counts.pieces);
+      EXPECT_EQ(0, counts.unknown);
+      EXPECT_EQ(6, counts.byte_fallback);
+    } else {
+      // "x" and "yz" are merged.
+      EXPECT_EQ(4, counts.pieces);
+      EXPECT_EQ(2, counts.unknown);
+      EXPECT_EQ(0, counts.byte_fallback);
+    }
+    EXPECT_EQ(OutputPieceType::kNormal,
+              GetOutputPieceType(false, true, byte_fallback));
+  }
+
+  EXPECT_EQ(OutputPieceType::kUnknown, GetOutputPieceType(true, false, false));
+  EXPECT_EQ(OutputPieceType::kMergedUnknown,
+            GetOutputPieceType(true, true, false));
+  EXPECT_EQ(OutputPieceType::kByteFallback,
+            GetOutputPieceType(true, true, true));
+}
+
+TEST(ModelInterfaceTest, CanEncodeWordsIndependentlyTest) {
+  for (const auto type : kModelTypes) {
+    ModelProto model_proto = MakeBaseModelProto(type);
+    AddPiece(&model_proto, WS "a");
+    AddPiece(&model_proto, "b");
+    AddPiece(&model_proto, WS);
+    auto model = ModelFactory::Create(model_proto);
+    EXPECT_TRUE(model->CanEncodeWordsIndependently());
+
+    AddPiece(&model_proto, "a" WS "b");
+    model = ModelFactory::Create(model_proto);
+    EXPECT_FALSE(model->CanEncodeWordsIndependently());
+
+    // With `treat_whitespace_as_suffix`, whitespace may only appear at the end.
+    model_proto = MakeBaseModelProto(type);
+    model_proto.mutable_trainer_spec()->set_treat_whitespace_as_suffix(true);
+    AddPiece(&model_proto, "a" WS);
+    model = ModelFactory::Create(model_proto);
+    EXPECT_TRUE(model->CanEncodeWordsIndependently());
+
+    AddPiece(&model_proto, WS "a");
+    model = ModelFactory::Create(model_proto);
+    EXPECT_FALSE(model->CanEncodeWordsIndependently());
+  }
+}
+
 std::string RandomString(int length) {
   const char kAlphaNum[] =
       "0123456789"
@@ -0,0 +1,302 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "piece_trie.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "third_party/absl/memory/memory.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace {
+
+template <typename Trie>
+int ExactMatchSearchImpl(const Trie &trie, absl::string_view key) {
+  if (key.empty()) return -1;
+  auto node = trie.root();
+  int id = -1;
+  for (const char c : key) {
+    if (!trie.Next(&node, c, &id)) return -1;
+  }
+  return id;
+}
+
+template <typename Trie>
+size_t CommonPrefixSearchImpl(const Trie &trie, absl::string_view key,
+                              PieceTrie::Result *results,
+                              size_t max_results) {
+  size_t num_results = 0;
+  auto node = trie.root();
+  for (size_t i = 0; i < key.size(); ++i) {
+    int id = -1;
+    if (!trie.Next(&node, key[i], &id)) break;
+    if (id < 0) continue;
+    if (num_results < max_results) {
+      results[num_results].id = id;
+      results[num_results].length = i + 1;
+    }
+    ++num_results;
+  }
+  return num_results;
+}
+
+}  // namespace
+
+std::unique_ptr<PieceTrie> MakePieceTrie(PieceTrieType type) {
+  switch (type) {
+    case PieceTrieType::kScoreOrdered:
+      return absl::make_unique<ScoreOrderedTrie>();
+    case PieceTrieType::kDoubleArray:
+    default:
+      return absl::make_unique<DoubleArrayTrie>();
+  }
+}
+
+util::Status DoubleArrayTrie::Build(
+    std::vector<std::pair<absl::string_view, int>> *pieces,
+    const std::vector<float> &scores) {
+  if (pieces->empty()) return util::InternalError("no pieces are loaded.");
+
+  // sort by sentencepiece since DoubleArray::build()
+  // only accepts sorted strings.
+  std::sort(pieces->begin(), pieces->end());
+
+  // Makes key/value set for DoubleArrayTrie.
+  std::vector<const char *> key(pieces->size());
+  std::vector<size_t> length(pieces->size());
+  std::vector<int> value(pieces->size());
+  for (size_t i = 0; i < pieces->size(); ++i) {
+    key[i] = (*pieces)[i].first.data();  // sorted piece.
+    length[i] = (*pieces)[i].first.size();
+    value[i] = (*pieces)[i].second;  // vocab_id
+  }
+
+  if (array_.build(key.size(), const_cast<char **>(&key[0]), &length[0],
+                   &value[0]) != 0) {
+    return util::InternalError("cannot build double-array.");
+  }
+
+  return util::OkStatus();
+}
+
+int DoubleArrayTrie::ExactMatchSearch(absl::string_view key) const {
+  return ExactMatchSearchImpl(*this, key);
+}
+
+size_t DoubleArrayTrie::CommonPrefixSearch(absl::string_view key,
+                                           Result *results,
+                                           size_t max_results) const {
+  return CommonPrefixSearchImpl(*this, key, results, max_results);
+}
+
+size_t DoubleArrayTrie::size_in_bytes() const { return array_.total_size(); }
+
+constexpr uint32 ScoreOrderedTrie::kLabelMask;
+constexpr uint32 ScoreOrderedTrie::kHasValue;
+constexpr uint32 ScoreOrderedTrie::kIsLeaf;
+constexpr int ScoreOrderedTrie::kPayloadShift;
+
+util::Status ScoreOrderedTrie::Build(
+    std::vector<std::pair<absl::string_view, int>> *pieces,
+    const std::vector<float> &scores) {
+  if (pieces->empty()) return util::InternalError("no pieces are loaded.");
+
+  std::sort(pieces->begin(), pieces->end());
+
+  // Builds a tree of the nodes first. As `pieces` are sorted, the children
+  // of a node are added in the order of their labels, and a child always
+  // has a larger index than its parent.
+  struct TreeNode {
+    std::vector<std::pair<uint32, int>> children;  // (label, index)
+    int id = -1;
+    float best_score = -FLT_MAX;
+  };
+  const uint32 kMaxPayload = kuint32max >> kPayloadShift;
+  std::vector<TreeNode> nodes(1);
+  for (const auto &piece : *pieces) {
+    CHECK_OR_RETURN(!piece.first.empty()) << "piece must not be empty.";
+    CHECK_OR_RETURN(piece.second >= 0 &&
+                    piece.second < static_cast<int>(scores.size()) &&
+                    piece.second <= static_cast<int>(kMaxPayload))
+        << "invalid id " << piece.second;
+    int n = 0;
+    for (const char c : piece.first) {
+      const uint32 label = static_cast<unsigned char>(c);
+      CHECK_NE_OR_RETURN(label, 0) << "piece must not contain NUL.";
+      if (!nodes[n].children.empty() &&
+          nodes[n].children.back().first == label) {
+        n = nodes[n].children.back().second;
+        continue;
+      }
+      const int child = nodes.size();
+      nodes[n].children.emplace_back(label, child);
+      nodes.emplace_back();
+      n = child;
+    }
+    nodes[n].id = piece.second;
+  }
+
+  for (int n = nodes.size() - 1; n >= 0; --n) {
+    auto &node = nodes[n];
+    if (node.id >= 0) node.best_score = scores[node.id];
+    for (const auto &child : node.children) {
+      node.best_score =
+          std::max(node.best_score, nodes[child.second].best_score);
+    }
+  }
+
+  // Places the children of the nodes from the best score, so that the
+  // nodes of frequent pieces get small positions. The children of a node
+  // are placed at base + label, and its vocab id at base + 0. A base is
+  // only used by one node, so the label of a unit identifies its parent.
+  std::vector<uint32> positions(nodes.size(), 0);
+  std::vector<bool> used, base_used;
+  units_.clear();
+
+  // Unused positions as a doubly linked list. The search of a base starts
+  // from the first unused position.
+  std::vector<int> next_free, prev_free;
+  int head = -1, tail = -1;
+  uint32 max_used = 0, max_base = 0;
+
+  auto Grow = [&](size_t size) {
+    const size_t old_size = used.size();
+    if (size <= old_size) return;
+    size = std::max(size, 2 * old_size);
+    used.resize(size, false);
+    base_used.resize(size, false);
+    units_.resize(size, kIsLeaf);
+    next_free.resize(size, -1);
+    prev_free.resize(size, -1);
+    for (size_t pos = old_size; pos < size; ++pos) {
+      prev_free[pos] = tail;
+      if (tail >= 0) {
+        next_free[tail] = pos;
+      } else {
+        head = pos;
+      }
+      tail = pos;
+    }
+  };
+
+  auto Use = [&](uint32 pos) {
+    used[pos] = true;
+    max_used = std::max(max_used, pos);
+    if (prev_free[pos] >= 0) {
+      next_free[prev_free[pos]] = next_free[pos];
+    } else {
+      head = next_free[pos];
+    }
+    if (next_free[pos] >= 0) {
+      prev_free[next_free[pos]] = prev_free[pos];
+    } else {
+      tail = prev_free[pos];
+    }
+  };
+
+  Grow(1024);
+  Use(0);  // root
+  units_[0] = 0;
+
+  // Searching more holes makes the array denser but the build slower.
+  constexpr int kMaxTrials = 1024;
+
+  std::vector<uint32> labels;
+  std::priority_queue<std::pair<float, int>> queue;
+  queue.emplace(nodes[0].best_score, 0);
+  while (!queue.empty()) {
+    const int n = queue.top().second;
+    queue.pop();
+    const auto &node = nodes[n];
+
+    labels.clear();
+    if (node.id >= 0) labels.push_back(0);
+    for (const auto &child : node.children) labels.push_back(child.first);
+    const uint32 first = labels.front();
+
+    // Base 0 is not used, as the root is at 0.
+    uint32 base = 0;
+    int trials = 0;
+    for (int pos = head;; pos = next_free[pos]) {
+      if (pos < 0 || ++trials > kMaxTrials) {
+        // Places the children after all the used units.
+        base = std::max(max_used + 1, first + 1) - first;
+        while (base < base_used.size() && base_used[base]) ++base;
+        break;
+      }
+      if (static_cast<uint32>(pos) <= first) continue;
+      base = pos - first;
+      if (base_used[base]) continue;
+      bool fits = true;
+      for (const uint32 label : labels) {
+        if (base + label < used.size() && used[base + label]) {
+          fits = false;
+          break;
+        }
+      }
+      if (fits) break;
+    }
+
+    CHECK_LE_OR_RETURN(base, kMaxPayload) << "too many pieces.";
+    Grow(base + 256);
+    base_used[base] = true;
+    max_base = std::max(max_base, base);
+    units_[positions[n]] |= base << kPayloadShift;
+
+    if (node.id >= 0) {
+      Use(base);
+      units_[base] = kIsLeaf | (node.id << kPayloadShift);
+    }
+
+    for (const auto &child : node.children) {
+      const uint32 pos = base + child.first;
+      const auto &child_node = nodes[child.second];
+      Use(pos);
+      positions[child.second] = pos;
+      units_[pos] = child.first | (child_node.id >= 0 ? kHasValue : 0);
+      if (child_node.children.empty()) {
+        units_[pos] |= kIsLeaf | (child_node.id << kPayloadShift);
+      } else {
+        queue.emplace(child_node.best_score, child.second);
+      }
+    }
+  }
+
+  // Next() reads base + label of any base.
+  units_.resize(std::max<size_t>(max_used + 1, max_base + 256));
+  units_.shrink_to_fit();
+
+  return util::OkStatus();
+}
+
+int ScoreOrderedTrie::ExactMatchSearch(absl::string_view key) const {
+  return ExactMatchSearchImpl(*this, key);
+}
+
+size_t ScoreOrderedTrie::CommonPrefixSearch(absl::string_view key,
+                                            Result *results,
+                                            size_t max_results) const {
+  return CommonPrefixSearchImpl(*this, key, results, max_results);
+}
+
+size_t ScoreOrderedTrie::size_in_bytes() const {
+  return units_.size() * sizeof(units_[0]);
+}
+
+}  // namespace sentencepiece
@@ -0,0 +1,163 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef PIECE_TRIE_H_
+#define PIECE_TRIE_H_
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+#include "third_party/darts_clone/darts.h"
+
+namespace sentencepiece {
+
+enum class PieceTrieType {
+  kDoubleArray,   // Darts-clone double array.
+  kScoreOrdered,  // Double array laid out in the order of the piece scores.
+};
+
+// Trie which maps the pieces of a model to their vocab ids.
+//
+// The encoders walk the trie byte by byte through the non-virtual Next() of
+// the concrete classes, which have the same signature:
+//
+//   // Moves `node` by the byte `c`. Returns false if there is no such
+//   // transition. Otherwise, sets `id` to the vocab id of the piece ending
+//   // at the new `node`, or -1.
+//   bool Next(Node *node, char c, int *id) const;
+//
+// Walks start from the node returned by root().
+class PieceTrie {
+ public:
+  // A piece which is a prefix of the key.
+  struct Result {
+    int id;
+    size_t length;
+  };
+
+  virtual ~PieceTrie() {}
+
+  // Builds the trie from (piece, vocab id) pairs. `pieces` are sorted.
+  // `scores` is indexed by vocab id, and gives a hint of how often the
+  // pieces are visited.
+  virtual util::Status Build(
+      std::vector<std::pair<absl::string_view, int>> *pieces,
+      const std::vector<float> &scores) = 0;
+
+  // Returns the vocab id of `key`, or -1 if `key` is not in the trie.
+  virtual int ExactMatchSearch(absl::string_view key) const = 0;
+
+  // Stores the pieces which are prefixes of `key` to `results` from the
+  // shortest one, and returns the number of them. The return value can be
+  // larger than `max_results`, but at most `max_results` are stored.
+  virtual size_t CommonPrefixSearch(absl::string_view key, Result *results,
+                                    size_t max_results) const = 0;
+
+  // Returns the memory used by the trie in bytes.
+  virtual size_t size_in_bytes() const = 0;
+};
+
+// Returns an empty trie of `type`.
+std::unique_ptr<PieceTrie> MakePieceTrie(PieceTrieType type);
+
+// Darts-clone double array.
+class DoubleArrayTrie : public PieceTrie {
+ public:
+  using Node = size_t;
+
+  util::Status Build(std::vector<std::pair<absl::string_view, int>> *pieces,
+                     const std::vector<float> &scores) override;
+
+  int ExactMatchSearch(absl::string_view key) const override;
+
+  size_t CommonPrefixSearch(absl::string_view key, Result *results,
+                            size_t max_results) const override;
+
+  size_t size_in_bytes() const override;
+
+  Node root() const { return 0; }
+
+  inline bool Next(Node *node, char c, int *id) const {
+    size_t key_pos = 0;
+    const int ret = array_.traverse(&c, *node, key_pos, 1);
+    if (ret == -2) return false;
+    *id = ret;
+    return true;
+  }
+
+ private:
+  Darts::DoubleArray array_;
+};
+
+// Double array whose units are placed in the descending order of the best
+// score in their subtrees. The nodes on the paths of frequent pieces are
+// packed at the beginning of the array, so that they share cache lines even
+// when the whole array does not fit in the cache.
+//
+// A unit is 4 bytes and one transition reads one unit. The unit of a leaf
+// holds the vocab id instead of the base of the children. An inner node
+// which ends a piece stores the vocab id in the unit at its base.
+class ScoreOrderedTrie : public PieceTrie {
+ public:
+  using Node = uint32;
+
+  util::Status Build(std::vector<std::pair<absl::string_view, int>> *pieces,
+                     const std::vector<float> &scores) override;
+
+  int ExactMatchSearch(absl::string_view key) const override;
+
+  size_t CommonPrefixSearch(absl::string_view key, Result *results,
+                            size_t max_results) const override;
+
+  size_t size_in_bytes() const override;
+
+  Node root() const { return 0; }
+
+  inline bool Next(Node *node, char c, int *id) const {
+    const uint32 parent = units_[*node];
+    if (parent & kIsLeaf) return false;
+    const uint32 label = static_cast<unsigned char>(c);
+    const uint32 pos = (parent >> kPayloadShift) + label;
+    const uint32 unit = units_[pos];
+    if ((unit & kLabelMask) != label) return false;
+    *node = pos;
+    if (!(unit & kHasValue)) {
+      *id = -1;
+    } else if (unit & kIsLeaf) {
+      *id = unit >> kPayloadShift;
+    } else {
+      *id = units_[unit >> kPayloadShift] >> kPayloadShift;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr uint32 kLabelMask = 0xFF;
+  static constexpr uint32 kHasValue = 0x100;
+  static constexpr uint32 kIsLeaf = 0x200;
+  static constexpr int kPayloadShift = 10;
+
+  // The payload is the vocab id for a leaf, or the base otherwise. The
+  // empty units and the units storing vocab ids are leaves without values,
+  // which no transition leaves.
+  std::vector<uint32> units_;
+};
+
+}  // namespace sentencepiece
+
+#endif  // PIECE_TRIE_H_
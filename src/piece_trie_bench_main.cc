@@ -0,0 +1,215 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+// Compares the trie backends of unigram::Model on a Latin and a CJK corpus
+// over growing vocabulary sizes, to check kMinPiecesForScoreOrderedTrie.
+//
+// The models are made from the corpus itself: all of its characters and
+// random substrings of 2-7 characters with random scores. The same models
+// are made on every run, and no trained model is needed.
+//
+// Usage: spm_piece_trie_bench --data_dir=<sentencepiece>/data
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "filesystem.h"
+#include "init.h"
+#include "normalizer.h"
+#include "piece_trie.h"
+#include "sentencepiece_model.pb.h"
+#include "sentencepiece_trainer.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/strings/numbers.h"
+#include "third_party/absl/strings/str_split.h"
+#include "unigram_model.h"
+#include "util.h"
+
+ABSL_FLAG(std::string, data_dir, "data",
+          "Directory of botchan.txt and wagahaiwa_nekodearu.txt.");
+ABSL_FLAG(std::string, vocab_sizes, "4000,8000,16000,32000,64000",
+          "Comma separated vocabulary sizes.");
+ABSL_FLAG(int32, repeats, 5,
+          "Number of timed runs of each trie. The fastest one is reported.");
+
+namespace sentencepiece {
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ElapsedMsec(Clock::time_point begin) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - begin)
+      .count();
+}
+
+std::vector<std::string> LoadNormalizedLines(absl::string_view filename) {
+  const NormalizerSpec spec =
+      SentencePieceTrainer::GetNormalizerSpec("nmt_nfkc");
+  const normalizer::Normalizer normalizer(spec);
+  auto input = filesystem::NewReadableFile(filename);
+  CHECK_OK(input->status());
+  std::vector<std::string> lines;
+  std::string line;
+  while (input->ReadLine(&line)) {
+    std::string normalized = normalizer.Normalize(line);
+    if (!normalized.empty()) lines.emplace_back(std::move(normalized));
+  }
+  return lines;
+}
+
+// Returns the prefix of `text` with at most `num_chars` characters.
+absl::string_view PrefixChars(absl::string_view text, int num_chars) {
+  size_t end = 0;
+  for (int i = 0; i < num_chars && end < text.size(); ++i) {
+    end += std::min(string_util::OneCharLen(text.data() + end),
+                    text.size() - end);
+  }
+  return text.substr(0, end);
+}
+
+ModelProto MakeModelProto(const std::vector<std::string> &lines,
+                          int vocab_size) {
+  ModelProto model_proto;
+  *model_proto.mutable_normalizer_spec() =
+      SentencePieceTrainer::GetNormalizerSpec("nmt_nfkc");
+  auto AddPiece = [&model_proto](absl::string_view piece, float score,
+                                 ModelProto::SentencePiece::Type type) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_piece(std::string(piece));
+    sp->set_score(score);
+    sp->set_type(type);
+  };
+  AddPiece("<unk>", 0.0, ModelProto::SentencePiece::UNKNOWN);
+  AddPiece("<s>", 0.0, ModelProto::SentencePiece::CONTROL);
+  AddPiece("</s>", 0.0, ModelProto::SentencePiece::CONTROL);
+
+  std::set<std::string> pieces;
+  for (const auto &line : lines) {
+    for (absl::string_view text = line; !text.empty();) {
+      const absl::string_view c = PrefixChars(text, 1);
+      pieces.emplace(c);
+      text.remove_prefix(c.size());
+    }
+  }
+  for (const auto &piece : pieces) {
+    AddPiece(piece, -10.0, ModelProto::SentencePiece::NORMAL);
+  }
+
+  std::mt19937 mt(vocab_size);
+  std::uniform_real_distribution<float> score(-15.0, -5.0);
+  while (model_proto.pieces_size() < vocab_size) {
+    const std::string &line = lines[mt() % lines.size()];
+    size_t pos = mt() % line.size();
+    while (pos > 0 && string_util::IsTrailByte(line[pos])) --pos;
+    const absl::string_view piece =
+        PrefixChars(absl::string_view(line).substr(pos), 2 + mt() % 6);
+    if (pieces.emplace(piece).second) {
+      AddPiece(piece, score(mt), ModelProto::SentencePiece::NORMAL);
+    }
+  }
+
+  return model_proto;
+}
+
+void Run(absl::string_view name, const std::vector<std::string> &lines,
+         int vocab_size) {
+  const ModelProto model_proto = MakeModelProto(lines, vocab_size);
+  unigram::Model model(model_proto);
+  CHECK_OK(model.status());
+
+  // The same pieces and scores as unigram::Model gives to the trie.
+  std::vector<std::pair<absl::string_view, int>> pieces;
+  std::vector<float> scores(model_proto.pieces_size(), 0.0);
+  for (int i = 0; i < model_proto.pieces_size(); ++i) {
+    const auto &sp = model_proto.pieces(i);
+    if (sp.type() != ModelProto::SentencePiece::NORMAL) continue;
+    pieces.emplace_back(sp.piece(), i);
+    scores[i] = sp.score();
+  }
+  std::sort(pieces.begin(), pieces.end());
+
+  const std::vector<std::pair<PieceTrieType, const char *>> kTries = {
+      {PieceTrieType::kDoubleArray, "double_array"},
+      {PieceTrieType::kScoreOrdered, "score_ordered"}};
+  std::vector<double> build_msec(kTries.size(), 1e30);
+  std::vector<double> encode_msec(kTries.size(), 1e30);
+  std::vector<size_t> size_in_bytes(kTries.size(), 0);
+  std::vector<size_t> num_pieces(kTries.size(), 0);
+
+  // The runs of the tries are interleaved to spread the noise evenly.
+  for (int r = 0; r < absl::GetFlag(FLAGS_repeats); ++r) {
+    for (size_t t = 0; t < kTries.size(); ++t) {
+      auto trie = MakePieceTrie(kTries[t].first);
+      auto sorted_pieces = pieces;
+      auto begin = Clock::now();
+      CHECK_OK(trie->Build(&sorted_pieces, scores));
+      build_msec[t] = std::min(build_msec[t], ElapsedMsec(begin));
+      size_in_bytes[t] = trie->size_in_bytes();
+
+      CHECK_OK(model.SetPieceTrieType(kTries[t].first));
+      size_t total = 0;
+      begin = Clock::now();
+      for (const auto &line : lines) total += model.Encode(line).size();
+      encode_msec[t] = std::min(encode_msec[t], ElapsedMsec(begin));
+      num_pieces[t] = total;
+    }
+  }
+
+  // Both tries must give the same segmentation.
+  CHECK_EQ(num_pieces[0], num_pieces[1]);
+
+  for (size_t t = 0; t < kTries.size(); ++t) {
+    std::cout << name << "\t" << model_proto.pieces_size() << "\t"
+              << kTries[t].second << "\t" << build_msec[t] << "\t"
+              << encode_msec[t] << "\t" << size_in_bytes[t] / 1024
+              << std::endl;
+  }
+}
+
+}  // namespace
+}  // namespace sentencepiece
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+
+  std::vector<int> vocab_sizes;
+  for (const auto &size :
+       absl::StrSplit(absl::GetFlag(FLAGS_vocab_sizes), ",")) {
+    int vocab_size = 0;
+    CHECK(absl::SimpleAtoi(size, &vocab_size));
+    vocab_sizes.push_back(vocab_size);
+  }
+
+  const std::vector<std::pair<const char *, const char *>> kCorpora = {
+      {"latin", "botchan.txt"}, {"cjk", "wagahaiwa_nekodearu.txt"}};
+  std::cout << "corpus\tpieces\ttrie\tbuild_ms\tencode_ms\tsize_kb"
+            << std::endl;
+  for (const auto &corpus : kCorpora) {
+    const auto lines = sentencepiece::LoadNormalizedLines(
+        sentencepiece::util::JoinPath(absl::GetFlag(FLAGS_data_dir),
+                                      corpus.second));
+    for (const int vocab_size : vocab_sizes) {
+      sentencepiece::Run(corpus.first, lines, vocab_size);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,159 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "piece_trie.h"
+
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "testharness.h"
+
+namespace sentencepiece {
+namespace {
+
+const std::vector<PieceTrieType> &GetPieceTrieTypes() {
+  static const std::vector<PieceTrieType> &v = *new std::vector<PieceTrieType>{
+      PieceTrieType::kDoubleArray, PieceTrieType::kScoreOrdered};
+  return v;
+}
+
+class PieceTrieTest : public test::TestWithParam<PieceTrieType> {
+ protected:
+  void SetUp() override { type_ = GetParam(); }
+  void TearDown() override {}
+
+  // Builds a trie of `pieces`, whose ids are their indices.
+  std::unique_ptr<PieceTrie> Build(const std::vector<std::string> &pieces,
+                                   const std::vector<float> &scores) {
+    std::vector<std::pair<absl::string_view, int>> v;
+    for (size_t i = 0; i < pieces.size(); ++i) v.emplace_back(pieces[i], i);
+    auto trie = MakePieceTrie(type_);
+    EXPECT_TRUE(trie->Build(&v, scores).ok());
+    return trie;
+  }
+
+  PieceTrieType type_;
+};
+
+}  // namespace
+
+TEST_P(PieceTrieTest, SearchTest) {
+  const std::vector<std::string> pieces = {
+      "a", "ab", "abc", "b", "xyz", "\xE2\x96\x81the", "\xE5\x90\xBE"};
+  const std::vector<float> scores = {-1.0, -2.0, -3.0, -1.0,
+                                     -5.0, -0.5, -4.0};
+  const auto trie = Build(pieces, scores);
+
+  for (size_t i = 0; i < pieces.size(); ++i) {
+    EXPECT_EQ(i, trie->ExactMatchSearch(pieces[i]));
+  }
+  EXPECT_EQ(-1, trie->ExactMatchSearch(""));
+  EXPECT_EQ(-1, trie->ExactMatchSearch("x"));
+  EXPECT_EQ(-1, trie->ExactMatchSearch("xy"));
+  EXPECT_EQ(-1, trie->ExactMatchSearch("abcd"));
+  EXPECT_EQ(-1, trie->ExactMatchSearch("c"));
+  EXPECT_EQ(-1, trie->ExactMatchSearch("\xE2\x96\x81"));
+
+  PieceTrie::Result results[4];
+  EXPECT_EQ(3, trie->CommonPrefixSearch("abcd", results, 4));
+  EXPECT_EQ(0, results[0].id);
+  EXPECT_EQ(1, results[0].length);
+  EXPECT_EQ(1, results[1].id);
+  EXPECT_EQ(2, results[1].length);
+  EXPECT_EQ(2, results[2].id);
+  EXPECT_EQ(3, results[2].length);
+
+  // Returns the number of all the matches.
+  results[1].id = -1;
+  EXPECT_EQ(3, trie->CommonPrefixSearch("abc", results, 1));
+  EXPECT_EQ(0, results[0].id);
+  EXPECT_EQ(-1, results[1].id);
+
+  EXPECT_EQ(0, trie->CommonPrefixSearch("", results, 4));
+  EXPECT_EQ(0, trie->CommonPrefixSearch("xy", results, 4));
+  EXPECT_EQ(0, trie->CommonPrefixSearch("cab", results, 4));
+  EXPECT_EQ(1, trie->CommonPrefixSearch("\xE2\x96\x81thee", results, 4));
+  EXPECT_EQ(5, results[0].id);
+  EXPECT_EQ(6, results[0].length);
+
+  EXPECT_GT(trie->size_in_bytes(), 0);
+}
+
+TEST_P(PieceTrieTest, RandomTest) {
+  std::mt19937 mt(type_ == PieceTrieType::kDoubleArray ? 1 : 2);
+  std::uniform_int_distribution<int> length_dist(1, 6);
+  std::uniform_real_distribution<float> score_dist(-20.0, 0.0);
+
+  // Short keys over a few bytes share many prefixes. Multi-byte labels
+  // cover the children which cannot be placed at small positions.
+  const std::string kBytes = "abc\xE2\x96\x81\xE5\x90\xBE\xFF";
+  std::uniform_int_distribution<int> byte_dist(0, kBytes.size() - 1);
+  auto RandomString = [&](int length) {
+    std::string s;
+    for (int i = 0; i < length; ++i) s += kBytes[byte_dist(mt)];
+    return s;
+  };
+
+  std::map<std::string, int> expected;
+  std::vector<std::string> pieces;
+  std::vector<float> scores;
+  for (int i = 0; i < 3000; ++i) {
+    const std::string piece = RandomString(length_dist(mt));
+    if (expected.count(piece)) continue;
+    expected[piece] = pieces.size();
+    pieces.push_back(piece);
+    scores.push_back(score_dist(mt));
+  }
+  const auto trie = Build(pieces, scores);
+
+  for (const auto &it : expected) {
+    EXPECT_EQ(it.second, trie->ExactMatchSearch(it.first));
+  }
+
+  std::vector<PieceTrie::Result> results(16);
+  for (int i = 0; i < 1000; ++i) {
+    const std::string key = RandomString(length_dist(mt) + 2);
+    const auto it = expected.find(key);
+    EXPECT_EQ(it == expected.end() ? -1 : it->second,
+              trie->ExactMatchSearch(key));
+
+    std::vector<std::pair<int, size_t>> expected_results;
+    for (size_t length = 1; length <= key.size(); ++length) {
+      const auto it = expected.find(key.substr(0, length));
+      if (it != expected.end()) {
+        expected_results.emplace_back(it->second, length);
+      }
+    }
+    const size_t num_results =
+        trie->CommonPrefixSearch(key, results.data(), results.size());
+    EXPECT_EQ(expected_results.size(), num_results);
+    for (size_t k = 0; k < num_results; ++k) {
+      EXPECT_EQ(expected_results[k].first, results[k].id);
+      EXPECT_EQ(expected_results[k].second, results[k].length);
+    }
+  }
+}
+
+TEST_P(PieceTrieTest, ErrorTest) {
+  std::vector<std::pair<absl::string_view, int>> pieces;
+  auto trie = MakePieceTrie(type_);
+  EXPECT_FALSE(trie->Build(&pieces, {}).ok());
+}
+
+INSTANTIATE_TEST_SUITE_P(ParametrizedPieceTrieTests, PieceTrieTest,
+                         test::ValuesIn(GetPieceTrieTypes()));
+
+}  // namespace sentencepiece
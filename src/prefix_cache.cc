@@ -0,0 +1,75 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "prefix_cache.h"
+
+#include "util.h"
+
+namespace sentencepiece {
+
+PrefixCache::PrefixCache(size_t max_blocks) : max_blocks_(max_blocks) {}
+
+PrefixCache::~PrefixCache() {}
+
+// static
+uint64 PrefixCache::Fingerprint(uint64 parent, absl::string_view input) {
+  // FNV-1a of the block, mixed with the key of the parent.
+  uint64 fp = 0xcbf29ce484222325ULL;
+  for (const char c : input) {
+    fp = (fp ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+  }
+  return port::FingerprintCat(parent, fp);
+}
+
+std::shared_ptr<const PrefixBlock> PrefixCache::Lookup(
+    uint64 key, absl::string_view input) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = index_.find(key);
+  if (it == index_.end() ||
+      absl::string_view(it->second->second->input) != input) {
+    return nullptr;
+  }
+  blocks_.splice(blocks_.begin(), blocks_, it->second);
+  return it->second->second;
+}
+
+void PrefixCache::Insert(uint64 key, std::shared_ptr<const PrefixBlock> block) {
+  if (max_blocks_ == 0) return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = index_.find(key);
+  if (it != index_.end()) {
+    it->second->second = std::move(block);
+    blocks_.splice(blocks_.begin(), blocks_, it->second);
+    return;
+  }
+  if (blocks_.size() >= max_blocks_) {
+    index_.erase(blocks_.back().first);
+    blocks_.pop_back();
+  }
+  blocks_.emplace_front(key, std::move(block));
+  index_[key] = blocks_.begin();
+}
+
+void PrefixCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  blocks_.clear();
+  index_.clear();
+}
+
+size_t PrefixCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return blocks_.size();
+}
+
+}  // namespace sentencepiece
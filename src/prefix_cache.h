@@ -0,0 +1,93 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef PREFIX_CACHE_H_
+#define PREFIX_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "common.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+
+// Segmentation of one block of an input prefix. An input is split into
+// blocks cut at whitespaces. A block holds the normalized words completed
+// by its bytes, i.e., the words of the prefix up to the block except the
+// last one, which are not held by the preceding blocks.
+struct PrefixBlock {
+  // Input bytes of the block.
+  std::string input;
+
+  // Normalized words and their positions in the whole input.
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+
+  // Segmentation of `normalized` as (length, id) pairs.
+  std::vector<std::pair<int, int>> pieces;
+
+  // Positions in the whole input to continue the segmentation from. The
+  // words after `pending` are not segmented yet, and the last segmented
+  // word starts at `context`. Both are valid when `has_emitted` is true.
+  size_t context = 0;
+  size_t pending = 0;
+  bool has_emitted = false;
+};
+
+// LRU cache of PrefixBlocks shared by the inputs with the same prefix. The
+// key of a block is the fingerprint of the whole prefix up to the block,
+// which is chained from the key of the preceding block. Thread-safe.
+class PrefixCache {
+ public:
+  explicit PrefixCache(size_t max_blocks);
+  virtual ~PrefixCache();
+
+  // Returns the key of the block `input` following the block of `parent`.
+  // `parent` of the first block is 0.
+  static uint64 Fingerprint(uint64 parent, absl::string_view input);
+
+  // Returns the block of `key` whose input is `input`, or nullptr.
+  std::shared_ptr<const PrefixBlock> Lookup(uint64 key,
+                                            absl::string_view input);
+
+  // Adds `block` as `key`, evicting the least recently used block when the
+  // cache is full.
+  void Insert(uint64 key, std::shared_ptr<const PrefixBlock> block);
+
+  // Removes all blocks.
+  void Clear();
+
+  // Returns the number of blocks.
+  size_t size() const;
+
+ private:
+  using Entry = std::pair<uint64, std::shared_ptr<const PrefixBlock>>;
+
+  const size_t max_blocks_;
+  mutable std::mutex mutex_;
+
+  // Most recently used first.
+  std::list<Entry> blocks_;
+  std::unordered_map<uint64, std::list<Entry>::iterator> index_;
+};
+
+}  // namespace sentencepiece
+
+#endif  // PREFIX_CACHE_H_
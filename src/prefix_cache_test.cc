@@ -0,0 +1,76 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "prefix_cache.h"
+
+#include "testharness.h"
+
+namespace sentencepiece {
+namespace {
+
+std::shared_ptr<const PrefixBlock> MakeBlock(absl::string_view input) {
+  auto block = std::make_shared<PrefixBlock>();
+  block->input.assign(input.data(), input.size());
+  return block;
+}
+
+}  // namespace
+
+TEST(PrefixCacheTest, FingerprintTest) {
+  const uint64 a = PrefixCache::Fingerprint(0, "abc");
+  EXPECT_EQ(a, PrefixCache::Fingerprint(0, "abc"));
+  EXPECT_NE(a, PrefixCache::Fingerprint(0, "abd"));
+  EXPECT_NE(a, PrefixCache::Fingerprint(1, "abc"));
+
+  // The key depends on the whole prefix.
+  EXPECT_NE(PrefixCache::Fingerprint(PrefixCache::Fingerprint(0, "ab"), "c"),
+            PrefixCache::Fingerprint(PrefixCache::Fingerprint(0, "a"), "c"));
+}
+
+TEST(PrefixCacheTest, LookupTest) {
+  PrefixCache cache(2);
+  EXPECT_EQ(0, cache.size());
+  EXPECT_TRUE(cache.Lookup(1, "a") == nullptr);
+
+  cache.Insert(1, MakeBlock("a"));
+  cache.Insert(2, MakeBlock("b"));
+  EXPECT_EQ(2, cache.size());
+  ASSERT_TRUE(cache.Lookup(1, "a") != nullptr);
+  EXPECT_EQ("a", cache.Lookup(1, "a")->input);
+
+  // The input is compared as the key may collide.
+  EXPECT_TRUE(cache.Lookup(1, "b") == nullptr);
+
+  // "b" is the least recently used.
+  cache.Insert(3, MakeBlock("c"));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_TRUE(cache.Lookup(1, "a") != nullptr);
+  EXPECT_TRUE(cache.Lookup(2, "b") == nullptr);
+  EXPECT_TRUE(cache.Lookup(3, "c") != nullptr);
+
+  // Inserting an existing key replaces the block.
+  cache.Insert(3, MakeBlock("d"));
+  EXPECT_EQ(2, cache.size());
+  EXPECT_TRUE(cache.Lookup(3, "d") != nullptr);
+
+  cache.Clear();
+  EXPECT_EQ(0, cache.size());
+  EXPECT_TRUE(cache.Lookup(1, "a") == nullptr);
+
+  PrefixCache empty_cache(0);
+  empty_cache.Insert(1, MakeBlock("a"));
+  EXPECT_EQ(0, empty_cache.size());
+}
+
+}  // namespace sentencepiece
@@ -14,17 +14,24 @@
 
 #include "sentencepiece_processor.h"
 
+#include <algorithm>
+#include <limits>
 #include <map>
 #include <set>
+#include <thread>
+#include <type_traits>
 #include <utility>
 
 #include "common.h"
 #include "filesystem.h"
+#include "metrics.h"
 #include "model_factory.h"
 #include "model_interface.h"
 #include "normalizer.h"
+#include "prefix_cache.h"
 #include "sentencepiece.pb.h"
 #include "third_party/absl/memory/memory.h"
+#include "third_party/absl/strings/match.h"
 #include "third_party/absl/strings/numbers.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_join.h"
@@ -45,9 +52,209 @@ const char kSpaceSymbol[] = "\xe2\x96\x81";
 // since this character can be useful both for user and
 // developer. We can easily figure out that <unk> is emitted.
 const char kDefaultUnknownSymbol[] = " \xE2\x81\x87 ";
+
+// REPLACEMENT CHARACTER (U+FFFD) in UTF-8.
+const char kReplacementCharacter[] = "\xef\xbf\xbd";
+
+// Flags of the precomputed decode table.
+enum DecodeFlag : uint8 {
+  kDecodeByte = 1,          // Byte piece. The surface is the raw byte.
+  kDecodeLeadingSpace = 2,  // The leading space is removed at the beginning.
+};
+
+// Returns true if `bytes` is a proper prefix of a multi-byte UTF-8
+// character, i.e., the following bytes may complete the character.
+bool IsIncompleteUTF8(absl::string_view bytes) {
+  if (bytes.empty() || bytes.size() >= string_util::OneCharLen(bytes.data()))
+    return false;
+  for (size_t i = 1; i < bytes.size(); ++i) {
+    if (!string_util::IsTrailByte(bytes[i])) return false;
+  }
+  return true;
+}
+
+// Decodes `bytes` as UTF-8 and appends the result to `output`. Invalid bytes
+// are mapped to REPLACEMENT CHARACTER (U+FFFD). When `partial` is true,
+// stops before the trailing incomplete character. Returns the number of
+// consumed bytes.
+size_t DecodeBytes(absl::string_view bytes, bool partial,
+                   std::string *output) {
+  size_t n = 0;
+  while (n < bytes.size()) {
+    const absl::string_view rest = bytes.substr(n);
+    if (partial && IsIncompleteUTF8(rest)) break;
+    size_t mblen = 0;
+    if (string_util::IsValidDecodeUTF8(rest, &mblen)) {
+      output->append(rest.data(), mblen);
+    } else {
+      output->append(kReplacementCharacter);
+    }
+    n += mblen;
+  }
+  return n;
+}
+
+// ASCII whitespaces at which an input can be cut without changing the
+// normalization of the words before the last one.
+const char kWordDelimiters[] = " \t\n\r";
+
+// Inputs shorter than this do not use the prefix cache.
+constexpr size_t kPrefixCacheBlockSize = 256;
+
+// Words of an input cut at a whitespace, of which normalized[begin, end) are
+// normalized in the same way as in the whole input.
+struct WordWindow {
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  size_t begin = 0;
+  size_t end = 0;
+
+  // Positions in the input where the last word of [begin, end) and the
+  // following words start. Valid when [begin, end) is not empty.
+  size_t context = 0;
+  size_t pending = 0;
+};
+
+// Normalizes `input` and selects the words which end after `pending`, or all
+// words when `has_emitted` is false. The last word is excluded unless
+// `is_last`, since the following input may change its normalization.
+util::Status NormalizeWords(const normalizer::Normalizer &normalizer,
+                            bool treat_whitespace_as_suffix,
+                            absl::string_view input, bool has_emitted,
+                            size_t pending, bool is_last,
+                            WordWindow *window) {
+  RETURN_IF_ERROR(normalizer.Normalize(input, &window->normalized,
+                                       &window->norm_to_orig));
+  const absl::string_view normalized = window->normalized;
+  const auto &norm_to_orig = window->norm_to_orig;
+
+  const auto words = SplitIntoWords(normalized, treat_whitespace_as_suffix);
+  auto WordBegin = [&](size_t n) {
+    return n < words.size()
+               ? static_cast<size_t>(words[n].data() - normalized.data())
+               : normalized.size();
+  };
+
+  // The end is compared since the dummy prefix is mapped to the same
+  // position as the next word.
+  size_t first = 0;
+  while (has_emitted && first < words.size() &&
+         norm_to_orig[WordBegin(first + 1)] <= pending) {
+    ++first;
+  }
+  const size_t last =
+      is_last || words.empty() ? words.size() : words.size() - 1;
+
+  window->begin = window->end = WordBegin(first);
+  if (first < last) {
+    window->end = WordBegin(last);
+    window->context = norm_to_orig[WordBegin(last - 1)];
+    window->pending = norm_to_orig[WordBegin(last)];
+  }
+
+  return util::OkStatus();
+}
+
+// Appends the encoding of one input to the concatenated batch output.
+void AppendEncoding(const std::vector<int> &ids, std::vector<int> *output) {
+  output->insert(output->end(), ids.begin(), ids.end());
+}
+
+void AppendEncoding(const CompactEncoding &encoding, CompactEncoding *output) {
+  output->ids.insert(output->ids.end(), encoding.ids.begin(),
+                     encoding.ids.end());
+  output->begins.insert(output->begins.end(), encoding.begins.begin(),
+                        encoding.begins.end());
+  output->ends.insert(output->ends.end(), encoding.ends.begin(),
+                      encoding.ends.end());
+}
+
+// Encodes `inputs` with `encode` using `num_threads` threads and concatenates
+// the results into `output`. The result of inputs[i] is stored in
+// output[offsets[i], offsets[i + 1]).
+template <typename Output, typename EncodeFunc>
+util::Status EncodeBatchWithThreads(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    const EncodeFunc &encode, Output *output, std::vector<size_t> *offsets) {
+  const size_t batch_size = inputs.size();
+  num_threads = static_cast<int>(std::max<size_t>(
+      1, std::min<size_t>(std::max(num_threads, 1), batch_size)));
+
+  // Each thread encodes a contiguous range of the batch into its own buffer.
+  // The buffers are concatenated in order afterwards.
+  std::vector<Output> buffers(num_threads);
+  std::vector<std::vector<size_t>> ends(num_threads);
+  std::vector<util::Status> statuses(num_threads);
+
+  auto EncodeRange = [&](int n) {
+    const size_t begin = batch_size * n / num_threads;
+    const size_t end = batch_size * (n + 1) / num_threads;
+    auto *buffer = &buffers[n];
+    Output result;
+    for (size_t i = begin; i < end; ++i) {
+      statuses[n] = encode(inputs[i], &result);
+      if (!statuses[n].ok()) return;
+      AppendEncoding(result, buffer);
+      ends[n].push_back(buffer->size());
+    }
+  };
+
+  if (num_threads == 1) {
+    EncodeRange(0);
+  } else {
+    auto pool = absl::make_unique<ThreadPool>(num_threads);
+    pool->StartWorkers();
+    for (int n = 0; n < num_threads; ++n) {
+      pool->Schedule([&, n]() { EncodeRange(n); });
+    }
+  }
+
+  for (int n = 0; n < num_threads; ++n) {
+    RETURN_IF_ERROR(statuses[n]);
+  }
+
+  offsets->reserve(batch_size + 1);
+  offsets->push_back(0);
+  for (int n = 0; n < num_threads; ++n) {
+    const size_t base = output->size();
+    for (const size_t end : ends[n]) {
+      offsets->push_back(base + end);
+    }
+    AppendEncoding(buffers[n], output);
+  }
+
+  return util::OkStatus();
+}
+
+// Creates a message on `arena`. Arena-enabled messages also allocate their
+// fields on `arena`. Others, e.g., those of the builtin protobuf-lite, are
+// only owned by `arena`.
+template <typename T>
+T *CreateOnArena(google::protobuf::Arena *arena, std::true_type) {
+  return google::protobuf::Arena::CreateMessage<T>(arena);
+}
+
+template <typename T>
+T *CreateOnArena(google::protobuf::Arena *arena, std::false_type) {
+  return google::protobuf::Arena::Create<T>(arena);
+}
+
+template <typename T>
+T *CreateOnArena(google::protobuf::Arena *arena) {
+  return CreateOnArena<T>(
+      arena,
+      std::integral_constant<
+          bool, google::protobuf::Arena::is_arena_constructable<T>::value>());
+}
 }  // namespace
 
-SentencePieceProcessor::SentencePieceProcessor() {}
+SentencePieceProcessor::SentencePieceProcessor()
+    : encode_workers_(absl::make_unique<WorkerPool>()) {
+#ifdef SPM_ENABLE_METRICS
+  metrics_ = absl::make_unique<metrics::Collector>();
+#endif
+}
+
 SentencePieceProcessor::~SentencePieceProcessor() {}
 
 util::Status SentencePieceProcessor::Load(absl::string_view filename) {
@@ -78,6 +285,7 @@ util::Status SentencePieceProcessor::Load(
     std::unique_ptr<ModelProto> model_proto) {
   model_proto_ = std::move(model_proto);
   model_ = ModelFactory::Create(*model_proto_);
+  ClearPrefixCache();
 
   normalizer_ = absl::make_unique<normalizer::Normalizer>(
       model_proto_->normalizer_spec(), model_proto_->trainer_spec());
@@ -92,6 +300,8 @@ util::Status SentencePieceProcessor::Load(
 
   RETURN_IF_ERROR(status());
 
+  InitializeDecodeTable();
+
   // Running self-testing.
   std::vector<std::string> errors, sps;
   for (const auto &s : model_proto_->self_test_data().samples()) {
@@ -118,6 +328,7 @@ util::Status SentencePieceProcessor::Load(
 
 util::Status SentencePieceProcessor::SetEncoderVersion(
     EncoderVersion encoder_version) {
+  ClearPrefixCache();
   return model_->SetEncoderVersion(encoder_version);
 }
 
@@ -170,6 +381,9 @@ util::Status SentencePieceProcessor::SetVocabulary(
     }
   }
 
+  InitializeDecodeTable();
+  ClearPrefixCache();
+
   return util::OkStatus();
 }
 
@@ -180,6 +394,9 @@ util::Status SentencePieceProcessor::ResetVocabulary() {
       piece.set_type(ModelProto::SentencePiece::NORMAL);
   }
 
+  InitializeDecodeTable();
+  ClearPrefixCache();
+
   return util::OkStatus();
 }
 
@@ -208,6 +425,42 @@ util::Status SentencePieceProcessor::LoadVocabulary(absl::string_view filename,
   return SetVocabulary(vocab);
 }
 
+util::Status SentencePieceProcessor::BuildVocabularyMask(
+    const std::vector<std::string> &valid_vocab, VocabularyMask *mask) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(mask) << "output mask is null";
+  CHECK_OR_RETURN(model_->IsVocabularyMaskAvailable())
+      << "Vocabulary mask is only enabled in subword units.";
+
+  const std::set<std::string> vocab(valid_vocab.begin(), valid_vocab.end());
+
+  // Same rule as SetVocabulary(). Control, unknown, user defined and byte
+  // pieces are not restricted.
+  const int size = model_->GetPieceSize();
+  mask->size_ = size;
+  mask->bits_.assign((size + 63) / 64, 0);
+  for (int id = 0; id < size; ++id) {
+    const std::string &piece = model_->IdToPiece(id);
+    if (model_->IsControl(id) || model_->IsUnknown(id) ||
+        model_->IsUserDefined(id) || model_->IsByte(id) ||
+        vocab.find(piece) != vocab.end() ||
+        string_util::OneCharLen(piece.c_str()) == piece.size()) {
+      mask->bits_[id >> 6] |= uint64_t(1) << (id & 63);
+    }
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::CheckVocabularyMask(
+    const VocabularyMask &mask) const {
+  CHECK_OR_RETURN(model_->IsVocabularyMaskAvailable())
+      << "Vocabulary mask is only enabled in subword units.";
+  CHECK_EQ_OR_RETURN(mask.size(), model_->GetPieceSize())
+      << "mask is not built for the current model.";
+  return util::OkStatus();
+}
+
 #define CHECK_OR_RETURN_STATUS_STL(container)               \
   RETURN_IF_ERROR(status());                                \
   CHECK_OR_RETURN(container) << "output container is null"; \
@@ -246,6 +499,43 @@ util::Status SentencePieceProcessor::Encode(absl::string_view input,
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::CountTokens(absl::string_view input,
+                                                 int *num_tokens) const {
+  RETURN_IF_ERROR(status());
+  CHECK_OR_RETURN(num_tokens) << "output is null";
+
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+
+  int count = model_->CountTokens(normalized);
+  for (const auto &extra_option : encode_extra_options_) {
+    if (extra_option == BOS || extra_option == EOS) ++count;
+  }
+  *num_tokens = count;
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::Encode(absl::string_view input,
+                                            CompactEncoding *encoding) const {
+  CHECK_OR_RETURN_STATUS_STL(encoding);
+  CHECK_LE_OR_RETURN(input.size(),
+                     static_cast<size_t>(std::numeric_limits<int32_t>::max()))
+      << "input is too long.";
+
+  SPM_METRICS_ADD(metrics_.get(), kNumEncodes, 1);
+  SPM_METRICS_ADD(metrics_.get(), kInputBytes, input.size());
+
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  EncodeResult result;
+  RETURN_IF_ERROR(
+      NormalizeAndEncode(input, nullptr, &normalized, &norm_to_orig, &result));
+
+  return PopulateCompactEncoding(normalized, norm_to_orig, result, encoding);
+}
+
 util::Status SentencePieceProcessor::Decode(
     const std::vector<std::string> &pieces, std::string *detokenized) const {
   CHECK_OR_RETURN_STATUS_STL(detokenized);
@@ -261,6 +551,10 @@ util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
                                             std::string *detokenized) const {
   CHECK_OR_RETURN_STATUS_STL(detokenized);
 
+  if (CanDecodeWithTable()) {
+    return DecodeWithTable(ids.data(), ids.size(), detokenized);
+  }
+
   SentencePieceText spt;
   RETURN_IF_ERROR(Decode(ids, &spt));
   *detokenized = std::move(spt.text());
@@ -268,6 +562,139 @@ util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<int> *ids, std::vector<size_t> *offsets) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+  CHECK_OR_RETURN_STATUS_STL(offsets);
+  return EncodeBatchWithThreads(
+      inputs, num_threads,
+      [this](absl::string_view input, std::vector<int> *result) {
+        return Encode(input, result);
+      },
+      ids, offsets);
+}
+
+util::Status SentencePieceProcessor::EncodeBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    CompactEncoding *encodings, std::vector<size_t> *offsets) const {
+  CHECK_OR_RETURN_STATUS_STL(encodings);
+  CHECK_OR_RETURN_STATUS_STL(offsets);
+  return EncodeBatchWithThreads(
+      inputs, num_threads,
+      [this](absl::string_view input, CompactEncoding *result) {
+        return Encode(input, result);
+      },
+      encodings, offsets);
+}
+
+util::Status SentencePieceProcessor::CountTokensBatch(
+    const std::vector<absl::string_view> &inputs, int num_threads,
+    std::vector<int> *num_tokens) const {
+  CHECK_OR_RETURN_STATUS_STL(num_tokens);
+  // Every input yields exactly one count, so the offsets are not needed.
+  std::vector<size_t> offsets;
+  return EncodeBatchWithThreads(
+      inputs, num_threads,
+      [this](absl::string_view input, std::vector<int> *result) {
+        result->resize(1);
+        return CountTokens(input, &(*result)[0]);
+      },
+      num_tokens, &offsets);
+}
+
+util::Status SentencePieceProcessor::DecodeBatch(
+    const std::vector<int> &ids, const std::vector<size_t> &offsets,
+    int num_threads, std::string *detokenized,
+    std::vector<size_t> *detokenized_offsets) const {
+  CHECK_OR_RETURN_STATUS_STL(detokenized);
+  CHECK_OR_RETURN_STATUS_STL(detokenized_offsets);
+  CHECK_OR_RETURN(!offsets.empty()) << "offsets must not be empty.";
+  CHECK_EQ_OR_RETURN(offsets.front(), 0);
+  CHECK_EQ_OR_RETURN(offsets.back(), ids.size());
+  for (size_t i = 1; i < offsets.size(); ++i) {
+    CHECK_LE_OR_RETURN(offsets[i - 1], offsets[i])
+        << "offsets must be non-decreasing.";
+  }
+
+  const size_t batch_size = offsets.size() - 1;
+  num_threads = static_cast<int>(std::max<size_t>(
+      1, std::min<size_t>(std::max(num_threads, 1), batch_size)));
+
+  // Each thread decodes a contiguous range of the batch into its own buffer.
+  // The buffers are concatenated in order afterwards.
+  std::vector<std::string> buffers(num_threads);
+  std::vector<std::vector<size_t>> ends(num_threads);
+  std::vector<util::Status> statuses(num_threads);
+  const bool with_table = CanDecodeWithTable();
+
+  auto DecodeRange = [&](int n) {
+    const size_t begin = batch_size * n / num_threads;
+    const size_t end = batch_size * (n + 1) / num_threads;
+    auto *buffer = &buffers[n];
+    for (size_t i = begin; i < end; ++i) {
+      const int *data = ids.data() + offsets[i];
+      const size_t size = offsets[i + 1] - offsets[i];
+      if (with_table) {
+        statuses[n] = DecodeWithTable(data, size, buffer);
+      } else {
+        std::string text;
+        statuses[n] = Decode(std::vector<int>(data, data + size), &text);
+        buffer->append(text);
+      }
+      if (!statuses[n].ok()) return;
+      ends[n].push_back(buffer->size());
+    }
+  };
+
+  if (num_threads == 1) {
+    DecodeRange(0);
+  } else {
+    auto pool = absl::make_unique<ThreadPool>(num_threads);
+    pool->StartWorkers();
+    for (int n = 0; n < num_threads; ++n) {
+      pool->Schedule([&, n]() { DecodeRange(n); });
+    }
+  }
+
+  size_t total = 0;
+  for (int n = 0; n < num_threads; ++n) {
+    RETURN_IF_ERROR(statuses[n]);
+    total += buffers[n].size();
+  }
+
+  detokenized->reserve(total);
+  detokenized_offsets->reserve(batch_size + 1);
+  detokenized_offsets->push_back(0);
+  for (int n = 0; n < num_threads; ++n) {
+    const size_t base = detokenized->size();
+    for (const size_t end : ends[n]) {
+      detokenized_offsets->push_back(base + end);
+    }
+    detokenized->append(buffers[n]);
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::DecodeBatch(
+    const std::vector<std::vector<int>> &ids, int num_threads,
+    std::string *detokenized, std::vector<size_t> *detokenized_offsets) const {
+  std::vector<int> flat_ids;
+  std::vector<size_t> offsets;
+  offsets.reserve(ids.size() + 1);
+  offsets.push_back(0);
+  for (const auto &v : ids) {
+    offsets.push_back(offsets.back() + v.size());
+  }
+  flat_ids.reserve(offsets.back());
+  for (const auto &v : ids) {
+    flat_ids.insert(flat_ids.end(), v.begin(), v.end());
+  }
+  return DecodeBatch(flat_ids, offsets, num_threads, detokenized,
+                     detokenized_offsets);
+}
+
 util::Status SentencePieceProcessor::NBestEncode(
     absl::string_view input, int nbest_size,
     std::vector<std::vector<std::string>> *pieces) const {
@@ -332,10 +759,68 @@ util::Status SentencePieceProcessor::SampleEncode(absl::string_view input,
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha, uint64_t seed,
+    uint64_t stream, std::vector<std::string> *pieces) const {
+  CHECK_OR_RETURN_STATUS_STL(pieces);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(SampleEncode(input, nbest_size, alpha, seed, stream, &spt));
+  for (const auto &sp : spt.pieces()) {
+    pieces->emplace_back(sp.piece());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha, uint64_t seed,
+    uint64_t stream, std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(SampleEncode(input, nbest_size, alpha, seed, stream, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
 util::Status SentencePieceProcessor::PopulateSentencePieceText(
     absl::string_view input, absl::string_view normalized,
     const std::vector<size_t> &norm_to_orig, const EncodeResult &result,
     SentencePieceText *spt) const {
+  return PopulateSentencePieceText(input, normalized, norm_to_orig, result,
+                                   encode_extra_options_, spt);
+}
+
+util::Status SentencePieceProcessor::PopulateSentencePieceText(
+    absl::string_view input, absl::string_view normalized,
+    const std::vector<size_t> &norm_to_orig, const EncodeResult &result,
+    const std::vector<ExtraOption> &extra_options,
+    SentencePieceText *spt) const {
+  SPM_METRICS_TIMER(metrics_.get(), kPopulateNanos);
+
+  const bool byte_fallback = model_->ByteFallbackEnabled();
+
+  // Continuous run of unknown pieces is merged so that decoder can copy or
+  // generate unknown tokens easily. Only the normalized range of the current
+  // run is tracked, and the merged piece and surface are written once when the
+  // run ends.
+  SentencePieceText::SentencePiece *unk_sp = nullptr;
+  size_t unk_begin = 0;
+  size_t unk_end = 0;
+  auto FlushUnknown = [&]() {
+    if (unk_sp == nullptr) return;
+    const size_t orig_begin = norm_to_orig[unk_begin];
+    const size_t orig_end = norm_to_orig[unk_end];
+    unk_sp->set_piece(normalized.data() + unk_begin, unk_end - unk_begin);
+    unk_sp->set_surface(input.data() + orig_begin, orig_end - orig_begin);
+    unk_sp->set_end(orig_end);
+    unk_sp = nullptr;
+  };
+
   size_t consumed = 0;
   bool is_prev_unk = false;
   for (const auto &p : result) {
@@ -345,6 +830,10 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
     CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
 
     const bool is_unk = IsUnknown(id);
+    const OutputPieceType type =
+        GetOutputPieceType(is_unk, is_prev_unk, byte_fallback);
+    is_prev_unk = is_unk;
+    if (type != OutputPieceType::kMergedUnknown) FlushUnknown();
 
     if (IsControl(id)) {
       // Control symbol has no corresponding source surface, so begin == end.
@@ -366,15 +855,15 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
       const auto surface =
           absl::ClippedSubstr(input, orig_begin, orig_end - orig_begin);
 
-      if (is_unk && model_->ByteFallbackEnabled()) {
+      if (type == OutputPieceType::kByteFallback) {
         // Decomposes an unknown piece into UTF-8 bytes
         for (int i = 0; i < w.size(); ++i) {
           // Create a byte piece
-          const char b = w[i];
+          const unsigned char b = w[i];
+          const int sp_id = model_->ByteToId(b);
+          CHECK_LE_OR_RETURN(0, sp_id);
           auto *sp = spt->add_pieces();
-          const auto piece = ByteToPiece(b);
-          auto sp_id = model_->PieceToId(piece);
-          sp->set_piece(piece.data(), piece.size());
+          sp->set_piece(ByteToPiece(b));
           sp->set_id(sp_id);
 
           // The last byte piece holds the surface of the original unknown
@@ -389,49 +878,261 @@ util::Status SentencePieceProcessor::PopulateSentencePieceText(
             sp->set_end(orig_begin);
           }
         }
-      } else {
-        // Merges continuous run of unknown pieces so that decoder
-        // can copy or generate unknown tokens easily.
+      } else if (type == OutputPieceType::kUnknown) {
         // Note that merged tokens are still unknown,
         // since known pieces never consist of unknown characters.
-        if (is_prev_unk && is_unk) {
-          auto *sp = spt->mutable_pieces(spt->pieces_size() - 1);
-          sp->set_piece(sp->piece() + std::string(w));
-          sp->set_surface(sp->surface() + std::string(surface));
-          sp->set_end(orig_end);
-        } else {
-          auto *sp = spt->add_pieces();
-          sp->set_piece(w.data(), w.size());
-          sp->set_id(id);
-          sp->set_surface(surface.data(), surface.size());
-          sp->set_begin(orig_begin);
-          sp->set_end(orig_end);
-        }
+        unk_sp = spt->add_pieces();
+        unk_sp->set_id(id);
+        unk_sp->set_begin(orig_begin);
+        unk_begin = begin;
+        unk_end = end;
+      } else if (type == OutputPieceType::kMergedUnknown) {
+        unk_end = end;
+      } else {
+        auto *sp = spt->add_pieces();
+        sp->set_piece(w.data(), w.size());
+        sp->set_id(id);
+        sp->set_surface(surface.data(), surface.size());
+        sp->set_begin(orig_begin);
+        sp->set_end(orig_end);
       }
       consumed += w.size();
     }
-    is_prev_unk = is_unk;
   }
+  FlushUnknown();
 
   CHECK_EQ_OR_RETURN(consumed, normalized.size())
       << "all normalized characters are not consumed.";
 
-  RETURN_IF_ERROR(ApplyExtraOptions(encode_extra_options_, spt));
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kExtraOptionsNanos);
+    RETURN_IF_ERROR(ApplyExtraOptions(extra_options, spt));
+  }
+
+#ifdef SPM_ENABLE_METRICS
+  if (metrics_ != nullptr) {
+    const auto counts = model_->CountOutputPieces(result);
+    metrics_->Add(metrics::kOutputTokens, spt->pieces_size());
+    metrics_->Add(metrics::kUnknownTokens, counts.unknown);
+    metrics_->Add(metrics::kByteFallbackTokens, counts.byte_fallback);
+  }
+#endif
 
   spt->set_text(input.data(), input.size());
 
   return util::OkStatus();
 }  // namespace sentencepiece
 
+util::Status SentencePieceProcessor::PopulateCompactEncoding(
+    absl::string_view normalized, const std::vector<size_t> &norm_to_orig,
+    const EncodeResult &result, CompactEncoding *encoding) const {
+  SPM_METRICS_TIMER(metrics_.get(), kPopulateNanos);
+
+  const bool byte_fallback = model_->ByteFallbackEnabled();
+  encoding->reserve(result.size());
+
+  // Follows PopulateSentencePieceText. Byte fallback and merging of unknown
+  // pieces only touch the ids and offsets.
+  size_t consumed = 0;
+  bool is_prev_unk = false;
+  for (const auto &p : result) {
+    const absl::string_view w = p.first;  // piece
+    const int id = p.second;              // id
+
+    CHECK_OR_RETURN(!w.empty()) << "Empty piece is not allowed.";
+
+    const bool is_unk = IsUnknown(id);
+    const OutputPieceType type =
+        GetOutputPieceType(is_unk, is_prev_unk, byte_fallback);
+    is_prev_unk = is_unk;
+
+    if (IsControl(id)) {
+      CHECK_LT_OR_RETURN(consumed, norm_to_orig.size());
+      const int32_t pos = norm_to_orig[consumed];
+      encoding->push_back(id, pos, pos);
+    } else {
+      const size_t end = consumed + w.size();
+      CHECK_LT_OR_RETURN(end, norm_to_orig.size());
+      const int32_t orig_begin = norm_to_orig[consumed];
+      const int32_t orig_end = norm_to_orig[end];
+      CHECK_LE_OR_RETURN(orig_begin, orig_end);
+
+      if (type == OutputPieceType::kByteFallback) {
+        // Only the last byte piece holds the original unknown character.
+        for (size_t i = 0; i < w.size(); ++i) {
+          const int byte_id =
+              model_->ByteToId(static_cast<unsigned char>(w[i]));
+          CHECK_LE_OR_RETURN(0, byte_id);
+          encoding->push_back(byte_id, orig_begin,
+                              i + 1 == w.size() ? orig_end : orig_begin);
+        }
+      } else if (type == OutputPieceType::kMergedUnknown) {
+        encoding->ends.back() = orig_end;
+      } else {
+        encoding->push_back(id, orig_begin, orig_end);
+      }
+      consumed = end;
+    }
+  }
+
+  CHECK_EQ_OR_RETURN(consumed, normalized.size())
+      << "all normalized characters are not consumed.";
+
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kExtraOptionsNanos);
+    RETURN_IF_ERROR(ApplyExtraOptions(encode_extra_options_, encoding));
+  }
+
+  SPM_METRICS_ADD(metrics_.get(), kOutputTokens, encoding->size());
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::NormalizeAndEncode(
+    absl::string_view input, const VocabularyMask *mask,
+    std::string *normalized, std::vector<size_t> *norm_to_orig,
+    EncodeResult *result) const {
+  // The cached segmentation is that of the full vocabulary.
+  if (mask == nullptr && prefix_cache_ != nullptr &&
+      input.size() > kPrefixCacheBlockSize &&
+      model_->CanEncodeWordsIndependently()) {
+    return EncodeWithPrefixCache(input, normalized, norm_to_orig, result);
+  }
+
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kNormalizeNanos);
+    RETURN_IF_ERROR(normalizer_->Normalize(input, normalized, norm_to_orig));
+  }
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kModelEncodeNanos);
+    *result = mask == nullptr ? model_->Encode(*normalized)
+                              : model_->EncodeWithMask(*normalized, *mask);
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::EncodeWithPrefixCache(
+    absl::string_view input, std::string *normalized,
+    std::vector<size_t> *norm_to_orig, EncodeResult *result) const {
+  const bool treat_whitespace_as_suffix =
+      model_proto_ &&
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+  normalized->clear();
+  norm_to_orig->clear();
+  std::vector<std::pair<int, int>> pieces;  // (length, id)
+
+  // Segments the words of input[context, end) after `pending` in the same
+  // way as StreamingEncoder, and stores them to `block`.
+  auto SegmentWords = [&](size_t end, bool is_last, PrefixBlock *block) {
+    const size_t context = block->context;
+    WordWindow window;
+    {
+      SPM_METRICS_TIMER(metrics_.get(), kNormalizeNanos);
+      RETURN_IF_ERROR(NormalizeWords(
+          *normalizer_, treat_whitespace_as_suffix,
+          input.substr(context, end - context), block->has_emitted,
+          block->pending - context, is_last, &window));
+    }
+
+    // The position after the last word is needed only at the end.
+    const size_t size = window.end - window.begin;
+    const absl::string_view text =
+        absl::string_view(window.normalized).substr(window.begin, size);
+    block->normalized.assign(text.data(), text.size());
+    block->norm_to_orig.clear();
+    for (size_t i = 0; i < size + (is_last ? 1 : 0); ++i) {
+      block->norm_to_orig.push_back(
+          window.norm_to_orig[window.begin + i] + context);
+    }
+    block->pieces.clear();
+    if (size > 0) {
+      SPM_METRICS_TIMER(metrics_.get(), kModelEncodeNanos);
+      for (const auto &p : model_->Encode(text)) {
+        block->pieces.emplace_back(p.first.size(), p.second);
+      }
+      block->context = window.context + context;
+      block->pending = window.pending + context;
+      block->has_emitted = true;
+    }
+    return util::OkStatus();
+  };
+
+  auto Append = [&](const PrefixBlock &block) {
+    normalized->append(block.normalized);
+    norm_to_orig->insert(norm_to_orig->end(), block.norm_to_orig.begin(),
+                         block.norm_to_orig.end());
+    pieces.insert(pieces.end(), block.pieces.begin(), block.pieces.end());
+  };
+
+  // The input is split into blocks, each of which ends just before the first
+  // whitespace after kPrefixCacheBlockSize bytes. The blocks are looked up
+  // until the first miss, and the following blocks are segmented and added.
+  PrefixBlock state;
+  uint64 key = 0;
+  bool is_cached = true;
+  size_t block_begin = 0;
+  while (true) {
+    const size_t block_end = input.find_first_of(
+        kWordDelimiters, block_begin + kPrefixCacheBlockSize);
+    if (block_end == absl::string_view::npos) break;
+    const absl::string_view block_input =
+        input.substr(block_begin, block_end - block_begin);
+    key = PrefixCache::Fingerprint(key, block_input);
+
+    std::shared_ptr<const PrefixBlock> block;
+    if (is_cached) {
+      block = prefix_cache_->Lookup(key, block_input);
+      is_cached = block != nullptr;
+    }
+    if (block == nullptr) {
+      auto new_block = std::make_shared<PrefixBlock>(state);
+      new_block->input.assign(block_input.data(), block_input.size());
+      RETURN_IF_ERROR(SegmentWords(block_end, false, new_block.get()));
+      prefix_cache_->Insert(key, new_block);
+      block = std::move(new_block);
+    }
+
+    Append(*block);
+    state.context = block->context;
+    state.pending = block->pending;
+    state.has_emitted = block->has_emitted;
+    block_begin = block_end;
+  }
+
+  RETURN_IF_ERROR(SegmentWords(input.size(), true, &state));
+  Append(state);
+
+  // `normalized` is complete, so the pieces can refer to it.
+  result->clear();
+  result->reserve(pieces.size());
+  size_t consumed = 0;
+  for (const auto &p : pieces) {
+    result->emplace_back(
+        absl::string_view(*normalized).substr(consumed, p.first), p.second);
+    consumed += p.first;
+  }
+
+  return util::OkStatus();
+}
+
 util::Status SentencePieceProcessor::Encode(absl::string_view input,
                                             SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
+  return EncodeInternal(input, nullptr, spt);
+}
+
+util::Status SentencePieceProcessor::EncodeInternal(
+    absl::string_view input, const VocabularyMask *mask,
+    SentencePieceText *spt) const {
+  SPM_METRICS_ADD(metrics_.get(), kNumEncodes, 1);
+  SPM_METRICS_ADD(metrics_.get(), kInputBytes, input.size());
 
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
-
-  const auto result = model_->Encode(normalized);
+  EncodeResult result;
+  RETURN_IF_ERROR(
+      NormalizeAndEncode(input, mask, &normalized, &norm_to_orig, &result));
   RETURN_IF_ERROR(
       PopulateSentencePieceText(input, normalized, norm_to_orig, result, spt));
 
@@ -442,15 +1143,32 @@ util::Status SentencePieceProcessor::NBestEncode(
     absl::string_view input, int nbest_size,
     NBestSentencePieceText *nbest_spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(nbest_spt);
+  return NBestEncodeInternal(input, nbest_size, nullptr, nbest_spt);
+}
+
+util::Status SentencePieceProcessor::NBestEncodeInternal(
+    absl::string_view input, int nbest_size, const VocabularyMask *mask,
+    NBestSentencePieceText *nbest_spt) const {
+  SPM_METRICS_ADD(metrics_.get(), kNumEncodes, 1);
+  SPM_METRICS_ADD(metrics_.get(), kInputBytes, input.size());
 
   std::string normalized;
   std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kNormalizeNanos);
+    RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  }
 
   CHECK_OR_RETURN(model_->IsNBestEncodeAvailable())
       << "NBestEncode is not available for the current model.";
 
-  const auto nbests = model_->NBestEncode(normalized, nbest_size);
+  NBestEncodeResult nbests;
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kModelEncodeNanos);
+    nbests = mask == nullptr
+                 ? model_->NBestEncode(normalized, nbest_size)
+                 : model_->NBestEncodeWithMask(normalized, nbest_size, *mask);
+  }
   CHECK_OR_RETURN(!nbests.empty()) << "NBestEncode returns empty result.";
 
   for (const auto &result : nbests) {
@@ -463,29 +1181,272 @@ util::Status SentencePieceProcessor::NBestEncode(
   return util::OkStatus();
 }
 
-util::Status SentencePieceProcessor::SampleEncode(
-    absl::string_view input, int nbest_size, float alpha,
+util::Status SentencePieceProcessor::Encode(absl::string_view input,
+                                            google::protobuf::Arena *arena,
+                                            SentencePieceText **spt) const {
+  CHECK_OR_RETURN(spt) << "output proto is null";
+  *spt = CreateOnArena<SentencePieceText>(arena);
+  return Encode(input, *spt);
+}
+
+util::Status SentencePieceProcessor::NBestEncode(
+    absl::string_view input, int nbest_size, google::protobuf::Arena *arena,
+    NBestSentencePieceText **nbest_spt) const {
+  CHECK_OR_RETURN(nbest_spt) << "output proto is null";
+  *nbest_spt = CreateOnArena<NBestSentencePieceText>(arena);
+  return NBestEncode(input, nbest_size, *nbest_spt);
+}
+
+util::Status SentencePieceProcessor::EncodeTruncated(
+    absl::string_view input, int max_tokens, TruncationMode mode,
     SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
+  CHECK_GE_OR_RETURN(max_tokens, 0);
 
-  CHECK_LE_OR_RETURN(nbest_size, 512) << "nbest_size must be nbest_size <= 512";
+  // bos/eos are added after the truncation, but within `max_tokens`.
+  int num_extra_pieces = 0;
+  for (const auto &extra_option : encode_extra_options_) {
+    if (extra_option == BOS || extra_option == EOS) ++num_extra_pieces;
+  }
+  CHECK_GE_OR_RETURN(max_tokens, num_extra_pieces)
+      << "max_tokens must be at least the number of bos/eos pieces.";
+  const int budget = max_tokens - num_extra_pieces;
+  const bool keep_head = mode == TruncationMode::kHead;
+  const bool incremental = model_->CanEncodeWordsIndependently();
+  const bool treat_whitespace_as_suffix =
+      model_proto_ &&
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+
+  // The window starts from a few bytes per piece and doubles until the
+  // budget is met or the window covers the whole input.
+  constexpr size_t kMinWindowSize = 256;
+  constexpr size_t kWindowBytesPerPiece = 8;
+  size_t window_size = std::max<size_t>(
+      kMinWindowSize, static_cast<size_t>(budget) * kWindowBytesPerPiece);
+
+  while (true) {
+    // The window input[begin, end) is cut just before a whitespace, so that
+    // the normalization of the window agrees with that of the whole input
+    // except for the words at the cut.
+    size_t begin = 0;
+    size_t end = input.size();
+    if (incremental && window_size < input.size()) {
+      if (keep_head) {
+        const size_t pos = input.find(' ', window_size);
+        if (pos != absl::string_view::npos) end = pos;
+      } else {
+        const size_t pos = input.rfind(' ', input.size() - window_size);
+        if (pos != absl::string_view::npos && pos > 0) begin = pos;
+      }
+    }
+    const bool is_whole = begin == 0 && end == input.size();
+    const absl::string_view window = input.substr(begin, end - begin);
+
+    std::string normalized;
+    std::vector<size_t> norm_to_orig;
+    RETURN_IF_ERROR(normalizer_->Normalize(window, &normalized, &norm_to_orig));
+
+    // Only segments the words which are away from the cut. They are encoded
+    // in the same way as in the whole input since no piece spans a word
+    // boundary.
+    size_t trusted_begin = 0;
+    size_t trusted_end = normalized.size();
+    if (!is_whole) {
+      const auto words = SplitIntoWords(normalized, treat_whitespace_as_suffix);
+      if (words.size() < 2) {
+        trusted_end = 0;
+      } else if (keep_head) {
+        trusted_end = words.back().data() - normalized.data();
+      } else {
+        trusted_begin = words[1].data() - normalized.data();
+      }
+    }
 
-  std::string normalized;
-  std::vector<size_t> norm_to_orig;
-  RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+    SentencePieceText window_spt;
+    if (trusted_begin < trusted_end) {
+      const absl::string_view trusted = absl::string_view(normalized).substr(
+          trusted_begin, trusted_end - trusted_begin);
+      const std::vector<size_t> trusted_to_orig(
+          norm_to_orig.begin() + trusted_begin,
+          norm_to_orig.begin() + trusted_end + 1);
+      RETURN_IF_ERROR(PopulateSentencePieceText(
+          window, trusted, trusted_to_orig, model_->Encode(trusted), {},
+          &window_spt));
+    }
 
-  if (!model_->IsNBestEncodeAvailable() || nbest_size < 0) {
-    CHECK_OR_RETURN(model_->IsSampleEncodeAvailable())
-        << "SampleEncode is not available for the current model.";
-    const auto result = model_->SampleEncode(normalized, alpha);
-    RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
-                                              result, spt));
+    // The piece at the cut may be merged with an unknown piece beyond the
+    // cut, so the budget must be exceeded by at least one piece.
+    const int num_pieces = window_spt.pieces_size();
+    if (is_whole || num_pieces > budget) {
+      auto *pieces = window_spt.mutable_pieces();
+      if (num_pieces > budget) {
+        if (keep_head) {
+          pieces->DeleteSubrange(budget, num_pieces - budget);
+        } else {
+          pieces->DeleteSubrange(0, num_pieces - budget);
+        }
+      }
+      for (auto &piece : *pieces) {
+        piece.set_begin(piece.begin() + begin);
+        piece.set_end(piece.end() + begin);
+      }
+      spt->Swap(&window_spt);
+      RETURN_IF_ERROR(ApplyExtraOptions(encode_extra_options_, spt));
+      spt->set_text(input.data(), input.size());
+      return util::OkStatus();
+    }
+
+    window_size *= 2;
+  }
+}
+
+util::Status SentencePieceProcessor::EncodeTruncated(
+    absl::string_view input, int max_tokens, TruncationMode mode,
+    std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(EncodeTruncated(input, max_tokens, mode, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::EncodeParallel(
+    absl::string_view input, int num_threads, SentencePieceText *spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+
+  SPM_METRICS_ADD(metrics_.get(), kNumEncodes, 1);
+  SPM_METRICS_ADD(metrics_.get(), kInputBytes, input.size());
+
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kNormalizeNanos);
+    RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  }
+
+  // Smaller chunks are not worth a thread.
+  constexpr size_t kMinChunkSize = 8192;
+  const int num_chunks =
+      model_->CanEncodeWordsIndependently()
+          ? static_cast<int>(std::max<size_t>(
+                1, std::min<size_t>(std::max(num_threads, 1),
+                                    normalized.size() / kMinChunkSize)))
+          : 1;
+
+  // Chunk n is normalized[bounds[n], bounds[n + 1]). Each bound is moved
+  // forward to the next word boundary. A match of the space symbol is always
+  // at a character boundary, as UTF-8 trail bytes never match its lead byte.
+  const bool treat_whitespace_as_suffix =
+      model_proto_ &&
+      model_proto_->trainer_spec().treat_whitespace_as_suffix();
+  const absl::string_view text(normalized);
+  std::vector<size_t> bounds = {0};
+  for (int n = 1; n < num_chunks; ++n) {
+    size_t pos = std::max(bounds.back() + 1, text.size() * n / num_chunks);
+    pos = text.find(kSpaceSymbol, pos);
+    if (pos == absl::string_view::npos) break;
+    if (treat_whitespace_as_suffix) pos += strlen(kSpaceSymbol);
+    if (pos >= text.size()) break;
+    bounds.push_back(pos);
+  }
+  bounds.push_back(text.size());
+
+  std::vector<EncodeResult> results(bounds.size() - 1);
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kModelEncodeNanos);
+    // Each chunk is segmented from a zero path score. Serial Encode()
+    // accumulates the score over the whole input instead.
+    // The first chunk is encoded on this thread.
+    encode_workers_->Run(results.size(), [&](int n) {
+      results[n] =
+          model_->Encode(text.substr(bounds[n], bounds[n + 1] - bounds[n]));
+    });
+  }
+
+  // Unknown pieces at the chunk boundaries are merged while populating.
+  EncodeResult result = std::move(results[0]);
+  for (size_t n = 1; n < results.size(); ++n) {
+    result.insert(result.end(), results[n].begin(), results[n].end());
+  }
+  RETURN_IF_ERROR(
+      PopulateSentencePieceText(input, normalized, norm_to_orig, result, spt));
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::EncodeParallel(
+    absl::string_view input, int num_threads, std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(EncodeParallel(input, num_threads, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    SentencePieceText *spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+  return SampleEncodeInternal(input, nbest_size, alpha, nullptr, nullptr, spt);
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha, uint64_t seed,
+    uint64_t stream, SentencePieceText *spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+  random::PhiloxRandomGenerator rand_gen(seed, stream);
+  return SampleEncodeInternal(input, nbest_size, alpha, &rand_gen, nullptr,
+                              spt);
+}
+
+util::Status SentencePieceProcessor::SampleEncodeInternal(
+    absl::string_view input, int nbest_size, float alpha,
+    random::PhiloxRandomGenerator *rand_gen, const VocabularyMask *mask,
+    SentencePieceText *spt) const {
+  CHECK_LE_OR_RETURN(nbest_size, 512) << "nbest_size must be nbest_size <= 512";
+
+  SPM_METRICS_ADD(metrics_.get(), kNumEncodes, 1);
+  SPM_METRICS_ADD(metrics_.get(), kInputBytes, input.size());
+
+  std::string normalized;
+  std::vector<size_t> norm_to_orig;
+  {
+    SPM_METRICS_TIMER(metrics_.get(), kNormalizeNanos);
+    RETURN_IF_ERROR(normalizer_->Normalize(input, &normalized, &norm_to_orig));
+  }
+
+  if (!model_->IsNBestEncodeAvailable() || nbest_size < 0) {
+    CHECK_OR_RETURN(model_->IsSampleEncodeAvailable())
+        << "SampleEncode is not available for the current model.";
+    EncodeResult result;
+    if (mask != nullptr) {
+      result = model_->SampleEncodeWithMask(normalized, alpha, rand_gen, *mask);
+    } else if (rand_gen == nullptr) {
+      result = model_->SampleEncode(normalized, alpha);
+    } else {
+      result = model_->SampleEncode(normalized, alpha, rand_gen);
+    }
+    RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
+                                              result, spt));
   } else if (nbest_size == 1 || nbest_size == 0) {
-    const auto result = model_->Encode(normalized);
+    const auto result = mask == nullptr
+                            ? model_->Encode(normalized)
+                            : model_->EncodeWithMask(normalized, *mask);
     RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
                                               result, spt));
   } else if (nbest_size > 1) {
-    const auto nbests = model_->NBestEncode(normalized, nbest_size);
+    const auto nbests =
+        mask == nullptr
+            ? model_->NBestEncode(normalized, nbest_size)
+            : model_->NBestEncodeWithMask(normalized, nbest_size, *mask);
     CHECK_OR_RETURN(!nbests.empty()) << "NBestEncode returns empty result.";
 
     std::vector<float> probs(nbests.size(), 0.0);
@@ -493,15 +1454,100 @@ util::Status SentencePieceProcessor::SampleEncode(
       probs[i] = std::exp(alpha * nbests[i].second);
     }
 
-    auto *mt = random::GetRandomGenerator();
     std::discrete_distribution<int> dist(probs.begin(), probs.end());
+    const int n = rand_gen == nullptr ? dist(*random::GetRandomGenerator())
+                                      : dist(*rand_gen);
     RETURN_IF_ERROR(PopulateSentencePieceText(input, normalized, norm_to_orig,
-                                              nbests[dist(*mt)].first, spt));
+                                              nbests[n].first, spt));
   }
 
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::Encode(
+    absl::string_view input, const VocabularyMask &mask,
+    std::vector<std::string> *pieces) const {
+  CHECK_OR_RETURN_STATUS_STL(pieces);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Encode(input, mask, &spt));
+  for (const auto &sp : spt.pieces()) {
+    pieces->emplace_back(sp.piece());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::Encode(absl::string_view input,
+                                            const VocabularyMask &mask,
+                                            std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(Encode(input, mask, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::Encode(absl::string_view input,
+                                            const VocabularyMask &mask,
+                                            SentencePieceText *spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+  RETURN_IF_ERROR(CheckVocabularyMask(mask));
+  return EncodeInternal(input, &mask, spt);
+}
+
+util::Status SentencePieceProcessor::NBestEncode(
+    absl::string_view input, int nbest_size, const VocabularyMask &mask,
+    std::vector<std::vector<int>> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  NBestSentencePieceText spt;
+  RETURN_IF_ERROR(NBestEncode(input, nbest_size, mask, &spt));
+  for (const auto &nbest : spt.nbests()) {
+    std::vector<int> result;
+    for (const auto &sp : nbest.pieces()) {
+      result.emplace_back(sp.id());
+    }
+    ids->emplace_back(result);
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::NBestEncode(
+    absl::string_view input, int nbest_size, const VocabularyMask &mask,
+    NBestSentencePieceText *nbest_spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(nbest_spt);
+  RETURN_IF_ERROR(CheckVocabularyMask(mask));
+  return NBestEncodeInternal(input, nbest_size, &mask, nbest_spt);
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    const VocabularyMask &mask, std::vector<int> *ids) const {
+  CHECK_OR_RETURN_STATUS_STL(ids);
+
+  SentencePieceText spt;
+  RETURN_IF_ERROR(SampleEncode(input, nbest_size, alpha, mask, &spt));
+  for (const auto &sp : spt.pieces()) {
+    ids->emplace_back(sp.id());
+  }
+
+  return util::OkStatus();
+}
+
+util::Status SentencePieceProcessor::SampleEncode(
+    absl::string_view input, int nbest_size, float alpha,
+    const VocabularyMask &mask, SentencePieceText *spt) const {
+  CHECK_OR_RETURN_STATUS_PROTO(spt);
+  RETURN_IF_ERROR(CheckVocabularyMask(mask));
+  return SampleEncodeInternal(input, nbest_size, alpha, nullptr, &mask, spt);
+}
+
 util::Status SentencePieceProcessor::Decode(
     const std::vector<std::string> &pieces, SentencePieceText *spt) const {
   CHECK_OR_RETURN_STATUS_PROTO(spt);
@@ -556,8 +1602,7 @@ util::Status SentencePieceProcessor::Decode(
       // Constructs byte sequence.
       std::string bytes;
       for (int i = begin; i < end; ++i) {
-        const auto &sp = spt->pieces(i);
-        const int byte = PieceToByte(sp.piece());
+        const int byte = model_->IdToByte(spt->pieces(i).id());
         CHECK_LE_OR_RETURN(0, byte);
         bytes.append(1, byte);
       }
@@ -605,6 +1650,409 @@ util::Status SentencePieceProcessor::Decode(
   return util::OkStatus();
 }
 
+void SentencePieceProcessor::InitializeDecodeTable() {
+  decode_surfaces_.clear();
+  decode_offsets_.clear();
+  decode_flags_.clear();
+
+  if (!model_proto_ || !status().ok()) return;
+
+  const char *unk_surface = kDefaultUnknownSymbol;
+  if (model_proto_->trainer_spec().has_unk_surface())
+    unk_surface = model_proto_->trainer_spec().unk_surface().c_str();
+
+  const bool remove_leading_space =
+      model_proto_->normalizer_spec().add_dummy_prefix() ||
+      model_proto_->normalizer_spec().remove_extra_whitespaces();
+
+  const int piece_size = model_->GetPieceSize();
+  decode_offsets_.reserve(piece_size + 1);
+  decode_flags_.reserve(piece_size);
+
+  for (int id = 0; id < piece_size; ++id) {
+    decode_offsets_.push_back(decode_surfaces_.size());
+    uint8 flags = 0;
+    if (model_->IsControl(id)) {
+      // Invisible symbol.
+    } else if (model_->IsUnknown(id)) {
+      decode_surfaces_.append(unk_surface);
+    } else if (model_->IsByte(id)) {
+      const int byte = model_->IdToByte(id);
+      if (byte < 0) {
+        // Falls back to the decoder with SentencePieceText.
+        decode_surfaces_.clear();
+        decode_offsets_.clear();
+        decode_flags_.clear();
+        return;
+      }
+      decode_surfaces_.append(1, static_cast<char>(byte));
+      flags |= kDecodeByte;
+    } else {
+      const std::string &piece = model_->IdToPiece(id);
+      if (remove_leading_space && absl::StartsWith(piece, kSpaceSymbol)) {
+        flags |= kDecodeLeadingSpace;
+      }
+      decode_surfaces_.append(
+          absl::StrReplaceAll(piece, {{kSpaceSymbol, " "}}));
+    }
+    decode_flags_.push_back(flags);
+  }
+  decode_offsets_.push_back(decode_surfaces_.size());
+}
+
+bool SentencePieceProcessor::CanDecodeWithTable() const {
+  if (decode_flags_.empty()) return false;
+
+  // The table does not add BOS/EOS, which is correct only when they are
+  // invisible control symbols.
+  for (const auto &extra_option : decode_extra_options_) {
+    if (extra_option == BOS && !IsControl(PieceToId(model_->bos_piece()))) {
+      return false;
+    }
+    if (extra_option == EOS && !IsControl(PieceToId(model_->eos_piece()))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+util::Status SentencePieceProcessor::DecodeWithTable(
+    const int *ids, size_t size, std::string *detokenized) const {
+  // BOS/EOS are invisible, so only the parity of REVERSE affects the text.
+  bool reverse = false;
+  for (const auto &extra_option : decode_extra_options_) {
+    if (extra_option == REVERSE) reverse = !reverse;
+  }
+
+  const int piece_size = static_cast<int>(decode_flags_.size());
+  size_t total = 0;
+  for (size_t i = 0; i < size; ++i) {
+    const int id = ids[i];
+    CHECK_OR_RETURN(id >= 0 && id < piece_size)
+        << "id " << id << " is out of range.";
+    total += decode_offsets_[id + 1] - decode_offsets_[id];
+  }
+
+  const size_t start = detokenized->size();
+  detokenized->reserve(start + total);
+
+  // Byte pieces are copied as they are. The run of bytes starting at
+  // `bytes_begin` is then decoded as UTF-8, and invalid bytes are mapped to
+  // REPLACEMENT CHARACTER (U+FFFD).
+  constexpr size_t kNoBytes = static_cast<size_t>(-1);
+  size_t bytes_begin = kNoBytes;
+  auto ProcessBytes = [&]() {
+    if (bytes_begin == kNoBytes) return;
+    absl::string_view bytes(detokenized->data() + bytes_begin,
+                            detokenized->size() - bytes_begin);
+    size_t mblen = 0;
+    bool valid = true;
+    for (size_t n = 0; valid && n < bytes.size(); n += mblen) {
+      valid = string_util::IsValidDecodeUTF8(bytes.substr(n), &mblen);
+    }
+    if (!valid) {
+      const std::string copied(bytes.data(), bytes.size());
+      detokenized->resize(bytes_begin);
+      DecodeBytes(copied, false, detokenized);
+    }
+    bytes_begin = kNoBytes;
+  };
+
+  for (size_t i = 0; i < size; ++i) {
+    const int id = ids[reverse ? size - i - 1 : i];
+    const uint8 flags = decode_flags_[id];
+    const char *surface = decode_surfaces_.data() + decode_offsets_[id];
+    size_t length = decode_offsets_[id + 1] - decode_offsets_[id];
+    if (flags & kDecodeByte) {
+      if (bytes_begin == kNoBytes) bytes_begin = detokenized->size();
+    } else {
+      ProcessBytes();
+      if ((flags & kDecodeLeadingSpace) && detokenized->size() == start) {
+        ++surface;
+        --length;
+      }
+    }
+    detokenized->append(surface, length);
+  }
+  ProcessBytes();
+
+  if (denormalizer_) {
+    const std::string denormalized = denormalizer_->Normalize(
+        absl::string_view(*detokenized).substr(start));
+    detokenized->resize(start);
+    detokenized->append(denormalized);
+  }
+
+  return util::OkStatus();
+}
+
+StreamingDecoder::StreamingDecoder(const SentencePieceProcessor *processor)
+    : processor_(processor) {}
+
+StreamingDecoder::~StreamingDecoder() {}
+
+util::Status StreamingDecoder::Decode(int id, std::string *text) {
+  CHECK_OR_RETURN(processor_) << "processor is null.";
+  RETURN_IF_ERROR(processor_->status());
+  CHECK_OR_RETURN(text) << "output container is null";
+  text->clear();
+
+  const auto &flags = processor_->decode_flags_;
+  const auto &offsets = processor_->decode_offsets_;
+  CHECK_OR_RETURN(processor_->CanDecodeWithTable())
+      << "decode table is not available.";
+  for (const auto &extra_option : processor_->decode_extra_options_) {
+    CHECK_OR_RETURN(extra_option != SentencePieceProcessor::REVERSE)
+        << "reverse option is not supported in streaming decoding.";
+  }
+  CHECK_OR_RETURN(id >= 0 && id < static_cast<int>(flags.size()))
+      << "id " << id << " is out of range.";
+
+  const char *surface = processor_->decode_surfaces_.data() + offsets[id];
+  size_t length = offsets[id + 1] - offsets[id];
+
+  std::string decoded;
+  if (flags[id] & kDecodeByte) {
+    pending_bytes_.append(surface, length);
+    pending_bytes_.erase(0, DecodeBytes(pending_bytes_, true, &decoded));
+  } else {
+    DecodeBytes(pending_bytes_, false, &decoded);
+    pending_bytes_.clear();
+    if ((flags[id] & kDecodeLeadingSpace) && text_size_ == 0 &&
+        decoded.empty()) {
+      ++surface;
+      --length;
+    }
+    decoded.append(surface, length);
+  }
+
+  AppendText(decoded, text);
+
+  return util::OkStatus();
+}
+
+util::Status StreamingDecoder::Flush(std::string *text) {
+  CHECK_OR_RETURN(text) << "output container is null";
+  text->clear();
+
+  std::string decoded;
+  DecodeBytes(pending_bytes_, false, &decoded);
+  AppendText(decoded, text);
+  Reset();
+
+  return util::OkStatus();
+}
+
+void StreamingDecoder::Reset() {
+  pending_bytes_.clear();
+  text_size_ = 0;
+}
+
+void StreamingDecoder::AppendText(absl::string_view text,
+                                  std::string *output) {
+  if (text.empty()) return;
+  text_size_ += text.size();
+  if (processor_ && processor_->denormalizer_) {
+    output->append(processor_->denormalizer_->Normalize(text));
+  } else {
+    output->append(text.data(), text.size());
+  }
+}
+
+StreamingEncoder::StreamingEncoder(const SentencePieceProcessor *processor)
+    : processor_(processor) {}
+
+StreamingEncoder::~StreamingEncoder() {}
+
+util::Status StreamingEncoder::Start(std::vector<int> *ids) {
+  CHECK_OR_RETURN(processor_) << "processor is null.";
+  RETURN_IF_ERROR(processor_->status());
+  CHECK_OR_RETURN(ids) << "output container is null";
+  ids->clear();
+
+  bool add_bos = false;
+  for (const auto &extra_option : processor_->encode_extra_options_) {
+    CHECK_OR_RETURN(extra_option != SentencePieceProcessor::REVERSE)
+        << "reverse option is not supported in streaming encoding.";
+    if (extra_option == SentencePieceProcessor::BOS) add_bos = true;
+  }
+
+  if (!started_ && add_bos) {
+    ids->push_back(processor_->PieceToId(
+        absl::string_view(processor_->model_->bos_piece().data())));
+  }
+  started_ = true;
+
+  return util::OkStatus();
+}
+
+util::Status StreamingEncoder::Encode(absl::string_view chunk,
+                                      std::vector<int> *ids) {
+  RETURN_IF_ERROR(Start(ids));
+  buffer_.append(chunk.data(), chunk.size());
+  if (!processor_->model_->CanEncodeWordsIndependently()) {
+    return util::OkStatus();
+  }
+
+  // The input is cut just before the last ASCII whitespace, so that only the
+  // last word of the cut input can be normalized differently from the whole
+  // input.
+  const size_t end = buffer_.find_last_of(kWordDelimiters);
+  if (end == std::string::npos || end <= pending_) return util::OkStatus();
+
+  return EncodeBuffer(end, false, ids);
+}
+
+util::Status StreamingEncoder::Flush(std::vector<int> *ids) {
+  RETURN_IF_ERROR(Start(ids));
+  RETURN_IF_ERROR(EncodeBuffer(buffer_.size(), true, ids));
+
+  for (const auto &extra_option : processor_->encode_extra_options_) {
+    if (extra_option == SentencePieceProcessor::EOS) {
+      ids->push_back(processor_->PieceToId(
+          absl::string_view(processor_->model_->eos_piece().data())));
+    }
+  }
+  Reset();
+
+  return util::OkStatus();
+}
+
+void StreamingEncoder::Reset() {
+  buffer_.clear();
+  pending_ = 0;
+  started_ = false;
+  has_emitted_ = false;
+  last_is_unknown_ = false;
+}
+
+util::Status StreamingEncoder::EncodeBuffer(size_t end, bool is_last,
+                                            std::vector<int> *ids) {
+  const absl::string_view input = absl::string_view(buffer_).substr(0, end);
+  const auto *model_proto = processor_->model_proto_.get();
+  WordWindow window;
+  RETURN_IF_ERROR(NormalizeWords(
+      *processor_->normalizer_,
+      model_proto && model_proto->trainer_spec().treat_whitespace_as_suffix(),
+      input, has_emitted_, pending_, is_last, &window));
+  if (window.begin == window.end) return util::OkStatus();
+
+  const absl::string_view text = absl::string_view(window.normalized)
+                                     .substr(window.begin,
+                                             window.end - window.begin);
+  const std::vector<size_t> text_to_orig(
+      window.norm_to_orig.begin() + window.begin,
+      window.norm_to_orig.begin() + window.end + 1);
+  SentencePieceText spt;
+  RETURN_IF_ERROR(processor_->PopulateSentencePieceText(
+      input, text, text_to_orig, processor_->model_->Encode(text), {}, &spt));
+
+  for (const auto &sp : spt.pieces()) {
+    const bool is_unknown = processor_->IsUnknown(sp.id());
+    if (!is_unknown || !last_is_unknown_) ids->push_back(sp.id());
+    last_is_unknown_ = is_unknown;
+  }
+
+  // The last emitted word is kept as a context, so that the following words
+  // are normalized as in the middle of the input.
+  if (!is_last) {
+    pending_ = window.pending - window.context;
+    has_emitted_ = true;
+    buffer_.erase(0, window.context);
+  }
+
+  return util::OkStatus();
+}
+
+ProcessorHandle::Snapshot::Snapshot(std::atomic<int64_t> *readers,
+                                    const SentencePieceProcessor *processor)
+    : readers_(readers), processor_(processor) {}
+
+ProcessorHandle::Snapshot::Snapshot(Snapshot &&other)
+    : readers_(other.readers_), processor_(other.processor_) {
+  other.readers_ = nullptr;
+  other.processor_ = nullptr;
+}
+
+ProcessorHandle::Snapshot &ProcessorHandle::Snapshot::operator=(
+    Snapshot &&other) {
+  if (this != &other) {
+    Release();
+    std::swap(readers_, other.readers_);
+    std::swap(processor_, other.processor_);
+  }
+  return *this;
+}
+
+ProcessorHandle::Snapshot::~Snapshot() { Release(); }
+
+void ProcessorHandle::Snapshot::Release() {
+  if (readers_) readers_->fetch_sub(1, std::memory_order_release);
+  readers_ = nullptr;
+  processor_ = nullptr;
+}
+
+ProcessorHandle::ProcessorHandle()
+    : processor_(nullptr), epoch_(0), generation_(0) {
+  for (auto &readers : readers_) {
+    for (auto &stripe : readers) stripe.count.store(0);
+  }
+}
+
+ProcessorHandle::~ProcessorHandle() { delete processor_.load(); }
+
+util::Status ProcessorHandle::Load(absl::string_view filename) {
+  auto processor = absl::make_unique<SentencePieceProcessor>();
+  RETURN_IF_ERROR(processor->Load(filename));
+  return Reset(std::move(processor));
+}
+
+util::Status ProcessorHandle::LoadFromSerializedProto(
+    absl::string_view serialized) {
+  auto processor = absl::make_unique<SentencePieceProcessor>();
+  RETURN_IF_ERROR(processor->LoadFromSerializedProto(serialized));
+  return Reset(std::move(processor));
+}
+
+util::Status ProcessorHandle::Reset(
+    std::unique_ptr<SentencePieceProcessor> processor) {
+  CHECK_OR_RETURN(processor) << "processor is null.";
+  RETURN_IF_ERROR(processor->status());
+
+  std::lock_guard<std::mutex> lock(reload_mutex_);
+  const SentencePieceProcessor *old = processor_.exchange(processor.release());
+  ++generation_;
+
+  // A reader registers itself and then reads the pointer, so a reader of
+  // `old` is registered before the exchange above, in either parity. A
+  // reader which read the previous epoch late may register after the first
+  // wait, but it reads the new pointer. Waiting for both parities after the
+  // exchange therefore covers all readers of `old`.
+  WaitForReaders();
+  WaitForReaders();
+  delete old;
+
+  return util::OkStatus();
+}
+
+ProcessorHandle::Snapshot ProcessorHandle::Acquire() const {
+  const size_t stripe =
+      std::hash<std::thread::id>()(std::this_thread::get_id()) % kNumStripes;
+  auto *readers = &readers_[epoch_.load() & 1][stripe].count;
+  readers->fetch_add(1);
+  return Snapshot(readers, processor_.load());
+}
+
+void ProcessorHandle::WaitForReaders() {
+  const uint64_t epoch = epoch_.fetch_add(1);
+  for (const auto &stripe : readers_[epoch & 1]) {
+    while (stripe.count.load() != 0) {
+      std::this_thread::yield();
+    }
+  }
+}
+
 util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
                                             SentencePieceText *spt) const {
   std::vector<std::string> pieces;
@@ -615,11 +2063,26 @@ util::Status SentencePieceProcessor::Decode(const std::vector<int> &ids,
   return Decode(pieces, spt);
 }
 
+namespace {
+// Size of the stack block which backs the arena in *AsSerializedProto().
+// Most sentences fit in it, so the arena does not allocate at all.
+constexpr size_t kSerializedProtoArenaBlockSize = 8192;
+
+google::protobuf::ArenaOptions SerializedProtoArenaOptions(char *block) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = block;
+  options.initial_block_size = kSerializedProtoArenaBlockSize;
+  return options;
+}
+}  // namespace
+
 std::string SentencePieceProcessor::EncodeAsSerializedProto(
     absl::string_view input) const {
-  SentencePieceText spt;
-  if (!Encode(input, &spt).ok()) return "";
-  return spt.SerializeAsString();
+  alignas(8) char block[kSerializedProtoArenaBlockSize];
+  google::protobuf::Arena arena(SerializedProtoArenaOptions(block));
+  SentencePieceText *spt = nullptr;
+  if (!Encode(input, &arena, &spt).ok()) return "";
+  return spt->SerializeAsString();
 }
 
 std::string SentencePieceProcessor::SampleEncodeAsSerializedProto(
@@ -631,9 +2094,11 @@ std::string SentencePieceProcessor::SampleEncodeAsSerializedProto(
 
 std::string SentencePieceProcessor::NBestEncodeAsSerializedProto(
     absl::string_view input, int nbest_size) const {
-  NBestSentencePieceText spt;
-  if (!NBestEncode(input, nbest_size, &spt).ok()) return "";
-  return spt.SerializeAsString();
+  alignas(8) char block[kSerializedProtoArenaBlockSize];
+  google::protobuf::Arena arena(SerializedProtoArenaOptions(block));
+  NBestSentencePieceText *nbest_spt = nullptr;
+  if (!NBestEncode(input, nbest_size, &arena, &nbest_spt).ok()) return "";
+  return nbest_spt->SerializeAsString();
 }
 
 std::string SentencePieceProcessor::DecodePiecesAsSerializedProto(
@@ -756,6 +2221,36 @@ util::Status SentencePieceProcessor::ApplyExtraOptions(
   return util::OkStatus();
 }
 
+util::Status SentencePieceProcessor::ApplyExtraOptions(
+    const std::vector<ExtraOption> &extra_options,
+    CompactEncoding *encoding) const {
+  // BOS and EOS have no offsets in SentencePieceText, i.e., begin == end == 0.
+  for (const auto &extra_option : extra_options) {
+    switch (extra_option) {
+      case REVERSE:
+        std::reverse(encoding->ids.begin(), encoding->ids.end());
+        std::reverse(encoding->begins.begin(), encoding->begins.end());
+        std::reverse(encoding->ends.begin(), encoding->ends.end());
+        break;
+      case EOS:
+        encoding->push_back(
+            PieceToId(absl::string_view(model_->eos_piece().data())), 0, 0);
+        break;
+      case BOS:
+        encoding->ids.insert(
+            encoding->ids.begin(),
+            PieceToId(absl::string_view(model_->bos_piece().data())));
+        encoding->begins.insert(encoding->begins.begin(), 0);
+        encoding->ends.insert(encoding->ends.begin(), 0);
+        break;
+      default:
+        return util::InternalError("unknown extra_option type.");
+    }
+  }
+
+  return util::OkStatus();
+}
+
 // static
 util::Status SentencePieceProcessor::ParseExtraOptions(
     absl::string_view _extra_option,
@@ -793,11 +2288,44 @@ util::Status SentencePieceProcessor::ParseExtraOptions(
 
 void SentencePieceProcessor::SetModel(std::unique_ptr<ModelInterface> &&model) {
   model_ = std::move(model);
+  // The injected model may not be consistent with `model_proto_`.
+  decode_surfaces_.clear();
+  decode_offsets_.clear();
+  decode_flags_.clear();
+  ClearPrefixCache();
 }
 
 void SentencePieceProcessor::SetNormalizer(
     std::unique_ptr<normalizer::Normalizer> &&normalizer) {
   normalizer_ = std::move(normalizer);
+  ClearPrefixCache();
+}
+
+util::Status SentencePieceProcessor::GetMetrics(
+    ProcessorMetrics *metrics) const {
+  CHECK_OR_RETURN(metrics) << "output metrics is null";
+  CHECK_OR_RETURN(metrics_)
+      << "Metrics are not enabled. Rebuild with -DSPM_ENABLE_METRICS=ON.";
+  metrics_->Snapshot(metrics);
+  return util::OkStatus();
+}
+
+void SentencePieceProcessor::ResetMetrics() {
+  if (metrics_) metrics_->Reset();
+}
+
+util::Status SentencePieceProcessor::SetPrefixCacheSize(int max_blocks) {
+  CHECK_GE_OR_RETURN(max_blocks, 0);
+  if (max_blocks == 0) {
+    prefix_cache_.reset();
+  } else {
+    prefix_cache_ = absl::make_unique<PrefixCache>(max_blocks);
+  }
+  return util::OkStatus();
+}
+
+void SentencePieceProcessor::ClearPrefixCache() {
+  if (prefix_cache_) prefix_cache_->Clear();
 }
 
 const ModelProto &SentencePieceProcessor::model_proto() const {
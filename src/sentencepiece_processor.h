@@ -15,8 +15,11 @@
 #ifndef SENTENCEPIECE_PROCESSOR_H_
 #define SENTENCEPIECE_PROCESSOR_H_
 
+#include <atomic>
+#include <cstdint>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -46,6 +49,14 @@ class string_view {
 }  // namespace absl
 #endif
 
+#ifndef SWIG
+namespace google {
+namespace protobuf {
+class Arena;
+}  // namespace protobuf
+}  // namespace google
+#endif  // SWIG
+
 namespace sentencepiece {
 
 #ifndef SWIG
@@ -163,6 +174,17 @@ namespace normalizer {
 class Normalizer;
 }  // namespace normalizer
 
+namespace random {
+class PhiloxRandomGenerator;
+}  // namespace random
+
+namespace metrics {
+class Collector;
+}  // namespace metrics
+
+class PrefixCache;
+class WorkerPool;
+
 // Defines the multiple versions of encoder within each model. Currently only
 // the Unigram model has an optimized encoder.
 enum class EncoderVersion {
@@ -178,6 +200,97 @@ namespace util {
 using bytes = std::string;
 }  // namespace util
 
+class StreamingDecoder;
+class StreamingEncoder;
+
+#ifndef SWIG
+// Part of the output kept by SentencePieceProcessor::EncodeTruncated().
+enum class TruncationMode {
+  kHead,  // Keeps the first pieces.
+  kTail   // Keeps the last pieces.
+};
+
+// Compact encoding result with byte offsets, stored as parallel arrays.
+// The i-th piece is ids[i] and corresponds to input[begins[i], ends[i]).
+// The ids and offsets are the same as those of SentencePieceText, but no
+// piece or surface string is created.
+struct CompactEncoding {
+  std::vector<int32_t> ids;
+  std::vector<int32_t> begins;
+  std::vector<int32_t> ends;
+
+  size_t size() const { return ids.size(); }
+  bool empty() const { return ids.empty(); }
+
+  void clear() {
+    ids.clear();
+    begins.clear();
+    ends.clear();
+  }
+
+  void reserve(size_t size) {
+    ids.reserve(size);
+    begins.reserve(size);
+    ends.reserve(size);
+  }
+
+  void push_back(int32_t id, int32_t begin, int32_t end) {
+    ids.push_back(id);
+    begins.push_back(begin);
+    ends.push_back(end);
+  }
+};
+
+// Snapshot of the encoding metrics of SentencePieceProcessor.
+// Metrics are recorded only when the library is built with
+// -DSPM_ENABLE_METRICS=ON.
+struct ProcessorMetrics {
+  // Number of encode calls and the total size of their inputs in bytes.
+  int64_t num_encodes = 0;
+  int64_t input_bytes = 0;
+
+  // Number of output pieces, and the unknown and byte-fallback pieces
+  // among them. NBestEncode counts the pieces of every hypothesis.
+  int64_t output_tokens = 0;
+  int64_t unknown_tokens = 0;
+  int64_t byte_fallback_tokens = 0;
+
+  // Accumulated wall time of each encoding stage in nanoseconds.
+  int64_t normalize_nanos = 0;
+  int64_t model_encode_nanos = 0;
+  int64_t populate_nanos = 0;
+  int64_t extra_options_nanos = 0;
+
+  double unknown_rate() const;
+  double byte_fallback_rate() const;
+
+  // Returns a human-readable dump of the metrics.
+  std::string DebugString() const;
+};
+
+// Precompiled vocabulary restriction passed to each encode call. Unlike
+// SentencePieceProcessor::SetVocabulary(), a mask does not modify the
+// processor, so callers with different vocabularies can share one processor
+// concurrently. Built by SentencePieceProcessor::BuildVocabularyMask() and
+// valid only for the model it was built with.
+class VocabularyMask {
+ public:
+  VocabularyMask() {}
+
+  // Returns true if the piece `id` may be used. 0 <= id < size().
+  bool IsAllowed(int id) const { return (bits_[id >> 6] >> (id & 63)) & 1; }
+
+  // Returns the vocabulary size of the model.
+  int size() const { return size_; }
+
+ private:
+  friend class SentencePieceProcessor;
+
+  std::vector<uint64_t> bits_;
+  int size_ = 0;
+};
+#endif  // SWIG
+
 class SentencePieceProcessor {
  public:
   SentencePieceProcessor();
@@ -242,6 +355,19 @@ class SentencePieceProcessor {
   virtual util::Status Encode(absl::string_view input,
                               std::vector<int> *ids) const;
 
+#ifndef SWIG
+  // Given a UTF8 input, encodes it into ids with their byte offsets in
+  // `input`. `input` must be shorter than 2GB.
+  virtual util::Status Encode(absl::string_view input,
+                              CompactEncoding *encoding) const;
+#endif  // SWIG
+
+  // Given a UTF8 input, returns the number of pieces Encode() produces,
+  // including the pieces added by byte fallback and the encode extra
+  // options. The pieces themselves are not created.
+  virtual util::Status CountTokens(absl::string_view input,
+                                   int *num_tokens) const;
+
   // Given a sequence of pieces, decodes it into a detokenized output.
   virtual util::Status Decode(const std::vector<std::string> &pieces,
                               std::string *detokenized) const;
@@ -250,6 +376,48 @@ class SentencePieceProcessor {
   virtual util::Status Decode(const std::vector<int> &ids,
                               std::string *detokenized) const;
 
+  //////////////////////////////////////////////////////////////
+  // Batch API.
+  //
+  // Encodes a batch of inputs into ids with `num_threads` threads.
+  // All ids are concatenated into `ids`, and the ids of inputs[i] are
+  // ids[offsets[i], offsets[i + 1]).
+  virtual util::Status EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                   int num_threads, std::vector<int> *ids,
+                                   std::vector<size_t> *offsets) const;
+
+#ifndef SWIG
+  // Same as above, but also returns the byte offsets of every piece.
+  // The pieces of inputs[i] are encodings[offsets[i], offsets[i + 1]), and
+  // their offsets are relative to inputs[i].
+  virtual util::Status EncodeBatch(const std::vector<absl::string_view> &inputs,
+                                   int num_threads, CompactEncoding *encodings,
+                                   std::vector<size_t> *offsets) const;
+#endif  // SWIG
+
+  // Counts the tokens of a batch of inputs with `num_threads` threads.
+  // (*num_tokens)[i] is the number of tokens of inputs[i].
+  virtual util::Status CountTokensBatch(
+      const std::vector<absl::string_view> &inputs, int num_threads,
+      std::vector<int> *num_tokens) const;
+
+  // Decodes a batch of id sequences with `num_threads` threads.
+  // The i-th sequence is ids[offsets[i], offsets[i + 1]), where
+  // offsets.front() == 0 and offsets.back() == ids.size().
+  // All detokenized outputs are concatenated into `detokenized`, and
+  // the i-th output is detokenized[detokenized_offsets[i],
+  // detokenized_offsets[i + 1]).
+  virtual util::Status DecodeBatch(
+      const std::vector<int> &ids, const std::vector<size_t> &offsets,
+      int num_threads, std::string *detokenized,
+      std::vector<size_t> *detokenized_offsets) const;
+
+  // Same as above, but the i-th sequence is given as ids[i].
+  virtual util::Status DecodeBatch(
+      const std::vector<std::vector<int>> &ids, int num_threads,
+      std::string *detokenized,
+      std::vector<size_t> *detokenized_offsets) const;
+
   // Sets the encoder version. Normally users do not need to call this function.
   // But they can call this fucntion just in case if they want to fall back to
   // the original encoder.
@@ -287,6 +455,8 @@ class SentencePieceProcessor {
   // - BPE (--model_type=bpe):
   // `alpha` is the dropout probability `p` of bpe merge operations
   // in https://arxiv.org/abs/1910.13267
+  // A seed given to SetRandomGeneratorSeed() samples different
+  // segmentations than 0.1.94 and earlier, with the same distribution.
   // Nbest-based sampling is not supported so nbest_size parameter is ignored in
   // BPE.
   virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
@@ -297,6 +467,20 @@ class SentencePieceProcessor {
   virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
                                     float alpha, std::vector<int> *ids) const;
 
+  // Same as above, but draws random numbers from a counter-based stream
+  // identified by (`seed`, `stream`) instead of the thread-local generator.
+  // Passing e.g. the sentence index as `stream` makes the sampling
+  // reproducible regardless of the number of threads.
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, uint64_t seed,
+                                    uint64_t stream,
+                                    std::vector<std::string> *pieces) const;
+
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, uint64_t seed,
+                                    uint64_t stream,
+                                    std::vector<int> *ids) const;
+
   //////////////////////////////////////////////////////////////
   // Advanced API returning SentencePieceText, which manages
   // utf8-byte alignments between user-input/detokenized text
@@ -315,6 +499,13 @@ class SentencePieceProcessor {
   virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
                                     float alpha, SentencePieceText *spt) const;
 
+  // Same as above, but draws random numbers from the stream (`seed`,
+  // `stream`).
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, uint64_t seed,
+                                    uint64_t stream,
+                                    SentencePieceText *spt) const;
+
   // Given a sequence of pieces, decodes it into SentencePieceText.
   virtual util::Status Decode(const std::vector<std::string> &pieces,
                               SentencePieceText *spt) const;
@@ -323,6 +514,103 @@ class SentencePieceProcessor {
   virtual util::Status Decode(const std::vector<int> &ids,
                               SentencePieceText *spt) const;
 
+#ifndef SWIG
+  // Arena-aware variants of Encode() and NBestEncode(). The result is created
+  // on `arena` and stored to `*spt` (`*nbest_spt`) even when an error is
+  // returned. All the pieces are released at once when `arena` is destroyed.
+  // When `arena` is nullptr, the caller owns the result.
+  //
+  // Messages are allocated on the arena only when the protobuf runtime
+  // supports arenas for them (protobuf >= 3.14). Otherwise, the top-level
+  // message is owned by the arena and its pieces are heap-allocated.
+  virtual util::Status Encode(absl::string_view input,
+                              google::protobuf::Arena *arena,
+                              SentencePieceText **spt) const;
+
+  virtual util::Status NBestEncode(absl::string_view input, int nbest_size,
+                                   google::protobuf::Arena *arena,
+                                   NBestSentencePieceText **nbest_spt) const;
+
+  // Encodes `input` and keeps at most `max_tokens` pieces from the head or
+  // the tail, including the bos/eos pieces of the encode extra options, which
+  // are applied after the truncation. The kept pieces are the same as those
+  // of Encode(). Returns an error when `max_tokens` is less than the number
+  // of the bos/eos pieces.
+  //
+  // When no piece of the model spans a word boundary, the input is
+  // normalized and segmented in growing windows cut at whitespace, and only
+  // the part needed for `max_tokens` is processed. Otherwise, the whole input
+  // is encoded and truncated. With kTail, the unigram path scores of the
+  // window start from zero, so segmentations whose scores tie within float
+  // precision of the whole-input path score may be resolved differently.
+  virtual util::Status EncodeTruncated(absl::string_view input, int max_tokens,
+                                       TruncationMode mode,
+                                       SentencePieceText *spt) const;
+
+  // Same as above, but returns ids.
+  virtual util::Status EncodeTruncated(absl::string_view input, int max_tokens,
+                                       TruncationMode mode,
+                                       std::vector<int> *ids) const;
+
+  // Encodes a single long `input` with `num_threads` threads. The normalized
+  // text is split into chunks of at least 8KB at word boundaries, which are
+  // segmented in parallel. Falls back to Encode() when a piece of the model
+  // spans a word boundary. BPE, word and char models return the same result
+  // as Encode(). With unigram models, the path scores restart from zero at
+  // the chunk boundaries, while Encode() accumulates them in float over the
+  // whole input. Segmentations whose scores tie within float precision may
+  // then be resolved differently, so the pieces can differ from Encode()
+  // although both are best segmentations within float precision.
+  //
+  // The chunks but the first are encoded by worker threads, which are
+  // started on the first call and reused by later calls. Use EncodeBatch()
+  // for many short inputs.
+  virtual util::Status EncodeParallel(absl::string_view input, int num_threads,
+                                      SentencePieceText *spt) const;
+
+  // Same as above, but returns ids.
+  virtual util::Status EncodeParallel(absl::string_view input, int num_threads,
+                                      std::vector<int> *ids) const;
+
+  //////////////////////////////////////////////////////////////
+  // Per-call vocabulary restriction.
+  //
+  // Builds `mask` allowing the same pieces as SetVocabulary(valid_vocab).
+  // Only unigram and BPE models support masks.
+  virtual util::Status BuildVocabularyMask(
+      const std::vector<std::string> &valid_vocab, VocabularyMask *mask) const;
+
+  // Same as Encode(), NBestEncode() and SampleEncode(), but the pieces
+  // disallowed by `mask` are not used, as if SetVocabulary() was called.
+  virtual util::Status Encode(absl::string_view input,
+                              const VocabularyMask &mask,
+                              std::vector<std::string> *pieces) const;
+
+  virtual util::Status Encode(absl::string_view input,
+                              const VocabularyMask &mask,
+                              std::vector<int> *ids) const;
+
+  virtual util::Status Encode(absl::string_view input,
+                              const VocabularyMask &mask,
+                              SentencePieceText *spt) const;
+
+  virtual util::Status NBestEncode(absl::string_view input, int nbest_size,
+                                   const VocabularyMask &mask,
+                                   std::vector<std::vector<int>> *ids) const;
+
+  virtual util::Status NBestEncode(absl::string_view input, int nbest_size,
+                                   const VocabularyMask &mask,
+                                   NBestSentencePieceText *nbest_spt) const;
+
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, const VocabularyMask &mask,
+                                    std::vector<int> *ids) const;
+
+  virtual util::Status SampleEncode(absl::string_view input, int nbest_size,
+                                    float alpha, const VocabularyMask &mask,
+                                    SentencePieceText *spt) const;
+#endif  // SWIG
+
   //////////////////////////////////////////////////////////////
   // Handy methods that return the result directly.
   // These functions ignore internal errors.
@@ -457,6 +745,28 @@ class SentencePieceProcessor {
 
   // Allows injection of a normalizer instance. `normalizer` is moved.
   void SetNormalizer(std::unique_ptr<normalizer::Normalizer> &&normalizer);
+
+  //////////////////////////////////////////////////////////////
+  // Metrics.
+  //
+  // Stores a snapshot of the encoding metrics to `metrics`. Returns an
+  // error when the library is built without -DSPM_ENABLE_METRICS=ON.
+  util::Status GetMetrics(ProcessorMetrics *metrics) const;
+
+  // Resets the encoding metrics.
+  void ResetMetrics();
+
+  //////////////////////////////////////////////////////////////
+  // Prefix cache.
+  //
+  // Caches the segmentation of input prefixes shared by many inputs, such as
+  // system prompts or few-shot examples, so that Encode() of an input
+  // starting with a cached prefix only normalizes and segments the rest.
+  // Inputs are split into blocks of a few hundred bytes cut at whitespaces,
+  // and up to `max_blocks` recently used blocks are kept. 0 disables the
+  // cache. The cache is used only when no piece of the model spans a word
+  // boundary, and is cleared when the model or the vocabulary is changed.
+  util::Status SetPrefixCacheSize(int max_blocks);
 #endif
 
   // Returns immutable model proto. Useful to obtain extended
@@ -468,6 +778,9 @@ class SentencePieceProcessor {
   util::bytes serialized_model_proto() const;
 
  private:
+  friend class StreamingDecoder;
+  friend class StreamingEncoder;
+
   enum ExtraOption { REVERSE, BOS, EOS };
 
   util::Status ParseExtraOptions(absl::string_view extra_option,
@@ -476,12 +789,84 @@ class SentencePieceProcessor {
   util::Status ApplyExtraOptions(const std::vector<ExtraOption> &extra_options,
                                  SentencePieceText *spt) const;
 
+  util::Status ApplyExtraOptions(const std::vector<ExtraOption> &extra_options,
+                                 CompactEncoding *encoding) const;
+
+  // Normalizes `input` and segments the normalized text, using the prefix
+  // cache when it is enabled. `mask` is nullptr when the vocabulary is not
+  // restricted.
+  util::Status NormalizeAndEncode(
+      absl::string_view input, const VocabularyMask *mask,
+      std::string *normalized, std::vector<size_t> *norm_to_orig,
+      std::vector<std::pair<absl::string_view, int>> *result) const;
+
+  // Same as above, but reuses the segmentation of the cached prefix blocks
+  // of `input` and adds the other blocks to the cache.
+  util::Status EncodeWithPrefixCache(
+      absl::string_view input, std::string *normalized,
+      std::vector<size_t> *norm_to_orig,
+      std::vector<std::pair<absl::string_view, int>> *result) const;
+
+  // Must be called whenever the segmentation may change.
+  void ClearPrefixCache();
+
   util::Status PopulateSentencePieceText(
       absl::string_view input, absl::string_view normalized,
       const std::vector<size_t> &norm_to_orig,
       const std::vector<std::pair<absl::string_view, int>> &result,
       SentencePieceText *spt) const;
 
+  // Same as above, but applies `extra_options` instead of the encode extra
+  // options.
+  util::Status PopulateSentencePieceText(
+      absl::string_view input, absl::string_view normalized,
+      const std::vector<size_t> &norm_to_orig,
+      const std::vector<std::pair<absl::string_view, int>> &result,
+      const std::vector<ExtraOption> &extra_options,
+      SentencePieceText *spt) const;
+
+  // Same as PopulateSentencePieceText, but only ids and offsets are stored.
+  util::Status PopulateCompactEncoding(
+      absl::string_view normalized, const std::vector<size_t> &norm_to_orig,
+      const std::vector<std::pair<absl::string_view, int>> &result,
+      CompactEncoding *encoding) const;
+
+  // Implementations of Encode and NBestEncode. `mask` is nullptr when the
+  // vocabulary is not restricted.
+  util::Status EncodeInternal(absl::string_view input,
+                              const VocabularyMask *mask,
+                              SentencePieceText *spt) const;
+
+  util::Status NBestEncodeInternal(absl::string_view input, int nbest_size,
+                                   const VocabularyMask *mask,
+                                   NBestSentencePieceText *nbest_spt) const;
+
+  // Implementation of SampleEncode. Uses the thread-local generator when
+  // `rand_gen` is nullptr.
+  util::Status SampleEncodeInternal(absl::string_view input, int nbest_size,
+                                    float alpha,
+                                    random::PhiloxRandomGenerator *rand_gen,
+                                    const VocabularyMask *mask,
+                                    SentencePieceText *spt) const;
+
+  // Returns an error unless `mask` can be used with the current model.
+  util::Status CheckVocabularyMask(const VocabularyMask &mask) const;
+
+  // Precomputes the decoded surface of every id. Must be called whenever
+  // the model or the types of pieces are changed.
+  void InitializeDecodeTable();
+
+  // Returns true if DecodeWithTable() gives the same text as Decode(), i.e.,
+  // the table is available and the BOS/EOS added by the decode extra options
+  // are control symbols.
+  bool CanDecodeWithTable() const;
+
+  // Decodes `ids[0, size)` with the precomputed decode table and appends
+  // the result to `detokenized`. The text is the same as Decode(), but
+  // no SentencePieceText is created.
+  util::Status DecodeWithTable(const int *ids, size_t size,
+                               std::string *detokenized) const;
+
   std::unique_ptr<ModelInterface> model_;
   std::unique_ptr<normalizer::Normalizer> normalizer_;
   std::unique_ptr<normalizer::Normalizer> denormalizer_;
@@ -491,8 +876,242 @@ class SentencePieceProcessor {
 
   std::vector<ExtraOption> encode_extra_options_;
   std::vector<ExtraOption> decode_extra_options_;
+
+  // Decoded surfaces of all ids stored back to back. The surface of `id` is
+  // decode_surfaces_[decode_offsets_[id], decode_offsets_[id + 1]).
+  // Empty when the table is not available, e.g., a mock model is injected.
+  std::string decode_surfaces_;
+  std::vector<uint32_t> decode_offsets_;
+  std::vector<uint8_t> decode_flags_;
+
+  // Encoding metrics. nullptr when built without metrics.
+  std::unique_ptr<metrics::Collector> metrics_;
+
+  // Cache of the segmentation of common input prefixes. nullptr when
+  // disabled.
+  std::unique_ptr<PrefixCache> prefix_cache_;
+
+  // Worker threads of EncodeParallel().
+  std::unique_ptr<WorkerPool> encode_workers_;
+};
+
+#ifndef SWIG
+// StreamingDecoder:
+// Incremental de-tokenizer for token-by-token generation.
+// Decode() accepts one id at a time and returns only the text which
+// becomes visible by the id. The concatenation of all outputs including
+// Flush() is the same as SentencePieceProcessor::Decode() of all ids.
+// Byte pieces (<0xXX>) are buffered until they form a complete UTF-8
+// character.
+//
+// Usage:
+//   StreamingDecoder decoder(&sp);
+//   std::string text;
+//   for (const int id : generated_ids) {
+//     decoder.Decode(id, &text);
+//     std::cout << text;
+//   }
+//   decoder.Flush(&text);
+//   std::cout << text;
+//
+// `processor` must outlive this object and must not be reloaded.
+// The decode extra option "reverse" is not supported, nor are "bos" and
+// "eos" when their pieces are not control symbols. When the model has
+// a denormalizer, it is applied to each output separately.
+class StreamingDecoder {
+ public:
+  explicit StreamingDecoder(const SentencePieceProcessor *processor);
+  virtual ~StreamingDecoder();
+
+  // Decodes `id` and stores the newly visible text to `text`.
+  // `text` can be empty when `id` is invisible or an incomplete byte.
+  virtual util::Status Decode(int id, std::string *text);
+
+  // Stores the buffered bytes to `text`, mapping incomplete UTF-8
+  // characters to REPLACEMENT CHARACTER (U+FFFD), and resets the state.
+  virtual util::Status Flush(std::string *text);
+
+  // Resets the state to decode a new sequence.
+  virtual void Reset();
+
+ private:
+  // Appends the denormalized `text` to `output`.
+  void AppendText(absl::string_view text, std::string *output);
+
+  const SentencePieceProcessor *processor_ = nullptr;
+
+  // Byte pieces not yet emitted.
+  std::string pending_bytes_;
+
+  // Size of the text emitted so far.
+  size_t text_size_ = 0;
 };
 
+// StreamingEncoder:
+// Incremental tokenizer for unbounded input such as log streams or huge
+// single-line documents. Encode() accepts a chunk of arbitrary bytes and
+// returns only the finalized ids, i.e., those of the words followed by a
+// whitespace, as neither their normalization nor their segmentation can be
+// changed by the following input. Chunks may split multi-byte characters.
+// The concatenation of all outputs including Flush() is the same as
+// SentencePieceProcessor::Encode() of the concatenated chunks, up to the float
+// near-ties described in SentencePieceProcessor::EncodeTruncated().
+//
+// Usage:
+//   StreamingEncoder encoder(&sp);
+//   std::vector<int> ids;
+//   while (ReadChunk(&chunk)) {
+//     encoder.Encode(chunk, &ids);
+//     Consume(ids);
+//   }
+//   encoder.Flush(&ids);
+//   Consume(ids);
+//
+// Only the last few words are buffered, so the memory is bounded by the
+// longest word. When a piece of the model spans a word boundary, the whole
+// input is buffered until Flush().
+//
+// `processor` must outlive this object and must not be reloaded.
+// The encode extra option "reverse" is not supported.
+class StreamingEncoder {
+ public:
+  explicit StreamingEncoder(const SentencePieceProcessor *processor);
+  virtual ~StreamingEncoder();
+
+  // Appends `chunk` to the input and stores the newly finalized ids to `ids`.
+  virtual util::Status Encode(absl::string_view chunk, std::vector<int> *ids);
+
+  // Ends the input, stores the remaining ids to `ids`, and resets the state.
+  virtual util::Status Flush(std::vector<int> *ids);
+
+  // Resets the state to encode a new input.
+  virtual void Reset();
+
+  // Returns the size of the buffered input.
+  size_t buffered_size() const { return buffer_.size(); }
+
+ private:
+  // Checks the processor and stores bos to `ids` at the beginning of the
+  // input.
+  util::Status Start(std::vector<int> *ids);
+
+  // Encodes the words of buffer_[0, end) not emitted yet and appends their
+  // ids to `ids`. The last word is emitted only when `is_last` is true.
+  util::Status EncodeBuffer(size_t end, bool is_last, std::vector<int> *ids);
+
+  const SentencePieceProcessor *processor_ = nullptr;
+
+  // Input not emitted yet, preceded by the last emitted word.
+  std::string buffer_;
+
+  // Position in `buffer_` where the input not emitted yet starts.
+  size_t pending_ = 0;
+
+  bool started_ = false;
+  bool has_emitted_ = false;
+
+  // Whether the last emitted id is unknown. Unknown pieces are merged
+  // across the outputs.
+  bool last_is_unknown_ = false;
+};
+
+// ProcessorHandle:
+// Holds the current SentencePieceProcessor of a service and replaces it
+// while other threads keep encoding. SentencePieceProcessor::Load() mutates
+// the processor in place and must not run concurrently with Encode(); the
+// handle instead loads a new processor aside, publishes it with an atomic
+// pointer swap, and deletes the old one after all snapshots of it are
+// released (read-copy-update).
+//
+// Usage:
+//   ProcessorHandle handle;
+//   CHECK_OK(handle.Load("v1.model"));
+//
+//   // Encoding threads:
+//   auto sp = handle.Acquire();
+//   sp->Encode(input, &ids);
+//
+//   // Reloading thread:
+//   CHECK_OK(handle.Load("v2.model"));
+//
+// Acquire() never blocks and never waits for a reload; it costs an atomic
+// increment, and the release an atomic decrement. A snapshot keeps the same
+// processor until it is released, so the calls through one snapshot are
+// consistent. Reloads are serialized and wait until the snapshots of the old
+// processor are released, so snapshots should be short-lived, and a thread must
+// not reload while it holds a snapshot. All snapshots must be released before
+// the handle is destroyed.
+class ProcessorHandle {
+ public:
+  // A reference to the processor published at the time of Acquire().
+  class Snapshot {
+   public:
+    Snapshot(Snapshot &&other);
+    Snapshot &operator=(Snapshot &&other);
+    ~Snapshot();
+
+    // Returns null when no processor is loaded.
+    const SentencePieceProcessor *get() const { return processor_; }
+    const SentencePieceProcessor *operator->() const { return processor_; }
+    const SentencePieceProcessor &operator*() const { return *processor_; }
+    explicit operator bool() const { return processor_ != nullptr; }
+
+   private:
+    friend class ProcessorHandle;
+    Snapshot(std::atomic<int64_t> *readers,
+             const SentencePieceProcessor *processor);
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    void Release();
+
+    std::atomic<int64_t> *readers_ = nullptr;
+    const SentencePieceProcessor *processor_ = nullptr;
+  };
+
+  ProcessorHandle();
+  virtual ~ProcessorHandle();
+
+  // Loads the model `filename` and publishes it.
+  virtual util::Status Load(absl::string_view filename);
+
+  // Loads the serialized model proto and publishes it.
+  virtual util::Status LoadFromSerializedProto(absl::string_view serialized);
+
+  // Publishes a loaded `processor`. The processor must not be modified
+  // afterwards.
+  virtual util::Status Reset(std::unique_ptr<SentencePieceProcessor> processor);
+
+  // Returns the current processor.
+  Snapshot Acquire() const;
+
+  // Returns the number of processors published so far.
+  int64_t generation() const { return generation_.load(); }
+
+ private:
+  // Reader counts are striped over threads to avoid contention on a single
+  // cache line, and doubled by the parity of the epoch so that a reload
+  // only waits for the readers registered before it.
+  static constexpr int kNumStripes = 16;
+  struct Readers {
+    std::atomic<int64_t> count;
+    char padding[64 - sizeof(std::atomic<int64_t>)];
+  };
+
+  // Advances the epoch and waits until the readers registered in the
+  // previous epoch release their snapshots.
+  void WaitForReaders();
+
+  std::atomic<const SentencePieceProcessor *> processor_;
+  std::atomic<uint64_t> epoch_;
+  std::atomic<int64_t> generation_;
+  mutable Readers readers_[2][kNumStripes];
+
+  // Serializes the reloads.
+  std::mutex reload_mutex_;
+};
+#endif  // SWIG
+
 // Set seed value of random generator.
 // Do not set static_cast<unique_int>(-1),
 // as this seed is reserved for initializing from
@@ -12,6 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <random>
+#include <set>
+#include <thread>
 #include <utility>
 
 #include "builder.h"
@@ -232,6 +235,51 @@ TEST(SentencepieceProcessorTest, EncodeTest) {
     EXPECT_EQ(7, spt.pieces(3).end());
   }
 
+  // Long unknown sequences separated by a known piece.
+  {
+    auto mock = absl::make_unique<MockModel>();
+
+    const std::string es(500, 'E');
+    const std::string fs(500, 'F');
+    const std::string input = "ABC " + es + " " + fs;
+    const std::string normalized = WS "ABC" WS + es + WS + fs;
+
+    EncodeResult result = {{WS "ABC", 3}, {WS, 4}};
+    for (int i = 0; i < es.size(); ++i) result.emplace_back("E", 0);
+    result.emplace_back(WS, 4);
+    for (int i = 0; i < fs.size(); ++i) result.emplace_back("F", 0);
+    result.emplace_back("</s>", 2);
+
+    mock->SetEncodeResult(normalized, result);
+    sp.SetModel(std::move(mock));
+    sp.SetNormalizer(
+        absl::make_unique<normalizer::Normalizer>(normalization_spec));
+
+    SentencePieceText spt;
+    EXPECT_TRUE(sp.Encode(input, &spt).ok());
+    ASSERT_EQ(6, spt.pieces_size());
+
+    EXPECT_EQ(es, spt.pieces(2).piece());
+    EXPECT_EQ(es, spt.pieces(2).surface());
+    EXPECT_EQ(0, spt.pieces(2).id());
+    EXPECT_EQ(4, spt.pieces(2).begin());
+    EXPECT_EQ(504, spt.pieces(2).end());
+
+    EXPECT_EQ(WS, spt.pieces(3).piece());
+    EXPECT_EQ(" ", spt.pieces(3).surface());
+    EXPECT_EQ(504, spt.pieces(3).begin());
+    EXPECT_EQ(505, spt.pieces(3).end());
+
+    EXPECT_EQ(fs, spt.pieces(4).piece());
+    EXPECT_EQ(fs, spt.pieces(4).surface());
+    EXPECT_EQ(0, spt.pieces(4).id());
+    EXPECT_EQ(505, spt.pieces(4).begin());
+    EXPECT_EQ(1005, spt.pieces(4).end());
+
+    EXPECT_EQ("", spt.pieces(5).surface());  // </s>
+    EXPECT_EQ(1005, spt.pieces(5).begin());
+  }
+
   // Byte-fallback.
   {
     const absl::string_view kInput2 = WS "ABC" WS "DEFあ";
@@ -1323,6 +1371,1023 @@ TEST(SentencePieceProcessorTest, ExtraOptionsUndefinedTest) {
   EXPECT_FALSE(sp.SetDecodeExtraOptions("eos").ok());
 }
 
+// Returns a model with <unk>, <s>, </s>, 256 byte pieces and `pieces`.
+ModelProto MakeByteFallbackModelProto(const std::vector<std::string> &pieces) {
+  ModelProto model_proto;
+  auto *sp1 = model_proto.add_pieces();
+  auto *sp2 = model_proto.add_pieces();
+  auto *sp3 = model_proto.add_pieces();
+
+  sp1->set_type(ModelProto::SentencePiece::UNKNOWN);
+  sp1->set_piece("<unk>");
+  sp2->set_type(ModelProto::SentencePiece::CONTROL);
+  sp2->set_piece("<s>");
+  sp3->set_type(ModelProto::SentencePiece::CONTROL);
+  sp3->set_piece("</s>");
+
+  for (int i = 0; i < 256; ++i) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_type(ModelProto::SentencePiece::BYTE);
+    sp->set_piece(ByteToPiece(i));
+  }
+
+  for (const auto &piece : pieces) AddPiece(&model_proto, piece, 0.0);
+
+  model_proto.mutable_trainer_spec()->set_byte_fallback(true);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  return model_proto;
+}
+
+TEST(SentencePieceProcessorTest, DecodeTableTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const int kByte = 3;  // id of <0x00>.
+  const int a = sp.PieceToId(WS "a");
+  const int b = sp.PieceToId("b");
+  const int ws = sp.PieceToId(WS);
+  const int cd = sp.PieceToId("c" WS "d");
+
+  const std::vector<std::vector<int>> inputs = {
+      {},
+      {a, b, cd},
+      {1, a, b, 2},
+      {ws, a},
+      {0, a, 0, 0, b},
+      // "あ" -> 0xE3 0x81 0x82
+      {kByte + 0xE3, kByte + 0x81, kByte + 0x82, a},
+      {a, kByte + 0xE3, kByte + 0x81, kByte + 0x82},
+      // Incomplete and invalid bytes.
+      {kByte + 0xE3, kByte + 0x81, b, kByte + 0x80, kByte + 0xE3, 1,
+       kByte + 0x81, kByte + 0x82},
+      // "😀" -> 0xF0 0x9F 0x98 0x80
+      {kByte + 0xF0, kByte + 0x9F, kByte + 0x98, kByte + 0x80, kByte + 0x80}};
+
+  auto DecodeWithSentencePieceText = [&sp](const std::vector<int> &ids) {
+    SentencePieceText spt;
+    EXPECT_TRUE(sp.Decode(ids, &spt).ok());
+    return spt.text();
+  };
+
+  for (const auto &extra_options : {"", "bos:eos", "reverse", "bos:reverse"}) {
+    EXPECT_TRUE(sp.SetDecodeExtraOptions(extra_options).ok());
+    for (const auto &ids : inputs) {
+      std::string output;
+      EXPECT_TRUE(sp.Decode(ids, &output).ok());
+      EXPECT_EQ(DecodeWithSentencePieceText(ids), output);
+    }
+  }
+
+  EXPECT_TRUE(sp.SetDecodeExtraOptions("").ok());
+  EXPECT_EQ("a\xE3\x81\x82 a", sp.DecodeIds({a, kByte + 0xE3, kByte + 0x81,
+                                              kByte + 0x82, a}));
+  EXPECT_EQ("\xEF\xBF\xBD" "b", sp.DecodeIds({kByte + 0xE3, b}));
+
+  std::string output;
+  EXPECT_FALSE(sp.Decode({a, -1}, &output).ok());
+  EXPECT_FALSE(sp.Decode({a, sp.GetPieceSize()}, &output).ok());
+}
+
+TEST(SentencePieceProcessorTest, DecodeTableVisibleBosEosTest) {
+  ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d"});
+  // <s> and </s> are visible in the decoded text.
+  model_proto.mutable_pieces(1)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+  model_proto.mutable_pieces(2)->set_type(ModelProto::SentencePiece::NORMAL);
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const int a = sp.PieceToId(WS "a");
+  const int b = sp.PieceToId("b");
+  const std::vector<std::vector<int>> inputs = {{}, {a, b}, {b, a, a}};
+
+  for (const auto &extra_options : {"bos", "eos", "bos:eos", "eos:reverse"}) {
+    EXPECT_TRUE(sp.SetDecodeExtraOptions(extra_options).ok());
+    std::vector<int> ids;
+    std::vector<size_t> offsets = {0};
+    std::string expected_batch;
+    for (const auto &input : inputs) {
+      SentencePieceText spt;
+      EXPECT_TRUE(sp.Decode(input, &spt).ok());
+      std::string output;
+      EXPECT_TRUE(sp.Decode(input, &output).ok());
+      EXPECT_EQ(spt.text(), output);
+      expected_batch += spt.text();
+      ids.insert(ids.end(), input.begin(), input.end());
+      offsets.push_back(ids.size());
+    }
+    std::string output;
+    std::vector<size_t> output_offsets;
+    EXPECT_TRUE(sp.DecodeBatch(ids, offsets, 2, &output, &output_offsets).ok());
+    EXPECT_EQ(expected_batch, output);
+
+    StreamingDecoder decoder(&sp);
+    EXPECT_FALSE(decoder.Decode(a, &output).ok());
+  }
+
+  EXPECT_TRUE(sp.SetDecodeExtraOptions("bos:eos").ok());
+  // The leading space is removed from <s>, not from the first id.
+  EXPECT_EQ("<s> ab</s>", sp.DecodeIds({a, b}));
+}
+
+TEST(SentencePieceProcessorTest, EncodeBatchTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d", "c"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 100; ++i) {
+    texts.emplace_back(std::string(i % 5, 'a') + " bc \xE3\x81\x82" +
+                       std::string(i % 3, 'b'));
+  }
+  texts.emplace_back("");
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+
+  for (const int num_threads : {-1, 1, 3, 200}) {
+    std::vector<int> ids;
+    std::vector<size_t> offsets;
+    EXPECT_TRUE(sp.EncodeBatch(inputs, num_threads, &ids, &offsets).ok());
+    EXPECT_EQ(inputs.size() + 1, offsets.size());
+    EXPECT_EQ(ids.size(), offsets.back());
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      EXPECT_EQ(sp.EncodeAsIds(inputs[i]),
+                std::vector<int>(ids.begin() + offsets[i],
+                                 ids.begin() + offsets[i + 1]));
+    }
+  }
+
+  std::vector<int> ids;
+  std::vector<size_t> offsets;
+  EXPECT_TRUE(sp.EncodeBatch({}, 4, &ids, &offsets).ok());
+  EXPECT_TRUE(ids.empty());
+  EXPECT_EQ(std::vector<size_t>({0}), offsets);
+}
+
+TEST(SentencePieceProcessorTest, ArenaEncodeTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d", "c"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const std::string input = "ab c d \xE3\x81\x82 aaa";
+  SentencePieceText expected;
+  EXPECT_TRUE(sp.Encode(input, &expected).ok());
+  NBestSentencePieceText nbest_expected;
+  EXPECT_TRUE(sp.NBestEncode(input, 3, &nbest_expected).ok());
+
+  {
+    google::protobuf::Arena arena;
+    SentencePieceText *spt = nullptr;
+    EXPECT_TRUE(sp.Encode(input, &arena, &spt).ok());
+    ASSERT_NE(nullptr, spt);
+    EXPECT_EQ(expected.SerializeAsString(), spt->SerializeAsString());
+    // With arena-enabled messages (system protobuf >= 3.14), the pieces are
+    // also allocated on the arena.
+    if (google::protobuf::Arena::is_arena_constructable<
+            SentencePieceText>::value) {
+      EXPECT_EQ(&arena, spt->GetArena());
+      ASSERT_GT(spt->pieces_size(), 0);
+      for (const auto &piece : spt->pieces()) {
+        EXPECT_EQ(&arena, piece.GetArena());
+      }
+    }
+
+    NBestSentencePieceText *nbest_spt = nullptr;
+    EXPECT_TRUE(sp.NBestEncode(input, 3, &arena, &nbest_spt).ok());
+    ASSERT_NE(nullptr, nbest_spt);
+    EXPECT_EQ(nbest_expected.SerializeAsString(),
+              nbest_spt->SerializeAsString());
+  }
+
+  // Without arena, the caller owns the result.
+  {
+    SentencePieceText *spt = nullptr;
+    EXPECT_TRUE(sp.Encode(input, nullptr, &spt).ok());
+    std::unique_ptr<SentencePieceText> owned(spt);
+    EXPECT_EQ(expected.SerializeAsString(), owned->SerializeAsString());
+  }
+
+  EXPECT_EQ(expected.SerializeAsString(), sp.EncodeAsSerializedProto(input));
+  EXPECT_EQ(nbest_expected.SerializeAsString(),
+            sp.NBestEncodeAsSerializedProto(input, 3));
+
+  // Longer than the initial arena block.
+  std::string long_input;
+  for (int i = 0; i < 1000; ++i) long_input += "ab c \xE3\x81\x82 ";
+  EXPECT_TRUE(sp.Encode(long_input, &expected).ok());
+  EXPECT_EQ(expected.SerializeAsString(),
+            sp.EncodeAsSerializedProto(long_input));
+}
+
+TEST(SentencePieceProcessorTest, CompactEncodingTest) {
+  ModelProto byte_fallback_model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d", "c"});
+
+  // The same pieces without byte fallback, so unknown runs are merged.
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+
+  const std::vector<std::string> inputs = {
+      "",
+      "ab c d",
+      "  ab  \xE3\x81\x82\xE3\x81\x84 xyz c d ",
+      "\xEF\xBC\xA1" "bc",  // Normalized by NFKC.
+  };
+
+  for (const auto *proto : {&model_proto, &byte_fallback_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+    for (const char *extra_options : {"", "bos:eos", "reverse:bos"}) {
+      EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+      for (const auto &input : inputs) {
+        SentencePieceText spt;
+        EXPECT_TRUE(sp.Encode(input, &spt).ok());
+        CompactEncoding encoding;
+        EXPECT_TRUE(sp.Encode(input, &encoding).ok());
+        ASSERT_EQ(spt.pieces_size(), encoding.size());
+        for (int i = 0; i < spt.pieces_size(); ++i) {
+          EXPECT_EQ(spt.pieces(i).id(), encoding.ids[i]);
+          EXPECT_EQ(spt.pieces(i).begin(), encoding.begins[i]);
+          EXPECT_EQ(spt.pieces(i).end(), encoding.ends[i]);
+        }
+      }
+    }
+
+    // Batch.
+    const std::vector<absl::string_view> batch(inputs.begin(), inputs.end());
+    for (const int num_threads : {1, 3}) {
+      CompactEncoding encodings;
+      std::vector<size_t> offsets;
+      EXPECT_TRUE(
+          sp.EncodeBatch(batch, num_threads, &encodings, &offsets).ok());
+      ASSERT_EQ(batch.size() + 1, offsets.size());
+      EXPECT_EQ(encodings.size(), offsets.back());
+      for (size_t i = 0; i < batch.size(); ++i) {
+        CompactEncoding encoding;
+        EXPECT_TRUE(sp.Encode(batch[i], &encoding).ok());
+        EXPECT_EQ(encoding.ids,
+                  std::vector<int32_t>(encodings.ids.begin() + offsets[i],
+                                       encodings.ids.begin() + offsets[i + 1]));
+        EXPECT_EQ(encoding.begins,
+                  std::vector<int32_t>(
+                      encodings.begins.begin() + offsets[i],
+                      encodings.begins.begin() + offsets[i + 1]));
+        EXPECT_EQ(encoding.ends, std::vector<int32_t>(
+                                     encodings.ends.begin() + offsets[i],
+                                     encodings.ends.begin() + offsets[i + 1]));
+      }
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, CountTokensTest) {
+  ModelProto byte_fallback_model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d", "c"});
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+
+  const std::vector<std::string> inputs = {
+      "",
+      "ab c d",
+      "  ab  \xE3\x81\x82\xE3\x81\x84 xyz c d ",
+      "xyz",
+      "\xEF\xBC\xA1" "bc",
+  };
+  const std::vector<absl::string_view> batch(inputs.begin(), inputs.end());
+
+  for (const auto *proto : {&model_proto, &byte_fallback_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+    for (const auto version :
+         {EncoderVersion::kOptimized, EncoderVersion::kOriginal}) {
+      EXPECT_TRUE(sp.SetEncoderVersion(version).ok());
+      for (const char *extra_options : {"", "bos:eos", "reverse:eos"}) {
+        EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+        std::vector<int> expected;
+        for (const auto &input : inputs) {
+          int num_tokens = -1;
+          EXPECT_TRUE(sp.CountTokens(input, &num_tokens).ok());
+          expected.push_back(sp.EncodeAsIds(input).size());
+          EXPECT_EQ(expected.back(), num_tokens);
+        }
+
+        for (const int num_threads : {1, 3}) {
+          std::vector<int> num_tokens;
+          EXPECT_TRUE(
+              sp.CountTokensBatch(batch, num_threads, &num_tokens).ok());
+          EXPECT_EQ(expected, num_tokens);
+        }
+      }
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, EncodeTruncatedTest) {
+  const std::vector<std::string> pieces = {WS "a", "b",  WS,    WS "c",
+                                           "d",    "cd", WS "ab"};
+  ModelProto byte_fallback_model_proto = MakeByteFallbackModelProto(pieces);
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+  ModelProto bpe_model_proto = model_proto;
+  bpe_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+  // "c" WS "d" spans a word boundary, so the whole input is encoded.
+  ModelProto cross_model_proto = model_proto;
+  AddPiece(&cross_model_proto, "c" WS "d", 0.0);
+
+  std::string input;
+  const char *kWords[] = {"ab", "c", "dd", "x", "cd", "\xE3\x81\x82", "abxy"};
+  for (int i = 0; i < 500; ++i) {
+    input += kWords[(i * 7 + i / 3) % 7];
+    input += (i % 11 == 0) ? "  " : " ";
+  }
+
+  for (const auto *proto : {&model_proto, &byte_fallback_model_proto,
+                            &bpe_model_proto, &cross_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+
+    SentencePieceText full;
+    EXPECT_TRUE(sp.Encode(input, &full).ok());
+    const std::vector<int> full_ids = sp.EncodeAsIds(input);
+    EXPECT_LT(200, full.pieces_size());
+
+    for (const auto mode : {TruncationMode::kHead, TruncationMode::kTail}) {
+      const bool keep_head = mode == TruncationMode::kHead;
+      for (const int max_tokens : {0, 1, 5, 100, 700, 100000}) {
+        const int size = std::min(max_tokens, full.pieces_size());
+        const int offset = keep_head ? 0 : full.pieces_size() - size;
+
+        EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+        SentencePieceText spt;
+        EXPECT_TRUE(sp.EncodeTruncated(input, max_tokens, mode, &spt).ok());
+        EXPECT_EQ(input, spt.text());
+        ASSERT_EQ(size, spt.pieces_size());
+        for (int i = 0; i < size; ++i) {
+          const auto &expected = full.pieces(offset + i);
+          EXPECT_EQ(expected.piece(), spt.pieces(i).piece());
+          EXPECT_EQ(expected.id(), spt.pieces(i).id());
+          EXPECT_EQ(expected.surface(), spt.pieces(i).surface());
+          EXPECT_EQ(expected.begin(), spt.pieces(i).begin());
+          EXPECT_EQ(expected.end(), spt.pieces(i).end());
+        }
+
+        // bos and eos are counted in `max_tokens`, which must leave room
+        // for both of them.
+        EXPECT_TRUE(sp.SetEncodeExtraOptions("bos:eos").ok());
+        std::vector<int> ids;
+        if (max_tokens < 2) {
+          EXPECT_FALSE(
+              sp.EncodeTruncated(input, max_tokens, mode, &ids).ok());
+          EXPECT_TRUE(sp.SetEncodeExtraOptions("eos").ok());
+          EXPECT_EQ(max_tokens == 1,
+                    sp.EncodeTruncated(input, max_tokens, mode, &ids).ok());
+          if (max_tokens == 1) {
+            EXPECT_EQ(std::vector<int>({sp.eos_id()}), ids);
+          }
+          continue;
+        }
+        std::vector<int> expected_ids = {sp.bos_id()};
+        const int body = std::min<int>(max_tokens - 2, full_ids.size());
+        const auto it =
+            keep_head ? full_ids.begin() : full_ids.end() - body;
+        expected_ids.insert(expected_ids.end(), it, it + body);
+        expected_ids.push_back(sp.eos_id());
+        EXPECT_TRUE(sp.EncodeTruncated(input, max_tokens, mode, &ids).ok());
+        EXPECT_EQ(expected_ids, ids);
+      }
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, EncodeParallelTest) {
+  const std::vector<std::string> pieces = {WS "a", "b",  WS,    WS "c",
+                                           "d",    "cd", WS "ab"};
+  ModelProto byte_fallback_model_proto = MakeByteFallbackModelProto(pieces);
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+  ModelProto bpe_model_proto = model_proto;
+  bpe_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+  ModelProto cross_model_proto = model_proto;
+  AddPiece(&cross_model_proto, "c" WS "d", 0.0);
+
+  // Long runs of unknown characters cross the chunk boundaries.
+  std::string input;
+  const char *kWords[] = {"ab", "c", "dd", "xxxxxxxx", "cd", "\xE3\x81\x82",
+                          "abxy"};
+  for (int i = 0; i < 20000; ++i) {
+    input += kWords[(i * 7 + i / 3) % 7];
+    input += (i % 11 == 0) ? "  " : " ";
+  }
+
+  for (const auto *proto : {&model_proto, &byte_fallback_model_proto,
+                            &bpe_model_proto, &cross_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+
+    SentencePieceText expected;
+    EXPECT_TRUE(sp.Encode(input, &expected).ok());
+    for (const int num_threads : {-1, 1, 2, 7, 64}) {
+      SentencePieceText spt;
+      EXPECT_TRUE(sp.EncodeParallel(input, num_threads, &spt).ok());
+      EXPECT_EQ(expected.SerializeAsString(), spt.SerializeAsString());
+
+      std::vector<int> ids;
+      EXPECT_TRUE(sp.EncodeParallel(input, num_threads, &ids).ok());
+      EXPECT_EQ(sp.EncodeAsIds(input), ids);
+    }
+
+    SentencePieceText spt;
+    EXPECT_TRUE(sp.EncodeParallel("", 4, &spt).ok());
+    EXPECT_EQ(0, spt.pieces_size());
+  }
+}
+
+TEST(SentencePieceProcessorTest, EncodeParallelRandomTest) {
+  // Random models and inputs. The random scores make ties of the path scores
+  // unlikely, so the result must be the same as Encode().
+  std::mt19937 mt(0);
+  std::uniform_real_distribution<float> score(-10.0, -0.1);
+  const std::vector<std::string> kChars = {
+      "a", "b", "c", "d", "e", "\xC3\xA9", "\xE3\x81\x82", "\xE3\x81\x84"};
+  // Unknown characters, a full-width "A" normalized to "A", and a tab.
+  const std::vector<std::string> kExtraChars = {"x", "\xE2\x98\x83",
+                                                "\xEF\xBC\xA1", "\t"};
+
+  for (int trial = 0; trial < 8; ++trial) {
+    const bool is_bpe = trial % 2 == 1;
+    const bool byte_fallback = trial % 4 >= 2;
+
+    ModelProto model_proto = MakeByteFallbackModelProto({});
+    if (!byte_fallback) {
+      model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+      model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+    }
+    if (is_bpe) {
+      model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+    }
+    std::set<std::string> pieces;
+    while (pieces.size() < 300) {
+      std::string piece = mt() % 2 ? WS : "";
+      for (int n = 1 + mt() % 4; n > 0; --n) {
+        piece += kChars[mt() % kChars.size()];
+      }
+      if (pieces.insert(piece).second) {
+        AddPiece(&model_proto, piece, score(mt));
+      }
+    }
+
+    std::string input;
+    while (input.size() < 200000) {
+      for (int n = 1 + mt() % 8; n > 0; --n) {
+        input += mt() % 20 == 0 ? kExtraChars[mt() % kExtraChars.size()]
+                                : kChars[mt() % kChars.size()];
+      }
+      input += std::string(1 + mt() % 3, mt() % 50 == 0 ? '\n' : ' ');
+    }
+
+    SentencePieceProcessor sp;
+    ASSERT_TRUE(sp.Load(model_proto).ok());
+    SentencePieceText expected;
+    EXPECT_TRUE(sp.Encode(input, &expected).ok());
+    for (const int num_threads : {2, 5, 16}) {
+      SentencePieceText spt;
+      EXPECT_TRUE(sp.EncodeParallel(input, num_threads, &spt).ok());
+      if (is_bpe) {
+        EXPECT_EQ(expected.SerializeAsString(), spt.SerializeAsString());
+        continue;
+      }
+
+      // Unigram models may resolve near-ties differently. The pieces still
+      // cover the same text with the same total score in double precision,
+      // in which Encode() does not accumulate the path score.
+      auto Summarize = [&sp](const SentencePieceText &spt) {
+        std::string surfaces;
+        double score = 0.0;
+        for (const auto &piece : spt.pieces()) {
+          surfaces += piece.surface();
+          score += sp.GetScore(piece.id());
+        }
+        return std::make_pair(surfaces, score);
+      };
+      const auto expected_summary = Summarize(expected);
+      const auto summary = Summarize(spt);
+      EXPECT_EQ(expected_summary.first, summary.first);
+      EXPECT_NEAR(expected_summary.second, summary.second,
+                  1e-6 * std::abs(expected_summary.second));
+    }
+  }
+}
+
+TEST(SentencePieceProcessorTest, DecodeBatchTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const int kByte = 3;  // id of <0x00>.
+  const int a = sp.PieceToId(WS "a");
+  const int b = sp.PieceToId("b");
+  const int cd = sp.PieceToId("c" WS "d");
+
+  std::vector<std::vector<int>> batch;
+  for (int i = 0; i < 100; ++i) {
+    std::vector<int> ids;
+    for (int j = 0; j < i % 7; ++j) {
+      const int candidates[] = {a, b, cd, 1, kByte + 0xE3, kByte + 0x81,
+                                kByte + 0x82};
+      ids.push_back(candidates[(i + j * 3) % arraysize(candidates)]);
+    }
+    batch.emplace_back(ids);
+  }
+
+  for (const int num_threads : {-1, 1, 3, 200}) {
+    std::string detokenized;
+    std::vector<size_t> offsets;
+    EXPECT_TRUE(
+        sp.DecodeBatch(batch, num_threads, &detokenized, &offsets).ok());
+    EXPECT_EQ(batch.size() + 1, offsets.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+      EXPECT_EQ(sp.DecodeIds(batch[i]),
+                detokenized.substr(offsets[i], offsets[i + 1] - offsets[i]));
+    }
+    EXPECT_EQ(detokenized.size(), offsets.back());
+  }
+
+  {
+    std::string detokenized;
+    std::vector<size_t> offsets;
+    EXPECT_TRUE(sp.DecodeBatch({}, {0}, 4, &detokenized, &offsets).ok());
+    EXPECT_TRUE(detokenized.empty());
+    EXPECT_EQ(std::vector<size_t>({0}), offsets);
+
+    EXPECT_TRUE(sp.DecodeBatch({a, b, cd}, {0, 0, 2, 3}, 2, &detokenized,
+                               &offsets)
+                    .ok());
+    EXPECT_EQ("abc d", detokenized);
+    EXPECT_EQ(std::vector<size_t>({0, 0, 2, 5}), offsets);
+
+    EXPECT_FALSE(sp.DecodeBatch({a, b}, {}, 1, &detokenized, &offsets).ok());
+    EXPECT_FALSE(
+        sp.DecodeBatch({a, b}, {0, 1}, 1, &detokenized, &offsets).ok());
+    EXPECT_FALSE(
+        sp.DecodeBatch({a, b}, {0, 2, 1, 2}, 1, &detokenized, &offsets).ok());
+    EXPECT_FALSE(
+        sp.DecodeBatch({a, -1}, {0, 1, 2}, 2, &detokenized, &offsets).ok());
+  }
+}
+
+TEST(SentencePieceProcessorTest, StreamingDecoderTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c" WS "d"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  const int kByte = 3;  // id of <0x00>.
+  const int a = sp.PieceToId(WS "a");
+  const int b = sp.PieceToId("b");
+  const int cd = sp.PieceToId("c" WS "d");
+
+  StreamingDecoder decoder(&sp);
+  std::string text;
+
+  // The leading space is removed even after <s>.
+  EXPECT_TRUE(decoder.Decode(1, &text).ok());
+  EXPECT_EQ("", text);
+  EXPECT_TRUE(decoder.Decode(a, &text).ok());
+  EXPECT_EQ("a", text);
+  EXPECT_TRUE(decoder.Decode(a, &text).ok());
+  EXPECT_EQ(" a", text);
+
+  // "あ" -> 0xE3 0x81 0x82
+  EXPECT_TRUE(decoder.Decode(kByte + 0xE3, &text).ok());
+  EXPECT_EQ("", text);
+  EXPECT_TRUE(decoder.Decode(kByte + 0x81, &text).ok());
+  EXPECT_EQ("", text);
+  EXPECT_TRUE(decoder.Decode(kByte + 0x82, &text).ok());
+  EXPECT_EQ("\xE3\x81\x82", text);
+
+  // An incomplete character is emitted as U+FFFD.
+  EXPECT_TRUE(decoder.Decode(kByte + 0xE3, &text).ok());
+  EXPECT_EQ("", text);
+  EXPECT_TRUE(decoder.Decode(b, &text).ok());
+  EXPECT_EQ("\xEF\xBF\xBD" "b", text);
+  EXPECT_TRUE(decoder.Decode(kByte + 0xE3, &text).ok());
+  EXPECT_EQ("", text);
+  EXPECT_TRUE(decoder.Flush(&text).ok());
+  EXPECT_EQ("\xEF\xBF\xBD", text);
+
+  // Flush() resets the state.
+  EXPECT_TRUE(decoder.Decode(a, &text).ok());
+  EXPECT_EQ("a", text);
+  decoder.Reset();
+
+  EXPECT_FALSE(decoder.Decode(-1, &text).ok());
+  EXPECT_FALSE(decoder.Decode(sp.GetPieceSize(), &text).ok());
+
+  // The concatenation of outputs is the same as Decode().
+  const int candidates[] = {a,
+                            b,
+                            cd,
+                            0,
+                            1,
+                            kByte + 'x',
+                            kByte + 0x80,
+                            kByte + 0xE3,
+                            kByte + 0x81,
+                            kByte + 0x82,
+                            kByte + 0xF0,
+                            kByte + 0x9F,
+                            kByte + 0x98};
+  for (int i = 0; i < 200; ++i) {
+    std::vector<int> ids;
+    std::string output;
+    for (int j = 0; j < i % 13; ++j) {
+      ids.push_back(candidates[(i * 7 + j * j) % arraysize(candidates)]);
+      EXPECT_TRUE(decoder.Decode(ids.back(), &text).ok());
+      output += text;
+    }
+    EXPECT_TRUE(decoder.Flush(&text).ok());
+    output += text;
+    EXPECT_EQ(sp.DecodeIds(ids), output);
+  }
+
+  EXPECT_TRUE(sp.SetDecodeExtraOptions("reverse").ok());
+  EXPECT_FALSE(decoder.Decode(a, &text).ok());
+}
+
+TEST(SentencePieceProcessorTest, StreamingEncoderTest) {
+  const std::vector<std::string> pieces = {WS "a", "b",  WS,    WS "c",
+                                           "d",    "cd", WS "ab"};
+  ModelProto byte_fallback_model_proto = MakeByteFallbackModelProto(pieces);
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+  ModelProto bpe_model_proto = model_proto;
+  bpe_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+  ModelProto extra_whitespace_model_proto = model_proto;
+  extra_whitespace_model_proto.mutable_normalizer_spec()
+      ->set_remove_extra_whitespaces(false);
+  // The whole input is buffered.
+  ModelProto cross_model_proto = model_proto;
+  AddPiece(&cross_model_proto, "c" WS "d", 0.0);
+
+  std::string input = "  ";
+  const char *kWords[] = {"ab", "c", "dd", "xx", "cd", "\xE3\x81\x82", "abxy"};
+  for (int i = 0; i < 300; ++i) {
+    input += kWords[(i * 7 + i / 3) % 7];
+    input += (i % 11 == 0) ? "   " : " ";
+  }
+
+  for (const auto *proto :
+       {&model_proto, &byte_fallback_model_proto, &bpe_model_proto,
+        &extra_whitespace_model_proto, &cross_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+    StreamingEncoder encoder(&sp);
+
+    for (const char *extra_options : {"", "bos:eos"}) {
+      EXPECT_TRUE(sp.SetEncodeExtraOptions(extra_options).ok());
+      for (const size_t chunk_size : {1, 2, 7, 100, 100000}) {
+        for (const size_t size : {size_t(0), size_t(5), input.size() - 1,
+                                  input.size()}) {
+          const absl::string_view text =
+              absl::string_view(input).substr(0, size);
+          std::vector<int> output, ids;
+          size_t max_buffered_size = 0;
+          for (size_t pos = 0; pos < text.size(); pos += chunk_size) {
+            EXPECT_TRUE(
+                encoder.Encode(text.substr(pos, chunk_size), &ids).ok());
+            output.insert(output.end(), ids.begin(), ids.end());
+            max_buffered_size =
+                std::max(max_buffered_size, encoder.buffered_size());
+          }
+          EXPECT_TRUE(encoder.Flush(&ids).ok());
+          output.insert(output.end(), ids.begin(), ids.end());
+          EXPECT_EQ(sp.EncodeAsIds(text), output);
+          EXPECT_EQ(0, encoder.buffered_size());
+
+          // Only a few words are buffered.
+          if (proto != &cross_model_proto && chunk_size < 100) {
+            EXPECT_GT(32, max_buffered_size);
+          }
+        }
+      }
+    }
+
+    EXPECT_TRUE(sp.SetEncodeExtraOptions("reverse").ok());
+    std::vector<int> ids;
+    EXPECT_FALSE(encoder.Encode("ab", &ids).ok());
+    EXPECT_TRUE(sp.SetEncodeExtraOptions("").ok());
+  }
+
+  // Unknown pieces are merged across the outputs.
+  ModelProto unk_model_proto = model_proto;
+  unk_model_proto.mutable_pieces()->DeleteSubrange(5, 1);  // WS
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(unk_model_proto).ok());
+  StreamingEncoder encoder(&sp);
+  std::vector<int> output, ids;
+  for (const char *chunk : {"ab xx ", "yy ", "zz"}) {
+    EXPECT_TRUE(encoder.Encode(chunk, &ids).ok());
+    output.insert(output.end(), ids.begin(), ids.end());
+  }
+  EXPECT_TRUE(encoder.Flush(&ids).ok());
+  output.insert(output.end(), ids.begin(), ids.end());
+  EXPECT_EQ(sp.EncodeAsIds("ab xx yy zz"), output);
+
+  StreamingEncoder null_encoder(nullptr);
+  EXPECT_FALSE(null_encoder.Encode("ab", &ids).ok());
+}
+
+TEST(SentencePieceProcessorTest, PrefixCacheTest) {
+  const std::vector<std::string> pieces = {WS "a", "b",  WS,    WS "c",
+                                           "d",    "cd", WS "ab"};
+  ModelProto byte_fallback_model_proto = MakeByteFallbackModelProto(pieces);
+  ModelProto model_proto = byte_fallback_model_proto;
+  model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  model_proto.mutable_pieces()->DeleteSubrange(3, 256);
+  ModelProto bpe_model_proto = model_proto;
+  bpe_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+  ModelProto extra_whitespace_model_proto = model_proto;
+  extra_whitespace_model_proto.mutable_normalizer_spec()
+      ->set_remove_extra_whitespaces(false);
+  // The cache is not used.
+  ModelProto cross_model_proto = model_proto;
+  AddPiece(&cross_model_proto, "c" WS "d", 0.0);
+
+  // Inputs share prefixes of various lengths.
+  std::string prompt = "  ";
+  const char *kWords[] = {"ab", "c", "dd", "xx", "cd", "\xE3\x81\x82", "abxy"};
+  for (int i = 0; i < 400; ++i) {
+    prompt += kWords[(i * 7 + i / 3) % 7];
+    prompt += (i % 11 == 0) ? "  \n" : " ";
+  }
+  std::vector<std::string> inputs;
+  for (const size_t size : {size_t(0), size_t(100), size_t(700), size_t(1000),
+                            prompt.size()}) {
+    for (const char *suffix : {"", " ", "ab c", "xx yy zz   "}) {
+      inputs.push_back(prompt.substr(0, size) + suffix);
+    }
+  }
+
+  for (const auto *proto :
+       {&model_proto, &byte_fallback_model_proto, &bpe_model_proto,
+        &extra_whitespace_model_proto, &cross_model_proto}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*proto).ok());
+    std::vector<std::string> expected;
+    for (const auto &input : inputs) {
+      SentencePieceText spt;
+      EXPECT_TRUE(sp.Encode(input, &spt).ok());
+      expected.push_back(spt.SerializeAsString());
+    }
+
+    for (const int max_blocks : {1, 3, 1000}) {
+      EXPECT_TRUE(sp.SetPrefixCacheSize(max_blocks).ok());
+      // Each input is encoded twice to hit the cache.
+      for (int n = 0; n < 2; ++n) {
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          SentencePieceText spt;
+          EXPECT_TRUE(sp.Encode(inputs[i], &spt).ok());
+          EXPECT_EQ(expected[i], spt.SerializeAsString());
+
+          CompactEncoding encoding;
+          EXPECT_TRUE(sp.Encode(inputs[i], &encoding).ok());
+          ASSERT_EQ(spt.pieces_size(), encoding.size());
+          for (int j = 0; j < spt.pieces_size(); ++j) {
+            EXPECT_EQ(spt.pieces(j).id(), encoding.ids[j]);
+            EXPECT_EQ(spt.pieces(j).begin(), encoding.begins[j]);
+            EXPECT_EQ(spt.pieces(j).end(), encoding.ends[j]);
+          }
+        }
+      }
+    }
+
+    // The cache is cleared when the vocabulary is changed.
+    EXPECT_TRUE(sp.SetPrefixCacheSize(1000).ok());
+    const std::vector<int> cached = sp.EncodeAsIds(prompt);
+    EXPECT_TRUE(sp.SetVocabulary({WS "a", "b"}).ok());
+    const std::vector<int> restricted = sp.EncodeAsIds(prompt);
+    EXPECT_TRUE(sp.SetPrefixCacheSize(0).ok());
+    EXPECT_EQ(sp.EncodeAsIds(prompt), restricted);
+    EXPECT_NE(cached, restricted);
+  }
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  EXPECT_FALSE(sp.SetPrefixCacheSize(-1).ok());
+}
+
+TEST(SentencePieceProcessorTest, ProcessorHandleTest) {
+  ModelProto model_proto1 = MakeByteFallbackModelProto({WS "ab", "a", "b"});
+  ModelProto model_proto2 =
+      MakeByteFallbackModelProto({WS "a", "b", "c", "bc"});
+
+  ProcessorHandle handle;
+  EXPECT_FALSE(handle.Acquire());
+  EXPECT_FALSE(handle.Reset(nullptr).ok());
+  EXPECT_FALSE(handle.Load("__UNKNOWN_FILE__").ok());
+  EXPECT_FALSE(handle.LoadFromSerializedProto("__NOT_A_PROTO__").ok());
+  EXPECT_EQ(0, handle.generation());
+
+  EXPECT_TRUE(
+      handle.LoadFromSerializedProto(model_proto1.SerializeAsString()).ok());
+  EXPECT_EQ(1, handle.generation());
+
+  // The expected ids of each model, keyed by the vocabulary size.
+  std::map<int, std::vector<int>> expected;
+  for (const auto *model_proto : {&model_proto1, &model_proto2}) {
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(*model_proto).ok());
+    EXPECT_TRUE(sp.Encode("ab abc", &expected[sp.GetPieceSize()]).ok());
+  }
+  EXPECT_EQ(2, expected.size());
+
+  // Encoding threads see either model, consistently within a snapshot,
+  // while the models are reloaded.
+  std::atomic<bool> stop(false);
+  std::atomic<int> num_encodes(0);
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 4; ++n) {
+    threads.emplace_back([&]() {
+      while (!stop) {
+        auto sp = handle.Acquire();
+        std::vector<int> ids;
+        EXPECT_TRUE(sp->Encode("ab abc", &ids).ok());
+        EXPECT_EQ(expected.at(sp->GetPieceSize()), ids);
+        ++num_encodes;
+      }
+    });
+  }
+  for (int i = 0; i < 100; ++i) {
+    auto processor = absl::make_unique<SentencePieceProcessor>();
+    EXPECT_TRUE(processor->Load(i % 2 ? model_proto1 : model_proto2).ok());
+    EXPECT_TRUE(handle.Reset(std::move(processor)).ok());
+  }
+  stop = true;
+  for (auto &thread : threads) thread.join();
+  EXPECT_EQ(101, handle.generation());
+  EXPECT_GT(num_encodes, 0);
+
+  // A reload waits until the snapshots of the old processor are released.
+  auto snapshot = handle.Acquire();
+  const int piece_size = snapshot->GetPieceSize();
+  std::atomic<bool> reloaded(false);
+  std::thread reloader([&]() {
+    EXPECT_TRUE(handle.Load("__UNKNOWN_FILE__").code() ==
+                util::StatusCode::kNotFound);
+    EXPECT_TRUE(
+        handle.LoadFromSerializedProto(model_proto1.SerializeAsString()).ok());
+    reloaded = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_FALSE(reloaded);
+  EXPECT_EQ(piece_size, snapshot->GetPieceSize());
+
+  // Moving a snapshot keeps the registration.
+  {
+    ProcessorHandle::Snapshot moved = std::move(snapshot);
+    EXPECT_FALSE(snapshot);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(reloaded);
+    EXPECT_EQ(piece_size, moved->GetPieceSize());
+  }
+  reloader.join();
+  EXPECT_TRUE(reloaded);
+  EXPECT_EQ(102, handle.generation());
+}
+
+TEST(SentencePieceProcessorTest, SampleEncodeWithStreamTest) {
+  ModelProto model_proto = MakeByteFallbackModelProto(
+      {WS "a", WS "ab", "a", "b", "ab", "abc", "bc", "c", WS});
+  for (auto &sp : *model_proto.mutable_pieces()) {
+    if (sp.type() == ModelProto::SentencePiece::NORMAL)
+      sp.set_score(-1.0 * sp.piece().size());
+  }
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 200; ++i) texts.emplace_back("abc ab abcabc");
+
+  for (const int nbest_size : {-1, 5}) {
+    std::vector<std::vector<int>> expected(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+      EXPECT_TRUE(
+          sp.SampleEncode(texts[i], nbest_size, 0.1, 1234, i, &expected[i])
+              .ok());
+    }
+
+    // Results only depend on (seed, stream), not on the thread.
+    std::vector<std::vector<int>> results(texts.size());
+    {
+      auto pool = absl::make_unique<ThreadPool>(4);
+      pool->StartWorkers();
+      for (int n = 0; n < 4; ++n) {
+        pool->Schedule([&, n]() {
+          for (size_t i = n; i < texts.size(); i += 4) {
+            EXPECT_TRUE(sp.SampleEncode(texts[i], nbest_size, 0.1, 1234, i,
+                                        &results[i])
+                            .ok());
+          }
+        });
+      }
+    }
+    EXPECT_EQ(expected, results);
+
+    std::set<std::vector<int>> uniq(expected.begin(), expected.end());
+    EXPECT_GT(uniq.size(), 1);
+
+    std::vector<std::string> pieces;
+    EXPECT_TRUE(
+        sp.SampleEncode(texts[0], nbest_size, 0.1, 1234, 0, &pieces).ok());
+    EXPECT_EQ(pieces.size(), expected[0].size());
+    for (size_t i = 0; i < pieces.size(); ++i) {
+      EXPECT_EQ(sp.PieceToId(pieces[i]), expected[0][i]);
+    }
+  }
+
+  std::vector<int> ids;
+  EXPECT_FALSE(sp.SampleEncode("abc", 1024, 0.1, 1234, 0, &ids).ok());
+}
+
+TEST(SentencePieceProcessorTest, MetricsTest) {
+  const ModelProto model_proto =
+      MakeByteFallbackModelProto({WS "a", "b", WS, "c"});
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+
+  ProcessorMetrics metrics;
+#ifdef SPM_ENABLE_METRICS
+  EXPECT_TRUE(sp.GetMetrics(&metrics).ok());
+  EXPECT_EQ(0, metrics.num_encodes);
+
+  std::vector<std::string> texts;
+  for (int i = 0; i < 100; ++i) texts.emplace_back("ab c\xE3\x81\x82");
+  const std::vector<absl::string_view> inputs(texts.begin(), texts.end());
+  std::vector<int> ids;
+  std::vector<size_t> offsets;
+  EXPECT_TRUE(sp.EncodeBatch(inputs, 4, &ids, &offsets).ok());
+
+  // "ab c" + three byte pieces of U+3042.
+  EXPECT_TRUE(sp.GetMetrics(&metrics).ok());
+  EXPECT_EQ(100, metrics.num_encodes);
+  EXPECT_EQ(100 * texts[0].size(), metrics.input_bytes);
+  EXPECT_EQ(ids.size(), metrics.output_tokens);
+  EXPECT_EQ(0, metrics.unknown_tokens);
+  EXPECT_EQ(300, metrics.byte_fallback_tokens);
+  EXPECT_NEAR(300.0 / ids.size(), metrics.byte_fallback_rate(), 1e-6);
+  EXPECT_GT(metrics.normalize_nanos + metrics.model_encode_nanos +
+                metrics.populate_nanos,
+            0);
+  EXPECT_NE(std::string::npos,
+            metrics.DebugString().find("byte_fallback_tokens: 300"));
+
+  sp.ResetMetrics();
+  EXPECT_TRUE(sp.GetMetrics(&metrics).ok());
+  EXPECT_EQ(0, metrics.num_encodes);
+  EXPECT_EQ(0, metrics.output_tokens);
+  EXPECT_EQ(0.0, metrics.unknown_rate());
+
+  // Without byte fallback, a run of unknown characters is one piece.
+  ModelProto unk_model_proto = model_proto;
+  unk_model_proto.mutable_trainer_spec()->set_byte_fallback(false);
+  auto *pieces = unk_model_proto.mutable_pieces();
+  for (int i = pieces->size() - 1; i >= 0; --i) {
+    if (pieces->Get(i).type() == ModelProto::SentencePiece::BYTE) {
+      pieces->DeleteSubrange(i, 1);
+    }
+  }
+  SentencePieceProcessor sp2;
+  EXPECT_TRUE(sp2.Load(unk_model_proto).ok());
+  EXPECT_TRUE(
+      sp2.Encode("a\xE3\x81\x82\xE3\x81\x84" "b\xE3\x81\x86", &ids).ok());
+  EXPECT_TRUE(sp2.GetMetrics(&metrics).ok());
+  EXPECT_EQ(ids.size(), metrics.output_tokens);
+  EXPECT_EQ(2, metrics.unknown_tokens);
+  EXPECT_EQ(0, metrics.byte_fallback_tokens);
+#else
+  EXPECT_FALSE(sp.GetMetrics(&metrics).ok());
+#endif
+}
+
 TEST(SentencePieceProcessorTest, OverrideSpecialPieceTest) {
   ModelProto model_proto;
   auto *sp1 = model_proto.add_pieces();
@@ -1459,4 +2524,114 @@ TEST(SentencePieceProcessorTest, VocabularyTest) {
   EXPECT_FALSE(sp.IsUnused(6));
   EXPECT_FALSE(sp.IsUnused(7));
 }
+
+TEST(SentencePieceProcessorTest, VocabularyMaskTest) {
+  ModelProto model_proto;
+  auto *unk = model_proto.add_pieces();
+  unk->set_type(ModelProto::SentencePiece::UNKNOWN);
+  unk->set_piece("<unk>");
+  AddPiece(&model_proto, WS, -1.0);
+  AddPiece(&model_proto, "a", -2.0);
+  AddPiece(&model_proto, "b", -2.0);
+  AddPiece(&model_proto, "c", -2.0);
+  AddPiece(&model_proto, "ab", -1.0);
+  AddPiece(&model_proto, "bc", -1.5);
+  AddPiece(&model_proto, WS "a", -1.2);
+  AddPiece(&model_proto, WS "ab", -0.5);
+  AddPiece(&model_proto, "abc", -0.8);
+  *(model_proto.mutable_normalizer_spec()) = MakeDefaultNormalizerSpec();
+
+  const std::vector<std::string> vocab = {"ab", WS "a", "bc"};
+  const std::vector<std::string> inputs = {"abc ab bca", "aabbcc", "ab abc",
+                                           "", "xab"};
+
+  ModelProto bpe_model_proto = model_proto;
+  bpe_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::BPE);
+
+  for (const auto *proto : {&model_proto, &bpe_model_proto}) {
+    for (const auto version :
+         {EncoderVersion::kOptimized, EncoderVersion::kOriginal}) {
+      SentencePieceProcessor sp, restricted;
+      EXPECT_TRUE(sp.Load(*proto).ok());
+      EXPECT_TRUE(restricted.Load(*proto).ok());
+      EXPECT_TRUE(sp.SetEncoderVersion(version).ok());
+      EXPECT_TRUE(restricted.SetEncoderVersion(version).ok());
+      EXPECT_TRUE(restricted.SetVocabulary(vocab).ok());
+
+      VocabularyMask mask;
+      EXPECT_TRUE(sp.BuildVocabularyMask(vocab, &mask).ok());
+      EXPECT_EQ(sp.GetPieceSize(), mask.size());
+      for (int id = 0; id < sp.GetPieceSize(); ++id) {
+        EXPECT_EQ(!restricted.IsUnused(id), mask.IsAllowed(id));
+      }
+
+      for (const auto &input : inputs) {
+        std::vector<int> ids, expected;
+        EXPECT_TRUE(sp.Encode(input, mask, &ids).ok());
+        EXPECT_TRUE(restricted.Encode(input, &expected).ok());
+        EXPECT_EQ(expected, ids);
+
+        std::vector<std::string> pieces, expected_pieces;
+        EXPECT_TRUE(sp.Encode(input, mask, &pieces).ok());
+        EXPECT_TRUE(restricted.Encode(input, &expected_pieces).ok());
+        EXPECT_EQ(expected_pieces, pieces);
+
+        // The processor itself is not restricted.
+        SentencePieceProcessor unrestricted;
+        EXPECT_TRUE(unrestricted.Load(*proto).ok());
+        EXPECT_TRUE(unrestricted.Encode(input, &expected).ok());
+        EXPECT_TRUE(sp.Encode(input, &ids).ok());
+        EXPECT_EQ(expected, ids);
+
+        if (proto == &model_proto) {
+          std::vector<std::vector<int>> nbest_ids, expected_nbest_ids;
+          EXPECT_TRUE(sp.NBestEncode(input, 5, mask, &nbest_ids).ok());
+          EXPECT_TRUE(
+              restricted.NBestEncode(input, 5, &expected_nbest_ids).ok());
+          EXPECT_EQ(expected_nbest_ids, nbest_ids);
+        } else {
+          std::vector<std::vector<int>> nbest_ids;
+          EXPECT_FALSE(sp.NBestEncode(input, 5, mask, &nbest_ids).ok());
+        }
+
+        for (int n = 0; n < 10; ++n) {
+          EXPECT_TRUE(sp.SampleEncode(input, -1, 0.5, mask, &ids).ok());
+          for (const int id : ids) EXPECT_TRUE(mask.IsAllowed(id));
+          std::string detokenized;
+          EXPECT_TRUE(sp.Decode(ids, &detokenized).ok());
+          if (input != "xab") EXPECT_EQ(input, detokenized);
+        }
+      }
+    }
+  }
+
+  SentencePieceProcessor sp;
+  EXPECT_TRUE(sp.Load(model_proto).ok());
+  std::vector<int> ids, masked_ids;
+  {
+    VocabularyMask mask;
+    EXPECT_TRUE(sp.BuildVocabularyMask(vocab, &mask).ok());
+    EXPECT_TRUE(sp.Encode("ab abc", &ids).ok());
+    EXPECT_TRUE(sp.Encode("ab abc", mask, &masked_ids).ok());
+    EXPECT_NE(ids, masked_ids);
+  }
+  EXPECT_FALSE(sp.Encode("abc", VocabularyMask(), &ids).ok());
+  EXPECT_FALSE(sp.BuildVocabularyMask(vocab, nullptr).ok());
+
+  // A mask of another model.
+  ModelProto other_model_proto = model_proto;
+  AddPiece(&other_model_proto, "cab", -3.0);
+  SentencePieceProcessor other;
+  EXPECT_TRUE(other.Load(other_model_proto).ok());
+  VocabularyMask mask;
+  EXPECT_TRUE(other.BuildVocabularyMask(vocab, &mask).ok());
+  EXPECT_FALSE(sp.Encode("abc", mask, &ids).ok());
+
+  ModelProto char_model_proto = model_proto;
+  char_model_proto.mutable_trainer_spec()->set_model_type(TrainerSpec::CHAR);
+  SentencePieceProcessor char_sp;
+  EXPECT_TRUE(char_sp.Load(char_model_proto).ok());
+  EXPECT_FALSE(char_sp.BuildVocabularyMask(vocab, &mask).ok());
+  EXPECT_FALSE(char_sp.Encode("abc", mask, &ids).ok());
+}
 }  // namespace sentencepiece
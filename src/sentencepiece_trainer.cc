@@ -32,6 +32,7 @@
 #include "util.h"
 
 ABSL_DECLARE_FLAG(int, minloglevel);
+ABSL_DECLARE_FLAG(bool, save_trace);
 
 namespace sentencepiece {
 namespace {
@@ -153,6 +154,13 @@ util::Status SentencePieceTrainer::MergeSpecsFromArgs(
       CHECK_OR_RETURN(absl::SimpleAtoi(value, &v));
       absl::SetFlag(&FLAGS_minloglevel, v);
       continue;
+    } else if (key == "save_trace") {
+      bool v = false;
+      CHECK_OR_RETURN(
+          string_util::lexical_cast(value.empty() ? "true" : value, &v))
+          << "cannot parse \"" << value << "\" as bool.";
+      absl::SetFlag(&FLAGS_save_trace, v);
+      continue;
     }
 
     const auto status_train = SetProtoField(key, value, trainer_spec);
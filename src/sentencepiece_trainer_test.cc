@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <cstdio>
+
 #include "filesystem.h"
 #include "sentencepiece_model.pb.h"
 #include "sentencepiece_trainer.h"
@@ -19,6 +21,8 @@
 #include "third_party/absl/strings/str_cat.h"
 #include "util.h"
 
+ABSL_DECLARE_FLAG(bool, save_trace);
+
 namespace sentencepiece {
 namespace {
 
@@ -332,6 +336,39 @@ TEST(SentencePieceTrainerTest, MergeSpecsFromArgs) {
                    .ok());
 }
 
+TEST(SentencePieceTrainerTest, SaveTraceTest) {
+  const std::string input =
+      util::JoinPath(absl::GetFlag(FLAGS_test_srcdir), kTestData);
+  const std::string model =
+      util::JoinPath(absl::GetFlag(FLAGS_test_tmpdir), "trace_m");
+  const std::string args = absl::StrCat("--input=", input, " --model_prefix=",
+                                        model, " --model_type=char");
+
+  // The trace is not saved by default.
+  std::remove((model + ".trace.json").c_str());
+  ASSERT_TRUE(SentencePieceTrainer::Train(args).ok());
+  EXPECT_FALSE(filesystem::NewReadableFile(model + ".trace.json")
+                   ->status()
+                   .ok());
+
+  ASSERT_TRUE(SentencePieceTrainer::Train(args + " --save_trace").ok());
+  absl::SetFlag(&FLAGS_save_trace, false);
+  auto output = filesystem::NewReadableFile(model + ".trace.json");
+  ASSERT_TRUE(output->status().ok());
+  std::string trace;
+  EXPECT_TRUE(output->ReadAll(&trace));
+  EXPECT_NE(std::string::npos, trace.find("\"save\""));
+
+  TrainerSpec trainer_spec;
+  NormalizerSpec normalizer_spec;
+  NormalizerSpec denormalizer_spec;
+  EXPECT_FALSE(SentencePieceTrainer::MergeSpecsFromArgs(
+                   "--save_trace=foo", &trainer_spec, &normalizer_spec,
+                   &denormalizer_spec)
+                   .ok());
+  EXPECT_FALSE(absl::GetFlag(FLAGS_save_trace));
+}
+
 TEST(SentencePieceTrainerTest, PopulateModelTypeFromStringTest) {
   TrainerSpec spec;
   EXPECT_TRUE(
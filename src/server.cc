@@ -0,0 +1,567 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "server.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <future>
+#include <sstream>
+
+#include "third_party/absl/memory/memory.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace server {
+namespace {
+
+std::string ErrorResponse(const util::Status &status) {
+  PayloadWriter writer;
+  writer.PutUInt8(static_cast<uint8>(status.code()));
+  writer.PutString(status.error_message());
+  return writer.payload();
+}
+
+std::string IdsResponse(const int *ids, size_t size) {
+  PayloadWriter writer;
+  writer.PutUInt8(static_cast<uint8>(util::StatusCode::kOk));
+  writer.PutIds(ids, size);
+  return writer.payload();
+}
+
+std::string TextResponse(absl::string_view text) {
+  PayloadWriter writer;
+  writer.PutUInt8(static_cast<uint8>(util::StatusCode::kOk));
+  writer.PutString(text);
+  return writer.payload();
+}
+
+std::string CountResponse(int count) {
+  PayloadWriter writer;
+  writer.PutUInt8(static_cast<uint8>(util::StatusCode::kOk));
+  writer.PutInt32(count);
+  return writer.payload();
+}
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram() : sum_(0), max_(0) {
+  for (auto &bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::Add(int64 micros) {
+  micros = std::max<int64>(0, micros);
+  int bucket = 0;
+  for (int64 v = micros; v > 0 && bucket + 1 < kNumBuckets; v >>= 1) {
+    ++bucket;
+  }
+  buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(micros, std::memory_order_relaxed);
+  int64 max = max_.load(std::memory_order_relaxed);
+  while (micros > max && !max_.compare_exchange_weak(max, micros)) {
+  }
+}
+
+int64 LatencyHistogram::count() const {
+  int64 count = 0;
+  for (const auto &bucket : buckets_) {
+    count += bucket.load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+int64 LatencyHistogram::Percentile(double q) const {
+  const int64 total = count();
+  if (total == 0) return 0;
+  const int64 target =
+      std::max<int64>(1, static_cast<int64>(std::ceil(q * total)));
+  int64 cumulative = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    cumulative += buckets_[i].load(std::memory_order_relaxed);
+    if (cumulative >= target) return i == 0 ? 0 : int64(1) << i;
+  }
+  return int64(1) << (kNumBuckets - 1);
+}
+
+std::string LatencyHistogram::DebugString() const {
+  const int64 total = count();
+  std::ostringstream os;
+  os << "count: " << total;
+  if (total > 0) {
+    os << " mean: " << sum_.load() / total << "us"
+       << " p50: <" << Percentile(0.5) << "us"
+       << " p90: <" << Percentile(0.9) << "us"
+       << " p99: <" << Percentile(0.99) << "us"
+       << " max: " << max_.load() << "us";
+  }
+  os << "\n";
+  for (int i = 0; i < kNumBuckets; ++i) {
+    const int64 n = buckets_[i].load(std::memory_order_relaxed);
+    if (n == 0) continue;
+    os << "  [" << (i == 0 ? 0 : int64(1) << (i - 1)) << ", "
+       << (i == 0 ? 1 : int64(1) << i) << ")us: " << n << "\n";
+  }
+  return os.str();
+}
+
+// A request of a connection. Owned by the connection thread, which waits for
+// `done` while the request is processed in a batch.
+struct Server::Request {
+  RequestType type = kEncode;
+  const SentencePieceProcessor *processor = nullptr;
+  std::string payload;
+  absl::string_view input;
+  std::vector<int> ids;
+  std::string response;
+  std::promise<void> done;
+};
+
+Server::Server(const ServerOptions &options)
+    : options_(options),
+      stopping_(false),
+      num_batches_(0),
+      num_batched_requests_(0) {}
+
+Server::~Server() { Stop(); }
+
+util::Status Server::LoadModel(absl::string_view name,
+                               absl::string_view filename) {
+  auto processor = absl::make_unique<SentencePieceProcessor>();
+  // Load() takes a null-terminated file name.
+  RETURN_IF_ERROR(
+      processor->Load(std::string(filename.data(), filename.size())));
+  return AddModel(name, std::move(processor));
+}
+
+util::Status Server::AddModel(
+    absl::string_view name, std::unique_ptr<SentencePieceProcessor> processor) {
+  CHECK_OR_RETURN(listen_fd_ < 0) << "models must be added before Start().";
+  CHECK_OR_RETURN(processor) << "processor is null.";
+  RETURN_IF_ERROR(processor->status());
+  const std::string key(name.data(), name.size());
+  CHECK_OR_RETURN(!key.empty()) << "model name must not be empty.";
+  CHECK_OR_RETURN(models_.find(key) == models_.end())
+      << "model " << key << " is already added.";
+  if (default_model_ == nullptr) default_model_ = processor.get();
+  models_[key] = std::move(processor);
+  return util::OkStatus();
+}
+
+util::Status Server::Start(absl::string_view socket_path) {
+  CHECK_OR_RETURN(listen_fd_ < 0) << "server is already started.";
+  CHECK_OR_RETURN(!models_.empty()) << "no model is added.";
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  CHECK_LT_OR_RETURN(socket_path.size(), sizeof(addr.sun_path))
+      << "socket path is too long.";
+  memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+  socket_path_.assign(socket_path.data(), socket_path.size());
+
+  // Removes the socket left by a previous server, but never other files.
+  struct stat st;
+  if (lstat(socket_path_.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      return util::StatusBuilder(util::StatusCode::kAlreadyExists, GTL_LOC)
+             << socket_path_ << " exists and is not a socket.";
+    }
+    unlink(socket_path_.c_str());
+  }
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+           << "socket: " << util::StrError(errno);
+  }
+  // The listening socket is non-blocking, so that accept() does not block
+  // when the client has gone after poll().
+  if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0 ||
+      listen(fd, SOMAXCONN) < 0 ||
+      fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+    const int error = errno;
+    close(fd);
+    return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+           << socket_path_ << ": " << util::StrError(error);
+  }
+
+  // Stop() writes to the pipe to wake up AcceptLoop(). shutdown() of a
+  // listening socket does not wake up accept() on BSD and macOS.
+  if (pipe(wakeup_fds_) < 0) {
+    const int error = errno;
+    close(fd);
+    unlink(socket_path_.c_str());
+    return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+           << "pipe: " << util::StrError(error);
+  }
+
+  listen_fd_ = fd;
+  stopping_ = false;
+  batch_thread_ = std::thread([this]() { BatchLoop(); });
+  accept_thread_ = std::thread([this]() { AcceptLoop(); });
+
+  return util::OkStatus();
+}
+
+void Server::Stop() {
+  if (listen_fd_ < 0) return;
+
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stopping_ = true;
+  }
+  queue_cv_.notify_all();
+
+  // Wakes up AcceptLoop() and the connections blocked in recv(). The
+  // requests already queued are still processed.
+  const char c = 0;
+  while (write(wakeup_fds_[1], &c, 1) < 0 && errno == EINTR) {
+  }
+  accept_thread_.join();
+  close(listen_fd_);
+  listen_fd_ = -1;
+  for (int &fd : wakeup_fds_) {
+    close(fd);
+    fd = -1;
+  }
+
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (auto &it : connections_) {
+      if (it.second.fd >= 0) shutdown(it.second.fd, SHUT_RDWR);
+      threads.emplace_back(std::move(it.second.thread));
+    }
+    connections_.clear();
+    finished_connections_.clear();
+  }
+  for (auto &thread : threads) thread.join();
+
+  batch_thread_.join();
+  unlink(socket_path_.c_str());
+}
+
+void Server::AcceptLoop() {
+  while (!stopping_) {
+    pollfd fds[2];
+    fds[0].fd = listen_fd_;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakeup_fds_[0];
+    fds[1].events = POLLIN;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno != EINTR) {
+        LOG(WARNING) << "poll: " << util::StrError(errno);
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      continue;
+    }
+    if (fds[1].revents != 0) break;
+
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd < 0) {
+      if (stopping_) break;
+      if (errno != EINTR && errno != ECONNABORTED && errno != EAGAIN &&
+          errno != EWOULDBLOCK) {
+        LOG(WARNING) << "accept: " << util::StrError(errno);
+        // Avoids a busy loop when e.g. file descriptors are exhausted.
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      continue;
+    }
+    // BSD and macOS pass O_NONBLOCK on to the accepted socket.
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+    JoinFinishedConnections();
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    if (stopping_) {
+      close(fd);
+      break;
+    }
+    const int64 id = next_connection_id_++;
+    auto &connection = connections_[id];
+    connection.fd = fd;
+    connection.thread = std::thread([this, id, fd]() {
+      ServeConnection(id, fd);
+    });
+  }
+}
+
+void Server::JoinFinishedConnections() {
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(connections_mutex_);
+    for (const int64 id : finished_connections_) {
+      const auto it = connections_.find(id);
+      if (it == connections_.end()) continue;
+      threads.emplace_back(std::move(it->second.thread));
+      connections_.erase(it);
+    }
+    finished_connections_.clear();
+  }
+  for (auto &thread : threads) thread.join();
+}
+
+void Server::ServeConnection(int64 id, int fd) {
+  std::string payload;
+  while (ReadFrame(fd, &payload).ok()) {
+    const auto start = std::chrono::steady_clock::now();
+    Request request;
+    request.payload.swap(payload);
+
+    const bool is_valid = ParseRequest(&request);
+    if (is_valid && request.type == kStats) {
+      request.response = TextResponse(StatsString());
+    } else if (is_valid) {
+      auto done = request.done.get_future();
+      {
+        std::lock_guard<std::mutex> lock(queue_mutex_);
+        if (stopping_) break;
+        queue_.push_back(&request);
+      }
+      queue_cv_.notify_one();
+      done.wait();
+    }
+
+    if (!WriteFrame(fd, request.response).ok()) break;
+
+    const int64 micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    if (!is_valid) continue;
+    switch (request.type) {
+      case kEncode:
+        encode_latency_.Add(micros);
+        break;
+      case kDecode:
+        decode_latency_.Add(micros);
+        break;
+      case kCountTokens:
+        count_tokens_latency_.Add(micros);
+        break;
+      default:
+        break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(connections_mutex_);
+  close(fd);
+  const auto it = connections_.find(id);
+  if (it != connections_.end()) it->second.fd = -1;
+  finished_connections_.push_back(id);
+}
+
+bool Server::ParseRequest(Request *request) const {
+  PayloadReader reader(request->payload);
+  uint8 type = 0;
+  absl::string_view model;
+  auto Error = [request](const util::Status &status) {
+    request->response = ErrorResponse(status);
+    return false;
+  };
+
+  if (!reader.GetUInt8(&type) || !reader.GetString(&model)) {
+    return Error(util::InvalidArgumentError("malformed request."));
+  }
+
+  if (model.empty()) {
+    request->processor = default_model_;
+  } else {
+    const auto it = models_.find(std::string(model.data(), model.size()));
+    if (it == models_.end()) {
+      return Error(util::StatusBuilder(util::StatusCode::kNotFound, GTL_LOC)
+                   << "model " << model << " is not found.");
+    }
+    request->processor = it->second.get();
+  }
+
+  bool is_parsed = false;
+  switch (type) {
+    case kEncode:
+    case kCountTokens:
+      is_parsed = reader.GetString(&request->input);
+      break;
+    case kDecode:
+      is_parsed = reader.GetIds(&request->ids);
+      break;
+    case kStats:
+      is_parsed = true;
+      break;
+    default:
+      return Error(util::StatusBuilder(util::StatusCode::kInvalidArgument,
+                                       GTL_LOC)
+                   << "unknown request type " << static_cast<int>(type));
+  }
+  if (!is_parsed || !reader.empty()) {
+    return Error(util::InvalidArgumentError("malformed request."));
+  }
+
+  request->type = static_cast<RequestType>(type);
+  return true;
+}
+
+void Server::BatchLoop() {
+  const size_t max_batch_size = std::max(1, options_.max_batch_size);
+  while (true) {
+    std::vector<Request *> batch;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+
+      // Waits a little for the requests of the other clients.
+      if (options_.max_batch_delay_us > 0) {
+        const auto deadline =
+            std::chrono::steady_clock::now() +
+            std::chrono::microseconds(options_.max_batch_delay_us);
+        queue_cv_.wait_until(lock, deadline, [&]() {
+          return stopping_ || queue_.size() >= max_batch_size;
+        });
+      }
+
+      const size_t size = std::min(queue_.size(), max_batch_size);
+      batch.assign(queue_.begin(), queue_.begin() + size);
+      queue_.erase(queue_.begin(), queue_.begin() + size);
+    }
+
+    ++num_batches_;
+    num_batched_requests_ += batch.size();
+
+    std::map<std::pair<const SentencePieceProcessor *, int>,
+             std::vector<Request *>>
+        groups;
+    for (auto *request : batch) {
+      groups[std::make_pair(request->processor, request->type)].push_back(
+          request);
+    }
+    for (const auto &it : groups) ProcessGroup(it.second);
+
+    // The connection threads own the requests.
+    for (auto *request : batch) request->done.set_value();
+  }
+}
+
+void Server::ProcessGroup(const std::vector<Request *> &group) {
+  if (group.size() == 1) {
+    ProcessRequest(group[0]);
+    return;
+  }
+
+  const auto *processor = group[0]->processor;
+  const int num_threads =
+      std::max(1, std::min<int>(options_.num_threads, group.size()));
+  util::Status status;
+  switch (group[0]->type) {
+    case kEncode: {
+      std::vector<absl::string_view> inputs;
+      for (const auto *request : group) inputs.push_back(request->input);
+      std::vector<int> ids;
+      std::vector<size_t> offsets;
+      status = processor->EncodeBatch(inputs, num_threads, &ids, &offsets);
+      for (size_t i = 0; status.ok() && i < group.size(); ++i) {
+        group[i]->response = IdsResponse(ids.data() + offsets[i],
+                                         offsets[i + 1] - offsets[i]);
+      }
+    } break;
+    case kCountTokens: {
+      std::vector<absl::string_view> inputs;
+      for (const auto *request : group) inputs.push_back(request->input);
+      std::vector<int> num_tokens;
+      status = processor->CountTokensBatch(inputs, num_threads, &num_tokens);
+      for (size_t i = 0; status.ok() && i < group.size(); ++i) {
+        group[i]->response = CountResponse(num_tokens[i]);
+      }
+    } break;
+    case kDecode: {
+      std::vector<int> ids;
+      std::vector<size_t> offsets = {0};
+      for (const auto *request : group) {
+        ids.insert(ids.end(), request->ids.begin(), request->ids.end());
+        offsets.push_back(ids.size());
+      }
+      std::string text;
+      std::vector<size_t> text_offsets;
+      status = processor->DecodeBatch(ids, offsets, num_threads, &text,
+                                      &text_offsets);
+      for (size_t i = 0; status.ok() && i < group.size(); ++i) {
+        group[i]->response = TextResponse(absl::string_view(text).substr(
+            text_offsets[i], text_offsets[i + 1] - text_offsets[i]));
+      }
+    } break;
+    default:
+      status = util::InternalError("unexpected request type.");
+      break;
+  }
+
+  // An invalid request fails the whole batch, so that the requests are
+  // processed one by one to report their own errors.
+  if (!status.ok()) {
+    for (auto *request : group) ProcessRequest(request);
+  }
+}
+
+void Server::ProcessRequest(Request *request) {
+  const auto *processor = request->processor;
+  util::Status status;
+  switch (request->type) {
+    case kEncode: {
+      std::vector<int> ids;
+      status = processor->Encode(request->input, &ids);
+      if (status.ok()) request->response = IdsResponse(ids.data(), ids.size());
+    } break;
+    case kCountTokens: {
+      int num_tokens = 0;
+      status = processor->CountTokens(request->input, &num_tokens);
+      if (status.ok()) request->response = CountResponse(num_tokens);
+    } break;
+    case kDecode: {
+      std::string text;
+      status = processor->Decode(request->ids, &text);
+      if (status.ok()) request->response = TextResponse(text);
+    } break;
+    default:
+      status = util::InternalError("unexpected request type.");
+      break;
+  }
+  if (!status.ok()) request->response = ErrorResponse(status);
+}
+
+std::string Server::StatsString() const {
+  std::ostringstream os;
+  os << "encode: " << encode_latency_.DebugString()
+     << "decode: " << decode_latency_.DebugString()
+     << "count_tokens: " << count_tokens_latency_.DebugString();
+  const int64 num_batches = num_batches_.load();
+  os << "batches: " << num_batches
+     << " requests: " << num_batched_requests_.load();
+  if (num_batches > 0) {
+    os << " mean_batch_size: "
+       << 1.0 * num_batched_requests_.load() / num_batches;
+  }
+  os << "\n";
+  return os.str();
+}
+
+}  // namespace server
+}  // namespace sentencepiece
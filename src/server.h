@@ -0,0 +1,156 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SERVER_H_
+#define SERVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "server_protocol.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace server {
+
+// Histogram of latencies in microseconds with power-of-two buckets.
+// Thread-safe.
+class LatencyHistogram {
+ public:
+  LatencyHistogram();
+
+  void Add(int64 micros);
+
+  int64 count() const;
+
+  // Returns the upper bound of the bucket of the `q`-quantile, 0 < q <= 1.
+  int64 Percentile(double q) const;
+
+  // Returns the summary and the non-empty buckets.
+  std::string DebugString() const;
+
+ private:
+  // Bucket 0 holds 0us, and bucket i > 0 holds [2^(i-1), 2^i)us.
+  static constexpr int kNumBuckets = 40;
+  std::atomic<int64> buckets_[kNumBuckets];
+  std::atomic<int64> sum_;
+  std::atomic<int64> max_;
+};
+
+struct ServerOptions {
+  // Maximum number of requests processed in one batch.
+  int max_batch_size = 64;
+
+  // Time to wait for more requests after the first request of a batch.
+  // 0 processes the requests queued so far without waiting.
+  int max_batch_delay_us = 200;
+
+  // Number of threads to process a batch.
+  int num_threads = 4;
+};
+
+// Tokenization server over a Unix domain socket. The processors are loaded
+// once and shared by all clients. Requests of all connections are queued and
+// processed together by the batch API of SentencePieceProcessor.
+// See server_protocol.h for the wire format.
+class Server {
+ public:
+  explicit Server(const ServerOptions &options);
+  virtual ~Server();
+
+  // Loads the model `filename` as `name`. The first model is the default
+  // model for the requests without a model name.
+  util::Status LoadModel(absl::string_view name, absl::string_view filename);
+
+  // Same as above, but adds a loaded `processor`.
+  util::Status AddModel(absl::string_view name,
+                        std::unique_ptr<SentencePieceProcessor> processor);
+
+  // Listens on `socket_path` and serves the requests in background threads.
+  // A stale socket at `socket_path` is removed. Fails if `socket_path` is
+  // another kind of file.
+  util::Status Start(absl::string_view socket_path);
+
+  // Stops serving and closes all connections.
+  void Stop();
+
+  // Returns the latency histograms and the batch statistics.
+  std::string StatsString() const;
+
+ private:
+  struct Request;
+
+  void AcceptLoop();
+  void ServeConnection(int64 id, int fd);
+  void BatchLoop();
+
+  // Parses the payload of `request`. Returns false and stores the error
+  // response when the request is invalid.
+  bool ParseRequest(Request *request) const;
+
+  // Processes the requests of the same model and type.
+  void ProcessGroup(const std::vector<Request *> &group);
+  void ProcessRequest(Request *request);
+
+  // Joins the threads of closed connections.
+  void JoinFinishedConnections();
+
+  const ServerOptions options_;
+  std::map<std::string, std::unique_ptr<SentencePieceProcessor>> models_;
+  const SentencePieceProcessor *default_model_ = nullptr;
+
+  std::string socket_path_;
+  int listen_fd_ = -1;
+  // Self-pipe to wake up AcceptLoop() on Stop().
+  int wakeup_fds_[2] = {-1, -1};
+  std::thread accept_thread_;
+  std::thread batch_thread_;
+
+  // Requests waiting for a batch.
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cv_;
+  std::deque<Request *> queue_;
+  std::atomic<bool> stopping_;
+
+  // Open connections keyed by their serial number. The socket is -1 after
+  // the connection is closed.
+  struct Connection {
+    int fd = -1;
+    std::thread thread;
+  };
+  std::mutex connections_mutex_;
+  std::map<int64, Connection> connections_;
+  std::vector<int64> finished_connections_;
+  int64 next_connection_id_ = 0;
+
+  LatencyHistogram encode_latency_;
+  LatencyHistogram decode_latency_;
+  LatencyHistogram count_tokens_latency_;
+  std::atomic<int64> num_batches_;
+  std::atomic<int64> num_batched_requests_;
+};
+
+}  // namespace server
+}  // namespace sentencepiece
+
+#endif  // SERVER_H_
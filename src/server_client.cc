@@ -0,0 +1,158 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "server_client.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "common.h"
+#include "server_protocol.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace server {
+namespace {
+
+std::string MakeRequest(RequestType type, absl::string_view model,
+                        PayloadWriter *writer) {
+  PayloadWriter header;
+  header.PutUInt8(type);
+  header.PutString(model);
+  return header.payload() + writer->payload();
+}
+
+}  // namespace
+
+Client::Client() : fd_(-1) {}
+
+Client::~Client() { Close(); }
+
+util::Status Client::Connect(absl::string_view socket_path) {
+  Close();
+
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  CHECK_LT_OR_RETURN(socket_path.size(), sizeof(addr.sun_path))
+      << "socket path is too long.";
+  memcpy(addr.sun_path, socket_path.data(), socket_path.size());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+           << "socket: " << util::StrError(errno);
+  }
+  if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+    const int error = errno;
+    close(fd);
+    return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+           << socket_path << ": " << util::StrError(error);
+  }
+
+  fd_ = fd;
+  return util::OkStatus();
+}
+
+void Client::Close() {
+  if (fd_ >= 0) close(fd_);
+  fd_ = -1;
+}
+
+util::Status Client::Call(const std::string &request, std::string *response) {
+  CHECK_OR_RETURN(fd_ >= 0) << "not connected.";
+
+  util::Status status = WriteFrame(fd_, request);
+  if (status.ok()) status = ReadFrame(fd_, response);
+  if (!status.ok()) {
+    // The stream is out of sync after a partial frame.
+    Close();
+    return status;
+  }
+
+  PayloadReader reader(*response);
+  uint8 code = 0;
+  CHECK_OR_RETURN(reader.GetUInt8(&code)) << "malformed response.";
+  if (code != static_cast<uint8>(util::StatusCode::kOk)) {
+    absl::string_view message;
+    CHECK_OR_RETURN(reader.GetString(&message)) << "malformed response.";
+    return util::Status(static_cast<util::StatusCode>(code),
+                        std::string(message.data(), message.size()));
+  }
+  response->erase(0, 1);
+  return util::OkStatus();
+}
+
+util::Status Client::Encode(absl::string_view model, absl::string_view input,
+                            std::vector<int> *ids) {
+  CHECK_OR_RETURN(ids) << "output container is null";
+  PayloadWriter writer;
+  writer.PutString(input);
+  std::string response;
+  RETURN_IF_ERROR(Call(MakeRequest(kEncode, model, &writer), &response));
+  PayloadReader reader(response);
+  CHECK_OR_RETURN(reader.GetIds(ids) && reader.empty())
+      << "malformed response.";
+  return util::OkStatus();
+}
+
+util::Status Client::Decode(absl::string_view model,
+                            const std::vector<int> &ids, std::string *text) {
+  CHECK_OR_RETURN(text) << "output container is null";
+  PayloadWriter writer;
+  writer.PutIds(ids.data(), ids.size());
+  std::string response;
+  RETURN_IF_ERROR(Call(MakeRequest(kDecode, model, &writer), &response));
+  PayloadReader reader(response);
+  absl::string_view value;
+  CHECK_OR_RETURN(reader.GetString(&value) && reader.empty())
+      << "malformed response.";
+  text->assign(value.data(), value.size());
+  return util::OkStatus();
+}
+
+util::Status Client::CountTokens(absl::string_view model,
+                                 absl::string_view input, int *num_tokens) {
+  CHECK_OR_RETURN(num_tokens) << "output container is null";
+  PayloadWriter writer;
+  writer.PutString(input);
+  std::string response;
+  RETURN_IF_ERROR(Call(MakeRequest(kCountTokens, model, &writer), &response));
+  PayloadReader reader(response);
+  int32 value = 0;
+  CHECK_OR_RETURN(reader.GetInt32(&value) && reader.empty())
+      << "malformed response.";
+  *num_tokens = value;
+  return util::OkStatus();
+}
+
+util::Status Client::GetStats(std::string *stats) {
+  CHECK_OR_RETURN(stats) << "output container is null";
+  PayloadWriter writer;
+  std::string response;
+  RETURN_IF_ERROR(Call(MakeRequest(kStats, "", &writer), &response));
+  PayloadReader reader(response);
+  absl::string_view value;
+  CHECK_OR_RETURN(reader.GetString(&value) && reader.empty())
+      << "malformed response.";
+  stats->assign(value.data(), value.size());
+  return util::OkStatus();
+}
+
+}  // namespace server
+}  // namespace sentencepiece
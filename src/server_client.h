@@ -0,0 +1,62 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SERVER_CLIENT_H_
+#define SERVER_CLIENT_H_
+
+#include <string>
+#include <vector>
+
+#include "sentencepiece_processor.h"
+
+namespace sentencepiece {
+namespace server {
+
+// Client of spm_server. A client holds one connection and is not
+// thread-safe; use one client per thread.
+// An empty `model` selects the default model of the server.
+class Client {
+ public:
+  Client();
+  virtual ~Client();
+
+  // Connects to the server listening on `socket_path`.
+  util::Status Connect(absl::string_view socket_path);
+
+  // Closes the connection.
+  void Close();
+
+  util::Status Encode(absl::string_view model, absl::string_view input,
+                      std::vector<int> *ids);
+
+  util::Status Decode(absl::string_view model, const std::vector<int> &ids,
+                      std::string *text);
+
+  util::Status CountTokens(absl::string_view model, absl::string_view input,
+                           int *num_tokens);
+
+  // Returns the statistics of the server.
+  util::Status GetStats(std::string *stats);
+
+ private:
+  // Sends `request` and receives the response payload after the status.
+  util::Status Call(const std::string &request, std::string *response);
+
+  int fd_;
+};
+
+}  // namespace server
+}  // namespace sentencepiece
+
+#endif  // SERVER_CLIENT_H_
@@ -0,0 +1,174 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "server_protocol.h"
+
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "util.h"
+
+namespace sentencepiece {
+namespace server {
+namespace {
+
+#ifdef MSG_NOSIGNAL
+constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+constexpr int kSendFlags = 0;
+#endif
+
+uint32 DecodeUInt32(const char *data) {
+  const auto *bytes = reinterpret_cast<const unsigned char *>(data);
+  return static_cast<uint32>(bytes[0]) | static_cast<uint32>(bytes[1]) << 8 |
+         static_cast<uint32>(bytes[2]) << 16 |
+         static_cast<uint32>(bytes[3]) << 24;
+}
+
+void EncodeUInt32(uint32 value, char *data) {
+  for (int i = 0; i < 4; ++i) data[i] = static_cast<char>(value >> (8 * i));
+}
+
+// Sends all `size` bytes. Retries on partial writes and interrupts.
+util::Status SendAll(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    const ssize_t n = send(fd, data, size, kSendFlags);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+             << "send: " << util::StrError(errno);
+    }
+    data += n;
+    size -= n;
+  }
+  return util::OkStatus();
+}
+
+// Receives exactly `size` bytes. `*received` is the number of bytes received
+// before an error.
+util::Status RecvAll(int fd, char *data, size_t size, size_t *received) {
+  *received = 0;
+  while (*received < size) {
+    const ssize_t n = recv(fd, data + *received, size - *received, 0);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+             << "recv: " << util::StrError(errno);
+    }
+    if (n == 0) {
+      return util::StatusBuilder(util::StatusCode::kUnavailable, GTL_LOC)
+             << "connection closed.";
+    }
+    *received += n;
+  }
+  return util::OkStatus();
+}
+
+}  // namespace
+
+void PayloadWriter::PutUInt8(uint8 value) {
+  payload_.push_back(static_cast<char>(value));
+}
+
+void PayloadWriter::PutUInt32(uint32 value) {
+  char data[4];
+  EncodeUInt32(value, data);
+  payload_.append(data, sizeof(data));
+}
+
+void PayloadWriter::PutInt32(int32 value) {
+  PutUInt32(static_cast<uint32>(value));
+}
+
+void PayloadWriter::PutString(absl::string_view value) {
+  PutUInt32(value.size());
+  payload_.append(value.data(), value.size());
+}
+
+void PayloadWriter::PutIds(const int *ids, size_t size) {
+  PutUInt32(size);
+  const size_t offset = payload_.size();
+  payload_.resize(offset + 4 * size);
+  for (size_t i = 0; i < size; ++i) {
+    EncodeUInt32(static_cast<uint32>(ids[i]), &payload_[offset + 4 * i]);
+  }
+}
+
+bool PayloadReader::GetUInt8(uint8 *value) {
+  if (payload_.empty()) return false;
+  *value = static_cast<uint8>(payload_[0]);
+  payload_.remove_prefix(1);
+  return true;
+}
+
+bool PayloadReader::GetUInt32(uint32 *value) {
+  if (payload_.size() < 4) return false;
+  *value = DecodeUInt32(payload_.data());
+  payload_.remove_prefix(4);
+  return true;
+}
+
+bool PayloadReader::GetInt32(int32 *value) {
+  uint32 v = 0;
+  if (!GetUInt32(&v)) return false;
+  *value = static_cast<int32>(v);
+  return true;
+}
+
+bool PayloadReader::GetString(absl::string_view *value) {
+  uint32 size = 0;
+  if (!GetUInt32(&size) || payload_.size() < size) return false;
+  *value = payload_.substr(0, size);
+  payload_.remove_prefix(size);
+  return true;
+}
+
+bool PayloadReader::GetIds(std::vector<int> *ids) {
+  uint32 size = 0;
+  if (!GetUInt32(&size) || payload_.size() / 4 < size) return false;
+  ids->resize(size);
+  for (uint32 i = 0; i < size; ++i) {
+    (*ids)[i] = static_cast<int32>(DecodeUInt32(payload_.data() + 4 * i));
+  }
+  payload_.remove_prefix(4 * size);
+  return true;
+}
+
+util::Status WriteFrame(int fd, absl::string_view payload) {
+  CHECK_LE_OR_RETURN(payload.size(), kMaxFrameSize) << "frame is too large.";
+  char header[4];
+  EncodeUInt32(payload.size(), header);
+  RETURN_IF_ERROR(SendAll(fd, header, sizeof(header)));
+  return SendAll(fd, payload.data(), payload.size());
+}
+
+util::Status ReadFrame(int fd, std::string *payload) {
+  char header[4];
+  size_t received = 0;
+  const auto status = RecvAll(fd, header, sizeof(header), &received);
+  if (!status.ok()) {
+    return received == 0 ? util::CancelledError("connection closed.")
+                         : status;
+  }
+
+  const uint32 size = DecodeUInt32(header);
+  CHECK_LE_OR_RETURN(size, kMaxFrameSize) << "frame is too large.";
+  payload->resize(size);
+  if (size == 0) return util::OkStatus();
+  return RecvAll(fd, &(*payload)[0], size, &received);
+}
+
+}  // namespace server
+}  // namespace sentencepiece
@@ -0,0 +1,98 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#ifndef SERVER_PROTOCOL_H_
+#define SERVER_PROTOCOL_H_
+
+#include <string>
+#include <vector>
+
+#include "common.h"
+#include "sentencepiece_processor.h"
+#include "third_party/absl/strings/string_view.h"
+
+namespace sentencepiece {
+namespace server {
+
+// Wire format of spm_server over a Unix domain socket.
+//
+// Every message is a frame, i.e., the uint32 size of the payload followed by
+// the payload. All integers are little-endian, and a string is its uint32
+// size followed by the bytes. A client sends one request and waits for its
+// response.
+//
+// Request:  uint8 type, string model (empty for the default model), and
+//   kEncode, kCountTokens: string input
+//   kDecode:               uint32 n, int32 ids[n]
+//   kStats:                nothing
+// Response: uint8 status code, and
+//   error:                 string message
+//   kEncode:               uint32 n, int32 ids[n]
+//   kDecode, kStats:       string text
+//   kCountTokens:          int32 count
+enum RequestType : uint8 {
+  kEncode = 1,
+  kDecode = 2,
+  kCountTokens = 3,
+  kStats = 4,
+};
+
+// Frames larger than this are rejected.
+constexpr uint32 kMaxFrameSize = 64 << 20;
+
+// Serializes the fields of a payload.
+class PayloadWriter {
+ public:
+  void PutUInt8(uint8 value);
+  void PutUInt32(uint32 value);
+  void PutInt32(int32 value);
+  void PutString(absl::string_view value);
+  void PutIds(const int *ids, size_t size);
+
+  const std::string &payload() const { return payload_; }
+
+ private:
+  std::string payload_;
+};
+
+// Parses the fields of a payload. Returns false when the payload is too
+// short.
+class PayloadReader {
+ public:
+  explicit PayloadReader(absl::string_view payload) : payload_(payload) {}
+
+  bool GetUInt8(uint8 *value);
+  bool GetUInt32(uint32 *value);
+  bool GetInt32(int32 *value);
+  bool GetString(absl::string_view *value);
+  bool GetIds(std::vector<int> *ids);
+
+  // Returns true when all fields are read.
+  bool empty() const { return payload_.empty(); }
+
+ private:
+  absl::string_view payload_;
+};
+
+// Sends `payload` as a frame to the socket `fd`.
+util::Status WriteFrame(int fd, absl::string_view payload);
+
+// Receives a frame from the socket `fd`. Returns a Cancelled error when the
+// peer closes the connection between frames.
+util::Status ReadFrame(int fd, std::string *payload);
+
+}  // namespace server
+}  // namespace sentencepiece
+
+#endif  // SERVER_PROTOCOL_H_
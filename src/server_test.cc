@@ -0,0 +1,304 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include "server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <thread>
+
+#include "filesystem.h"
+#include "sentencepiece_model.pb.h"
+#include "server_client.h"
+#include "server_protocol.h"
+#include "testharness.h"
+#include "third_party/absl/memory/memory.h"
+#include "third_party/absl/strings/str_cat.h"
+#include "util.h"
+
+namespace sentencepiece {
+namespace server {
+namespace {
+
+std::unique_ptr<SentencePieceProcessor> MakeProcessor() {
+  ModelProto model_proto;
+  auto *unk = model_proto.add_pieces();
+  unk->set_piece("<unk>");
+  unk->set_type(ModelProto::SentencePiece::UNKNOWN);
+  for (const auto &piece : {"<s>", "</s>"}) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_piece(piece);
+    sp->set_type(ModelProto::SentencePiece::CONTROL);
+  }
+  const std::vector<std::pair<const char *, float>> pieces = {
+      {"\xE2\x96\x81", -1.0}, {"a", -2.0},  {"b", -2.0},
+      {"c", -2.0},            {"ab", -1.5}, {"\xE2\x96\x81" "abc", -1.0}};
+  for (const auto &piece : pieces) {
+    auto *sp = model_proto.add_pieces();
+    sp->set_piece(piece.first);
+    sp->set_score(piece.second);
+  }
+  auto processor = absl::make_unique<SentencePieceProcessor>();
+  EXPECT_TRUE(processor->Load(model_proto).ok());
+  return processor;
+}
+
+std::string SocketPath() {
+  return util::JoinPath(absl::GetFlag(FLAGS_test_tmpdir), "spm_server.sock");
+}
+
+}  // namespace
+
+TEST(ServerProtocolTest, PayloadTest) {
+  PayloadWriter writer;
+  writer.PutUInt8(kDecode);
+  writer.PutString("model");
+  writer.PutInt32(-5);
+  const std::vector<int> ids = {1, 2, 100000};
+  writer.PutIds(ids.data(), ids.size());
+  writer.PutString("");
+
+  PayloadReader reader(writer.payload());
+  uint8 type = 0;
+  absl::string_view model, empty;
+  int32 value = 0;
+  std::vector<int> output;
+  EXPECT_TRUE(reader.GetUInt8(&type));
+  EXPECT_TRUE(reader.GetString(&model));
+  EXPECT_TRUE(reader.GetInt32(&value));
+  EXPECT_TRUE(reader.GetIds(&output));
+  EXPECT_FALSE(reader.empty());
+  EXPECT_TRUE(reader.GetString(&empty));
+  EXPECT_TRUE(reader.empty());
+  EXPECT_EQ(kDecode, type);
+  EXPECT_EQ("model", model);
+  EXPECT_EQ(-5, value);
+  EXPECT_EQ(ids, output);
+  EXPECT_TRUE(empty.empty());
+
+  // Truncated payloads are rejected.
+  for (size_t size = 0; size < writer.payload().size(); ++size) {
+    PayloadReader truncated(absl::string_view(writer.payload().data(), size));
+    const bool ok = truncated.GetUInt8(&type) &&
+                    truncated.GetString(&model) &&
+                    truncated.GetInt32(&value) && truncated.GetIds(&output) &&
+                    truncated.GetString(&empty);
+    EXPECT_FALSE(ok);
+  }
+}
+
+TEST(ServerProtocolTest, FrameTest) {
+  int fds[2];
+  EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+
+  const std::string large(100000, 'x');
+  std::thread writer([&]() {
+    EXPECT_TRUE(WriteFrame(fds[0], "hello").ok());
+    EXPECT_TRUE(WriteFrame(fds[0], "").ok());
+    EXPECT_TRUE(WriteFrame(fds[0], large).ok());
+    close(fds[0]);
+  });
+
+  std::string payload;
+  EXPECT_TRUE(ReadFrame(fds[1], &payload).ok());
+  EXPECT_EQ("hello", payload);
+  EXPECT_TRUE(ReadFrame(fds[1], &payload).ok());
+  EXPECT_EQ("", payload);
+  EXPECT_TRUE(ReadFrame(fds[1], &payload).ok());
+  EXPECT_EQ(large, payload);
+  writer.join();
+
+  // The peer closed the connection between frames.
+  const auto status = ReadFrame(fds[1], &payload);
+  EXPECT_EQ(util::StatusCode::kCancelled, status.code());
+  close(fds[1]);
+}
+
+TEST(LatencyHistogramTest, PercentileTest) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(0, histogram.count());
+  EXPECT_EQ(0, histogram.Percentile(0.5));
+
+  for (int i = 0; i < 90; ++i) histogram.Add(10);
+  for (int i = 0; i < 10; ++i) histogram.Add(1000);
+  histogram.Add(0);
+  EXPECT_EQ(101, histogram.count());
+  EXPECT_EQ(16, histogram.Percentile(0.5));
+  EXPECT_EQ(16, histogram.Percentile(0.9));
+  EXPECT_EQ(1024, histogram.Percentile(0.99));
+  EXPECT_EQ(1024, histogram.Percentile(1.0));
+
+  const std::string debug = histogram.DebugString();
+  EXPECT_NE(std::string::npos, debug.find("count: 101"));
+  EXPECT_NE(std::string::npos, debug.find("max: 1000us"));
+  EXPECT_NE(std::string::npos, debug.find("[8, 16)us: 90"));
+}
+
+TEST(ServerTest, EndToEndTest) {
+  const auto expected = MakeProcessor();
+  auto with_eos = MakeProcessor();
+  EXPECT_TRUE(with_eos->SetEncodeExtraOptions("eos").ok());
+
+  ServerOptions options;
+  options.max_batch_size = 8;
+  options.num_threads = 2;
+  Server server(options);
+  EXPECT_FALSE(server.Start(SocketPath()).ok());  // no model.
+  EXPECT_TRUE(server.AddModel("default", MakeProcessor()).ok());
+  EXPECT_TRUE(server.AddModel("eos", std::move(with_eos)).ok());
+  EXPECT_FALSE(server.AddModel("eos", MakeProcessor()).ok());
+  EXPECT_TRUE(server.Start(SocketPath()).ok());
+  EXPECT_FALSE(server.AddModel("other", MakeProcessor()).ok());
+
+  constexpr int kNumClients = 8;
+  constexpr int kNumRequests = 50;
+  std::vector<std::thread> threads;
+  for (int n = 0; n < kNumClients; ++n) {
+    threads.emplace_back([&, n]() {
+      Client client;
+      EXPECT_TRUE(client.Connect(SocketPath()).ok());
+      for (int i = 0; i < kNumRequests; ++i) {
+        const std::string input =
+            absl::StrCat("abc ab", std::string(i % 7, 'c'), " x",
+                         std::to_string(n), " ba");
+        std::vector<int> ids, expected_ids;
+        EXPECT_TRUE(client.Encode("", input, &ids).ok());
+        EXPECT_TRUE(expected->Encode(input, &expected_ids).ok());
+        EXPECT_EQ(expected_ids, ids);
+
+        std::vector<int> eos_ids;
+        EXPECT_TRUE(client.Encode("eos", input, &eos_ids).ok());
+        expected_ids.push_back(expected->eos_id());
+        EXPECT_EQ(expected_ids, eos_ids);
+
+        std::string text, expected_text;
+        EXPECT_TRUE(client.Decode("default", ids, &text).ok());
+        EXPECT_TRUE(expected->Decode(ids, &expected_text).ok());
+        EXPECT_EQ(expected_text, text);
+
+        int num_tokens = 0;
+        EXPECT_TRUE(client.CountTokens("", input, &num_tokens).ok());
+        EXPECT_EQ(static_cast<int>(ids.size()), num_tokens);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  Client client;
+  EXPECT_TRUE(client.Connect(SocketPath()).ok());
+  std::string stats;
+  EXPECT_TRUE(client.GetStats(&stats).ok());
+  EXPECT_NE(std::string::npos,
+            stats.find(absl::StrCat(
+                "encode: count: ",
+                std::to_string(2 * kNumClients * kNumRequests))));
+  EXPECT_NE(std::string::npos,
+            stats.find(absl::StrCat(
+                "decode: count: ",
+                std::to_string(kNumClients * kNumRequests))));
+  EXPECT_NE(std::string::npos, stats.find("batches: "));
+
+  server.Stop();
+  std::vector<int> ids;
+  EXPECT_FALSE(client.Encode("", "abc", &ids).ok());
+}
+
+TEST(ServerTest, ErrorTest) {
+  Client client;
+  std::vector<int> ids;
+  EXPECT_FALSE(client.Encode("", "abc", &ids).ok());  // not connected.
+  EXPECT_FALSE(
+      client.Connect(util::JoinPath(absl::GetFlag(FLAGS_test_tmpdir),
+                                    "__UNKNOWN_SOCKET__"))
+          .ok());
+
+  Server server(ServerOptions{});
+  EXPECT_TRUE(server.AddModel("default", MakeProcessor()).ok());
+  EXPECT_TRUE(server.Start(SocketPath()).ok());
+  EXPECT_TRUE(client.Connect(SocketPath()).ok());
+
+  const auto status = client.Encode("__UNKNOWN__", "abc", &ids);
+  EXPECT_EQ(util::StatusCode::kNotFound, status.code());
+
+  // The connection is still usable after an error.
+  std::string text;
+  EXPECT_FALSE(client.Decode("", {1, 100000}, &text).ok());
+  EXPECT_TRUE(client.Encode("", "abc", &ids).ok());
+  EXPECT_TRUE(client.Decode("", ids, &text).ok());
+  EXPECT_EQ("abc", text);
+
+  // An invalid request in a batch does not fail the other requests.
+  std::vector<std::thread> threads;
+  for (int n = 0; n < 8; ++n) {
+    threads.emplace_back([n]() {
+      Client client;
+      EXPECT_TRUE(client.Connect(SocketPath()).ok());
+      std::string text;
+      if (n % 2 == 0) {
+        EXPECT_FALSE(client.Decode("", {100000}, &text).ok());
+      } else {
+        EXPECT_TRUE(client.Decode("", {4}, &text).ok());
+        EXPECT_EQ("a", text);
+      }
+    });
+  }
+  for (auto &thread : threads) thread.join();
+}
+
+TEST(ServerTest, SocketPathTest) {
+  const std::string path = SocketPath();
+  unlink(path.c_str());
+
+  // A file other than a socket is not removed.
+  {
+    auto output = filesystem::NewWritableFile(path);
+    EXPECT_TRUE(output->Write("data"));
+  }
+  Server server(ServerOptions{});
+  EXPECT_TRUE(server.AddModel("default", MakeProcessor()).ok());
+  EXPECT_EQ(util::StatusCode::kAlreadyExists, server.Start(path).code());
+  EXPECT_EQ(0, access(path.c_str(), F_OK));
+  unlink(path.c_str());
+
+  // A stale socket is replaced.
+  {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.data(), path.size());
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXPECT_EQ(0, bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)));
+    close(fd);
+  }
+  Client client;
+  EXPECT_FALSE(client.Connect(path).ok());
+  EXPECT_TRUE(server.Start(path).ok());
+
+  // The server can be restarted.
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(client.Connect(path).ok());
+    std::vector<int> ids;
+    EXPECT_TRUE(client.Encode("", "abc", &ids).ok());
+    server.Stop();
+    EXPECT_NE(0, access(path.c_str(), F_OK));
+    EXPECT_TRUE(server.Start(path).ok());
+  }
+  server.Stop();
+}
+
+}  // namespace server
+}  // namespace sentencepiece
@@ -0,0 +1,93 @@
+// Copyright 2016 Google Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.!
+
+#include <signal.h>
+
+#include <iostream>
+#include <string>
+
+#include "common.h"
+#include "init.h"
+#include "sentencepiece_processor.h"
+#include "server.h"
+#include "third_party/absl/flags/flag.h"
+#include "third_party/absl/memory/memory.h"
+#include "third_party/absl/strings/match.h"
+#include "third_party/absl/strings/str_split.h"
+
+ABSL_FLAG(std::string, socket, "/tmp/spm_server.sock",
+          "Unix domain socket to listen on.");
+ABSL_FLAG(std::string, model, "",
+          "',' separated models to serve, e.g., \"en=en.model,ja=ja.model\". "
+          "The name defaults to the file name without \".model\". The first "
+          "model serves the requests without a model name.");
+ABSL_FLAG(std::string, extra_options, "",
+          "':' separated encoder extra options, e.g., \"reverse:bos:eos\"");
+ABSL_FLAG(int32, num_threads, 4, "Number of threads to process a batch.");
+ABSL_FLAG(int32, max_batch_size, 64, "Maximum number of requests in a batch.");
+ABSL_FLAG(int32, max_batch_delay_us, 200,
+          "Time to wait for more requests after the first request of a batch.");
+
+int main(int argc, char *argv[]) {
+  sentencepiece::ParseCommandLineFlags(argv[0], &argc, &argv, true);
+
+  CHECK(!absl::GetFlag(FLAGS_model).empty()) << "--model is required.";
+
+  sentencepiece::server::ServerOptions options;
+  options.num_threads = absl::GetFlag(FLAGS_num_threads);
+  options.max_batch_size = absl::GetFlag(FLAGS_max_batch_size);
+  options.max_batch_delay_us = absl::GetFlag(FLAGS_max_batch_delay_us);
+  sentencepiece::server::Server server(options);
+
+  const std::string models = absl::GetFlag(FLAGS_model);
+  for (const auto model : absl::StrSplit(models, ",")) {
+    // Load() takes a null-terminated file name.
+    std::string name, filename(model.data(), model.size());
+    const size_t pos = filename.find('=');
+    if (pos != std::string::npos) {
+      name = filename.substr(0, pos);
+      filename = filename.substr(pos + 1);
+    } else {
+      name = filename.substr(filename.find_last_of('/') + 1);
+      if (absl::EndsWith(name, ".model")) {
+        name = name.substr(0, name.size() - 6);
+      }
+    }
+    auto sp = absl::make_unique<sentencepiece::SentencePieceProcessor>();
+    CHECK_OK(sp->Load(filename));
+    CHECK_OK(sp->SetEncodeExtraOptions(absl::GetFlag(FLAGS_extra_options)));
+    CHECK_OK(server.AddModel(name, std::move(sp)));
+    LOG(INFO) << "Loaded " << filename << " as " << name;
+  }
+
+  // Waits for a signal in the main thread; the server threads do not
+  // receive it.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+
+  CHECK_OK(server.Start(absl::GetFlag(FLAGS_socket)));
+  LOG(INFO) << "Listening on " << absl::GetFlag(FLAGS_socket);
+
+  int signal_number = 0;
+  sigwait(&signals, &signal_number);
+
+  server.Stop();
+  std::cerr << server.StatsString();
+
+  return 0;
+}
@@ -12,7 +12,9 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <algorithm>
 #include <cstdlib>
+#include <ctime>
 #include <memory>
 #include <set>
 #include <string>
@@ -26,6 +28,7 @@
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
 #include "third_party/absl/container/flat_hash_map.h"
+#include "third_party/absl/flags/flag.h"
 #include "third_party/absl/memory/memory.h"
 #include "third_party/absl/strings/numbers.h"
 #include "third_party/absl/strings/str_cat.h"
@@ -36,6 +39,14 @@
 #include "unicode_script.h"
 #include "util.h"
 
+#ifndef OS_WIN
+#include <sys/resource.h>
+#endif
+
+ABSL_FLAG(bool, save_trace, false,
+          "Save the training phases to <model_prefix>.trace.json in the "
+          "Chrome trace event format.");
+
 namespace sentencepiece {
 
 const char32 TrainerInterface::kWSChar = L'\u2581';
@@ -149,8 +160,103 @@ class SentenceSelector {
   const TrainerSpec *spec_ = nullptr;
   std::unique_ptr<Sampler> sampler_;
 };
+
+// Returns the CPU time (user + system) of this process in microseconds.
+int64 GetCpuUsec() {
+#ifdef OS_WIN
+  return static_cast<int64>(std::clock()) * 1000000 / CLOCKS_PER_SEC;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return (static_cast<int64>(usage.ru_utime.tv_sec) +
+          usage.ru_stime.tv_sec) *
+             1000000 +
+         usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+// Returns the peak RSS of this process in kilobytes. Returns 0 if not
+// available.
+int64 GetPeakRssKb() {
+#ifdef OS_WIN
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;  // bytes on macOS.
+#else
+  return usage.ru_maxrss;
+#endif
+#endif
+}
 }  // namespace
 
+PhaseProfiler::PhaseProfiler() : start_(std::chrono::steady_clock::now()) {}
+
+PhaseProfiler::~PhaseProfiler() {}
+
+int64 PhaseProfiler::NowUsec() const {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start_)
+      .count();
+}
+
+void PhaseProfiler::Begin(absl::string_view name) {
+  Phase phase;
+  phase.name = std::string(name);
+  phase.depth = running_.size();
+  phase.begin_usec = NowUsec();
+  running_.push_back({phases_.size(), GetCpuUsec()});
+  phases_.emplace_back(phase);
+}
+
+void PhaseProfiler::End() {
+  if (running_.empty()) return;
+  const RunningPhase running = running_.back();
+  running_.pop_back();
+  auto *phase = &phases_[running.index];
+  phase->wall_usec = NowUsec() - phase->begin_usec;
+  phase->cpu_usec = GetCpuUsec() - running.begin_cpu_usec;
+  phase->peak_rss_kb = GetPeakRssKb();
+  // Verbose only, i.e., --minloglevel=-1.
+  if (absl::GetFlag(FLAGS_minloglevel) >= 0) return;
+  LOG(INFO) << "Phase " << phase->name << ": wall=" << phase->wall_usec / 1e6
+            << "s cpu=" << phase->cpu_usec / 1e6
+            << "s peak_rss=" << phase->peak_rss_kb / 1024 << "MB";
+}
+
+std::string PhaseProfiler::ToChromeTrace() const {
+  auto escape = [](const std::string &s) {
+    std::string result;
+    for (const char c : s) {
+      if (c == '"' || c == '\\') result += '\\';
+      result += c;
+    }
+    return result;
+  };
+
+  std::vector<bool> running(phases_.size(), false);
+  for (const auto &r : running_) running[r.index] = true;
+
+  std::ostringstream os;
+  os << "{\"traceEvents\":[";
+  bool first = true;
+  for (size_t i = 0; i < phases_.size(); ++i) {
+    if (running[i]) continue;
+    const auto &phase = phases_[i];
+    if (!first) os << ",";
+    first = false;
+    os << "\n{\"name\":\"" << escape(phase.name) << "\",\"cat\":\"train\""
+       << ",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+       << ",\"ts\":" << phase.begin_usec << ",\"dur\":" << phase.wall_usec
+       << ",\"args\":{\"cpu_usec\":" << phase.cpu_usec
+       << ",\"peak_rss_kb\":" << phase.peak_rss_kb << "}}";
+  }
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return os.str();
+}
+
 MultiFileSentenceIterator::MultiFileSentenceIterator(
     const std::vector<std::string> &files)
     : files_(files) {
@@ -288,6 +394,7 @@ bool TrainerInterface::IsValidSentencePiece(
 }
 
 util::Status TrainerInterface::LoadSentences() {
+  PhaseProfiler::ScopedPhase phase(&profiler_, "load_sentences");
   RETURN_IF_ERROR(status());
   CHECK_OR_RETURN(sentences_.empty());
   CHECK_OR_RETURN(required_chars_.empty());
@@ -325,52 +432,55 @@ util::Status TrainerInterface::LoadSentences() {
     sentence_iterator_ = sentence_iterator_impl.get();
   }
 
-  for (; !sentence_iterator_->done(); sentence_iterator_->Next()) {
-    int64 freq = 1;
-    std::string sentence = sentence_iterator_->value();
-
-    if (is_tsv) {
-      const std::vector<std::string> v = absl::StrSplit(sentence, '\t');
-      CHECK_EQ_OR_RETURN(v.size(), 2)
-          << "Input format must be: word <tab> freq. " << sentence;
-      sentence = v[0];
-      CHECK_OR_RETURN(absl::SimpleAtoi(v[1], &freq))
-          << "Could not parse the frequency";
-      CHECK_GE_OR_RETURN(freq, 1);
-    }
-
-    if (sentence.empty()) continue;
-
-    if (static_cast<int>(sentence.size()) >
-        trainer_spec_.max_sentence_length()) {
-      if (too_long_lines == 0) {
-        LOG(WARNING) << "Found too long line (" << sentence.size() << " > "
-                     << trainer_spec_.max_sentence_length() << ").";
-        LOG(WARNING) << "Too long lines are skipped in the training.";
-        LOG(WARNING) << "The maximum length can be changed with "
-                        "--max_sentence_length=<size> flag.";
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "read_corpus");
+    for (; !sentence_iterator_->done(); sentence_iterator_->Next()) {
+      int64 freq = 1;
+      std::string sentence = sentence_iterator_->value();
+
+      if (is_tsv) {
+        const std::vector<std::string> v = absl::StrSplit(sentence, '\t');
+        CHECK_EQ_OR_RETURN(v.size(), 2)
+            << "Input format must be: word <tab> freq. " << sentence;
+        sentence = v[0];
+        CHECK_OR_RETURN(absl::SimpleAtoi(v[1], &freq))
+            << "Could not parse the frequency";
+        CHECK_GE_OR_RETURN(freq, 1);
       }
-      ++too_long_lines;
-      continue;
-    }
 
-    if (sentence.find(kUNKStr) != std::string::npos) {
-      LOG(INFO) << "Reserved chars are found. Skipped: " << sentence;
-      continue;
-    }
+      if (sentence.empty()) continue;
+
+      if (static_cast<int>(sentence.size()) >
+          trainer_spec_.max_sentence_length()) {
+        if (too_long_lines == 0) {
+          LOG(WARNING) << "Found too long line (" << sentence.size() << " > "
+                       << trainer_spec_.max_sentence_length() << ").";
+          LOG(WARNING) << "Too long lines are skipped in the training.";
+          LOG(WARNING) << "The maximum length can be changed with "
+                          "--max_sentence_length=<size> flag.";
+        }
+        ++too_long_lines;
+        continue;
+      }
 
-    test_sentence_sampler.Add(sentence);
+      if (sentence.find(kUNKStr) != std::string::npos) {
+        LOG(INFO) << "Reserved chars are found. Skipped: " << sentence;
+        continue;
+      }
+
+      test_sentence_sampler.Add(sentence);
 
-    if (!selector.Add(std::make_pair(sentence, freq))) {
-      goto END;
+      if (!selector.Add(std::make_pair(sentence, freq))) {
+        goto END;
+      }
     }
-  }
 
-  RETURN_IF_ERROR(sentence_iterator_->status());
+    RETURN_IF_ERROR(sentence_iterator_->status());
 
-END:
-  // Emits error message if any.
-  selector.Finish();
+  END:
+    // Emits error message if any.
+    selector.Finish();
+  }
 
   if (sentences_.size() == selector.total_size()) {
     LOG(INFO) << "Loaded all " << sentences_.size() << " sentences";
@@ -385,6 +495,7 @@ END:
 
   // Normalize and removes empty string.
   {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "normalize");
     const normalizer::Normalizer normalizer(normalizer_spec_, trainer_spec_);
     std::set<absl::string_view> meta_pieces_set;
     for (const auto &it : meta_pieces_) {
@@ -422,77 +533,81 @@ END:
   }
 
   // Count character frequencies.
-  int64 all_chars_count = 0;
-  // A map from a character to {is_required_char, character count}.
-  absl::flat_hash_map<char32, std::pair<bool, int64>> chars_count;
-  for (const char32 c :
-       string_util::UTF8ToUnicodeText(trainer_spec_.required_chars())) {
-    CHECK_OR_RETURN(string_util::IsValidCodepoint(c));
-    if (c == 0x0000) {
-      LOG(INFO) << "Found null character. The required_chars field must be "
-                   "encoded in utf-8.";
-      continue;
-    }
-    chars_count[c].first = true;  // is_required_character.
-  }
-  for (const auto &w : sentences_) {
-    for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
-      if (!string_util::IsValidCodepoint(c)) continue;
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "count_characters");
+    int64 all_chars_count = 0;
+    // A map from a character to {is_required_char, character count}.
+    absl::flat_hash_map<char32, std::pair<bool, int64>> chars_count;
+    for (const char32 c :
+         string_util::UTF8ToUnicodeText(trainer_spec_.required_chars())) {
+      CHECK_OR_RETURN(string_util::IsValidCodepoint(c));
       if (c == 0x0000) {
-        LOG(INFO)
-            << "Found null character. The corpus must be encoded in utf-8.";
+        LOG(INFO) << "Found null character. The required_chars field must be "
+                     "encoded in utf-8.";
         continue;
       }
-      if (c == 0x0020) {
-        // UTF8ToUnicodeText returns a white space if the text
-        // contains an interchange-invalid character.
-        CHECK_OR_RETURN(w.first.find(" ") == std::string::npos)
-            << "space must not be included in normalized string.";
-        continue;
+      chars_count[c].first = true;  // is_required_character.
+    }
+    for (const auto &w : sentences_) {
+      for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
+        if (!string_util::IsValidCodepoint(c)) continue;
+        if (c == 0x0000) {
+          LOG(INFO)
+              << "Found null character. The corpus must be encoded in utf-8.";
+          continue;
+        }
+        if (c == 0x0020) {
+          // UTF8ToUnicodeText returns a white space if the text
+          // contains an interchange-invalid character.
+          CHECK_OR_RETURN(w.first.find(" ") == std::string::npos)
+              << "space must not be included in normalized string.";
+          continue;
+        }
+        chars_count[c].second += w.second;
+        all_chars_count += w.second;
       }
-      chars_count[c].second += w.second;
-      all_chars_count += w.second;
     }
-  }
-  LOG(INFO) << "all chars count=" << all_chars_count;
-
-  // Determines required_chars which must be included in the vocabulary.
-  int64 accumulated_chars_count = 0;
-  // Sorted() sorts the chars_count values in the decsending order of pair<>.
-  // I.e. characters are sorted in the order of required characters and then
-  // frequent characters.
-  for (const auto &w : Sorted(chars_count)) {
-    const float coverage = 1.0 * accumulated_chars_count / all_chars_count;
-    if (!trainer_spec_.use_all_vocab() &&
-        coverage >= trainer_spec_.character_coverage()) {
-      LOG(INFO) << "Done: " << 100.0 * coverage << "% characters are covered.";
-      break;
-    }
-    accumulated_chars_count += w.second.second;
-    CHECK_NE_OR_RETURN(w.first, 0x0020)
-        << "space must not be included in normalized string.";
-    if (w.first == kUPPBoundaryChar) continue;  // Tab is not included.
-    required_chars_.emplace(w.first, w.second.second);
-  }
-
-  LOG(INFO) << "Alphabet size=" << required_chars_.size();
-  LOG(INFO) << "Final character coverage="
-            << 1.0 * accumulated_chars_count / all_chars_count;
-
-  CHECK_OR_RETURN(!port::ContainsKey(required_chars_, kUNKChar));
+    LOG(INFO) << "all chars count=" << all_chars_count;
+
+    // Determines required_chars which must be included in the vocabulary.
+    int64 accumulated_chars_count = 0;
+    // Sorted() sorts the chars_count values in the decsending order of pair<>.
+    // I.e. characters are sorted in the order of required characters and then
+    // frequent characters.
+    for (const auto &w : Sorted(chars_count)) {
+      const float coverage = 1.0 * accumulated_chars_count / all_chars_count;
+      if (!trainer_spec_.use_all_vocab() &&
+          coverage >= trainer_spec_.character_coverage()) {
+        LOG(INFO) << "Done: " << 100.0 * coverage
+                  << "% characters are covered.";
+        break;
+      }
+      accumulated_chars_count += w.second.second;
+      CHECK_NE_OR_RETURN(w.first, 0x0020)
+          << "space must not be included in normalized string.";
+      if (w.first == kUPPBoundaryChar) continue;  // Tab is not included.
+      required_chars_.emplace(w.first, w.second.second);
+    }
 
-  // Replaces rare characters (characters not included in required_chars_)
-  // with kUNKChar.
-  for (auto &w : sentences_) {
-    string_util::UnicodeText uw2;
-    for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
-      if (port::ContainsKey(required_chars_, c)) {
-        uw2.push_back(c);
-      } else {
-        uw2.push_back(kUNKChar);
+    LOG(INFO) << "Alphabet size=" << required_chars_.size();
+    LOG(INFO) << "Final character coverage="
+              << 1.0 * accumulated_chars_count / all_chars_count;
+
+    CHECK_OR_RETURN(!port::ContainsKey(required_chars_, kUNKChar));
+
+    // Replaces rare characters (characters not included in required_chars_)
+    // with kUNKChar.
+    for (auto &w : sentences_) {
+      string_util::UnicodeText uw2;
+      for (const char32 c : string_util::UTF8ToUnicodeText(w.first)) {
+        if (port::ContainsKey(required_chars_, c)) {
+          uw2.push_back(c);
+        } else {
+          uw2.push_back(kUNKChar);
+        }
       }
+      w.first = string_util::UnicodeTextToUTF8(uw2);
     }
-    w.first = string_util::UnicodeTextToUTF8(uw2);
   }
 
   // +3 for meta pieces.
@@ -514,6 +629,7 @@ END:
 }
 
 void TrainerInterface::SplitSentencesByWhitespace() {
+  PhaseProfiler::ScopedPhase phase(&profiler_, "split_by_whitespace");
   LOG(INFO) << "Tokenizing input sentences with whitespace: "
             << sentences_.size();
   absl::flat_hash_map<std::string, int64> tokens;
@@ -589,33 +705,55 @@ util::Status TrainerInterface::Serialize(ModelProto *model_proto) const {
   if (!self_test_samples_.empty()) {
     SentencePieceProcessor sp;
     RETURN_IF_ERROR(sp.Load(*model_proto));
-    for (const auto &input : self_test_samples_) {
-      std::vector<std::string> sps;
-      RETURN_IF_ERROR(sp.Encode(input, &sps));
+
+    // Encodes the samples in parallel. Each thread handles a strided subset.
+    const int num_threads = std::max<int>(
+        1, std::min<int>(trainer_spec_.num_threads(),
+                         self_test_samples_.size()));
+    std::vector<std::string> expected(self_test_samples_.size());
+    std::vector<util::Status> statuses(num_threads);
+    {
+      auto pool = absl::make_unique<ThreadPool>(num_threads);
+      pool->StartWorkers();
+      for (int n = 0; n < num_threads; ++n) {
+        pool->Schedule([&, n]() {
+          for (size_t i = n; i < self_test_samples_.size();
+               i += num_threads) {
+            std::vector<std::string> sps;
+            statuses[n] = sp.Encode(self_test_samples_[i], &sps);
+            if (!statuses[n].ok()) return;
+            expected[i] = absl::StrJoin(sps, " ");
+          }
+        });
+      }
+    }
+
+    for (const auto &status : statuses) {
+      RETURN_IF_ERROR(status);
+    }
+
+    for (size_t i = 0; i < self_test_samples_.size(); ++i) {
       auto *sample = model_proto->mutable_self_test_data()->add_samples();
-      sample->set_input(input);
-      sample->set_expected(absl::StrJoin(sps, " "));
+      sample->set_input(self_test_samples_[i]);
+      sample->set_expected(expected[i]);
     }
   }
 
   return util::OkStatus();
 }
 
-util::Status TrainerInterface::SaveModel(absl::string_view filename) const {
+util::Status TrainerInterface::SaveModel(absl::string_view filename,
+                                         const ModelProto &model_proto) const {
   LOG(INFO) << "Saving model: " << filename;
-  ModelProto model_proto;
-  RETURN_IF_ERROR(Serialize(&model_proto));
-
   auto output = filesystem::NewWritableFile(filename.data(), true);
   RETURN_IF_ERROR(output->status());
   output->Write(model_proto.SerializeAsString());
   return util::OkStatus();
 }
 
-util::Status TrainerInterface::SaveVocab(absl::string_view filename) const {
+util::Status TrainerInterface::SaveVocab(absl::string_view filename,
+                                         const ModelProto &model_proto) const {
   LOG(INFO) << "Saving vocabs: " << filename;
-  ModelProto model_proto;
-  RETURN_IF_ERROR(Serialize(&model_proto));
   auto output = filesystem::NewWritableFile(filename);
   RETURN_IF_ERROR(output->status());
 
@@ -635,12 +773,33 @@ util::Status TrainerInterface::SaveVocab(absl::string_view filename) const {
 }
 
 util::Status TrainerInterface::Save() const {
-  if (output_model_proto_) {
-    RETURN_IF_ERROR(Serialize(output_model_proto_));
-  } else {
-    RETURN_IF_ERROR(SaveModel(trainer_spec_.model_prefix() + ".model"));
-    RETURN_IF_ERROR(SaveVocab(trainer_spec_.model_prefix() + ".vocab"));
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "save");
+    if (output_model_proto_) {
+      RETURN_IF_ERROR(Serialize(output_model_proto_));
+    } else {
+      // Both files are written from the same proto.
+      ModelProto model_proto;
+      RETURN_IF_ERROR(Serialize(&model_proto));
+      RETURN_IF_ERROR(
+          SaveModel(trainer_spec_.model_prefix() + ".model", model_proto));
+      RETURN_IF_ERROR(
+          SaveVocab(trainer_spec_.model_prefix() + ".vocab", model_proto));
+    }
+  }
+
+  if (!output_model_proto_ && absl::GetFlag(FLAGS_save_trace)) {
+    RETURN_IF_ERROR(SaveTrace(trainer_spec_.model_prefix() + ".trace.json"));
   }
+
+  return util::OkStatus();
+}
+
+util::Status TrainerInterface::SaveTrace(absl::string_view filename) const {
+  LOG(INFO) << "Saving trace: " << filename;
+  auto output = filesystem::NewWritableFile(filename);
+  RETURN_IF_ERROR(output->status());
+  CHECK_OR_RETURN(output->Write(profiler_.ToChromeTrace()));
   return util::OkStatus();
 }
 
@@ -16,6 +16,7 @@
 #define TRAINER_INTERFACE_H_
 
 #include <algorithm>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <string>
@@ -49,6 +50,64 @@ std::vector<std::pair<K, V>> Sorted(const absl::flat_hash_map<K, V> &m) {
   return Sorted(v);
 }
 
+// Records the wall time, CPU time and peak RSS of training phases.
+// Phases can be nested. The result can be exported in the Chrome trace
+// event format, which is viewable with chrome://tracing.
+class PhaseProfiler {
+ public:
+  struct Phase {
+    std::string name;
+    int depth = 0;
+    // Wall clock time relative to the construction of the profiler.
+    int64 begin_usec = 0;
+    int64 wall_usec = 0;
+    // Process CPU time (user + system) of all threads.
+    int64 cpu_usec = 0;
+    // Peak RSS of the process at the end of the phase.
+    int64 peak_rss_kb = 0;
+  };
+
+  // Begins a phase in the constructor and ends it in the destructor.
+  class ScopedPhase {
+   public:
+    ScopedPhase(PhaseProfiler *profiler, absl::string_view name)
+        : profiler_(profiler) {
+      profiler_->Begin(name);
+    }
+    ~ScopedPhase() { profiler_->End(); }
+
+   private:
+    PhaseProfiler *profiler_ = nullptr;
+  };
+
+  PhaseProfiler();
+  virtual ~PhaseProfiler();
+
+  // Begins a new phase nested in the current one.
+  void Begin(absl::string_view name);
+
+  // Ends the innermost phase and logs its figures.
+  void End();
+
+  // Completed and running phases in the order of Begin().
+  const std::vector<Phase> &phases() const { return phases_; }
+
+  // Returns the completed phases in the Chrome trace event format.
+  std::string ToChromeTrace() const;
+
+ private:
+  struct RunningPhase {
+    size_t index;
+    int64 begin_cpu_usec;
+  };
+
+  int64 NowUsec() const;
+
+  const std::chrono::steady_clock::time_point start_;
+  std::vector<Phase> phases_;
+  std::vector<RunningPhase> running_;
+};
+
 class MultiFileSentenceIterator : public SentenceIterator {
  public:
   explicit MultiFileSentenceIterator(const std::vector<std::string> &files);
@@ -160,6 +219,11 @@ class TrainerInterface {
   // Emits model to this proto instead of file.
   ModelProto *output_model_proto_ = nullptr;
 
+  // Records the training phases. The trace is saved as
+  // <model_prefix>.trace.json with --save_trace. Mutable as Save() is a
+  // const method.
+  mutable PhaseProfiler profiler_;
+
  private:
   // Serialize final_pieces_ to |model_proto|.
   util::Status Serialize(ModelProto *model_proto) const;
@@ -167,11 +231,16 @@ class TrainerInterface {
   // Saves the best sentence split with the current model for debugging.
   util::Status SaveSplits(absl::string_view filename) const;
 
-  // Saves model file.
-  util::Status SaveModel(absl::string_view filename) const;
+  // Saves `model_proto` to the model file.
+  util::Status SaveModel(absl::string_view filename,
+                         const ModelProto &model_proto) const;
+
+  // Saves the pieces of `model_proto` to the vocabulary file for NMT.
+  util::Status SaveVocab(absl::string_view filename,
+                         const ModelProto &model_proto) const;
 
-  // Saves vocabulary file for NMT.
-  util::Status SaveVocab(absl::string_view filename) const;
+  // Saves the phase trace in the Chrome trace event format.
+  util::Status SaveTrace(absl::string_view filename) const;
 
   // Initializes `meta_pieces_` from TrainerSpec.
   util::Status InitMetaPieces();
@@ -12,12 +12,15 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <numeric>
 #include <utility>
 
 #include "filesystem.h"
+#include "sentencepiece_processor.h"
 #include "testharness.h"
 #include "third_party/absl/strings/str_cat.h"
 #include "third_party/absl/strings/str_format.h"
+#include "third_party/absl/strings/str_join.h"
 #include "trainer_interface.h"
 #include "util.h"
 
@@ -438,6 +441,32 @@ TEST(TrainerInterfaceTest, SerializeTest) {
       EXPECT_EQ(final_pieces[i - 3].second, model_proto.pieces(i).score());
     }
   }
+
+  {
+    // Self-test samples are encoded in parallel but kept in input order.
+    trainer_spec.set_vocab_size(10);
+    trainer_spec.set_model_type(TrainerSpec::CHAR);
+    trainer_spec.set_hard_vocab_limit(false);
+    trainer_spec.set_num_threads(4);
+    TrainerInterface trainer(trainer_spec, normalizer_spec, denormalizer_spec);
+    trainer.final_pieces_ = final_pieces;
+    for (int i = 0; i < 100; ++i) {
+      trainer.self_test_samples_.emplace_back(i % 7 + 1, "abc"[i % 3]);
+    }
+    ModelProto model_proto;
+    EXPECT_TRUE(trainer.Serialize(&model_proto).ok());
+    ASSERT_EQ(100, model_proto.self_test_data().samples_size());
+
+    SentencePieceProcessor sp;
+    EXPECT_TRUE(sp.Load(model_proto).ok());
+    for (int i = 0; i < 100; ++i) {
+      const auto &sample = model_proto.self_test_data().samples(i);
+      EXPECT_EQ(trainer.self_test_samples_[i], sample.input());
+      std::vector<std::string> sps;
+      EXPECT_TRUE(sp.Encode(sample.input(), &sps).ok());
+      EXPECT_EQ(absl::StrJoin(sps, " "), sample.expected());
+    }
+  }
 }
 
 TEST(TrainerInterfaceTest, CharactersTest) {
@@ -504,6 +533,43 @@ TEST(TrainerInterfaceTest, CharactersTest) {
   }
 }
 
+TEST(TrainerInterfaceTest, PhaseProfilerTest) {
+  PhaseProfiler profiler;
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler, "outer");
+    profiler.Begin("inner");
+    std::vector<int> v(1 << 20, 1);
+    EXPECT_EQ(1 << 20, std::accumulate(v.begin(), v.end(), 0));
+    profiler.End();
+  }
+  profiler.Begin("running");
+
+  const auto &phases = profiler.phases();
+  ASSERT_EQ(3, phases.size());
+  EXPECT_EQ("outer", phases[0].name);
+  EXPECT_EQ(0, phases[0].depth);
+  EXPECT_EQ("inner", phases[1].name);
+  EXPECT_EQ(1, phases[1].depth);
+  EXPECT_LE(phases[0].begin_usec, phases[1].begin_usec);
+  EXPECT_LE(phases[1].begin_usec + phases[1].wall_usec,
+            phases[0].begin_usec + phases[0].wall_usec);
+  EXPECT_GE(phases[1].cpu_usec, 0);
+#ifndef OS_WIN
+  EXPECT_GT(phases[1].peak_rss_kb, 0);
+#endif
+
+  // Running phases are not exported.
+  const std::string trace = profiler.ToChromeTrace();
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"outer\""));
+  EXPECT_NE(std::string::npos, trace.find("\"name\":\"inner\""));
+  EXPECT_EQ(std::string::npos, trace.find("running"));
+  EXPECT_EQ(0, trace.find("{\"traceEvents\":["));
+
+  // End() without Begin() is ignored.
+  profiler.End();
+  profiler.End();
+}
+
 TEST(TrainerInterfaceTest, MultiFileSentenceIteratorTest) {
   std::vector<std::string> files;
   std::vector<std::string> expected;
@@ -37,6 +37,11 @@ constexpr size_t kPreallocateLatticeNodeSize = 1024;
 constexpr float kUnkPenalty = 10.0;
 constexpr float kEpsilon = 1e-7;
 
+// Models with at least this many pieces are loaded with the score-ordered
+// trie. Its double array outgrows the cache less often, which pays for its
+// slower build from this size on. Checked with spm_piece_trie_bench.
+constexpr size_t kMinPiecesForScoreOrderedTrie = 16384;
+
 // Returns log(exp(x) + exp(y)).
 // if init_mode is true, returns log(exp(y)) == y.
 // log(\sum_i exp(a[i])) can be computed as
@@ -330,6 +335,11 @@ std::vector<std::vector<Lattice::Node *>> Lattice::NBest(size_t nbest_size) {
 }
 
 std::vector<Lattice::Node *> Lattice::Sample(float theta) {
+  return Sample(theta, nullptr);
+}
+
+std::vector<Lattice::Node *> Lattice::Sample(
+    float theta, random::PhiloxRandomGenerator *rand_gen) {
   const int len = size();
   if (len == 0) return {};
 
@@ -345,7 +355,7 @@ std::vector<Lattice::Node *> Lattice::Sample(float theta) {
     }
   }
 
-  auto *mt = random::GetRandomGenerator();
+  auto *mt = rand_gen == nullptr ? random::GetRandomGenerator() : nullptr;
 
   std::vector<Node *> results;
   std::vector<float> probs;
@@ -359,7 +369,7 @@ std::vector<Lattice::Node *> Lattice::Sample(float theta) {
                                                    theta * lnode->score - Z)));
     }
     std::discrete_distribution<int> dist(probs.begin(), probs.end());
-    node = end_nodes_[node->pos][dist(*mt)];
+    node = end_nodes_[node->pos][rand_gen ? dist(*rand_gen) : dist(*mt)];
     if (node == bos_node()) break;
 
     Z = alpha[node->node_id];
@@ -373,7 +383,7 @@ std::vector<Lattice::Node *> Lattice::Sample(float theta) {
 // Model::Model() {}
 // Model::~Model() {}
 
-void Model::PopulateNodes(Lattice *lattice) const {
+void Model::PopulateNodes(Lattice *lattice, const VocabularyMask *mask) const {
   auto get_chars_length = [&lattice](int begin_pos, const char *end) {
     int pos = begin_pos;
     while (lattice->surface(pos) < end) ++pos;
@@ -386,16 +396,15 @@ void Model::PopulateNodes(Lattice *lattice) const {
   const char *end = lattice->sentence() + lattice->utf8_size();
 
   // +1 just in case.
-  std::vector<Darts::DoubleArray::result_pair_type> trie_results(
-      trie_results_size_ + 1);
+  std::vector<PieceTrie::Result> trie_results(trie_results_size_ + 1);
 
   for (int begin_pos = 0; begin_pos < len; ++begin_pos) {
     const char *begin = lattice->surface(begin_pos);
 
     // Finds all pieces which are prefix of surface(begin_pos).
-    const size_t num_nodes = trie_->commonPrefixSearch(
-        begin, trie_results.data(), trie_results.size(),
-        static_cast<int>(end - begin));
+    const size_t num_nodes = trie_->CommonPrefixSearch(
+        absl::string_view(begin, end - begin), trie_results.data(),
+        trie_results.size());
     CHECK_LT(num_nodes, trie_results.size());
 
     bool has_single_node = false;
@@ -404,8 +413,8 @@ void Model::PopulateNodes(Lattice *lattice) const {
     for (size_t k = 0; k < num_nodes; ++k) {
       const int length =
           get_chars_length(begin_pos, begin + trie_results[k].length);
-      const int id = trie_results[k].value;
-      if (IsUnusedInlined(id)) continue;
+      const int id = trie_results[k].id;
+      if (IsUnusedInlined(id, mask)) continue;
       Lattice::Node *node = lattice->Insert(begin_pos, length);
       node->id = id;  // the value of Trie stores vocab_id.
       // User defined symbol receives extra bonus to always be selected.
@@ -429,46 +438,49 @@ int Model::PieceToId(absl::string_view piece) const {
   if (it != reserved_id_map_.end()) {
     return it->second;
   }
-  int id = 0;
-  trie_->exactMatchSearch(piece.data(), id, piece.size());
+  const int id = trie_->ExactMatchSearch(piece);
   return id == -1 ? unk_id_ : id;
 }
 
-void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
-  if (!status().ok()) return;
+util::Status Model::SetPieceTrieType(PieceTrieType type) {
+  RETURN_IF_ERROR(status());
+  if (type == trie_type_) return util::OkStatus();
+  trie_type_ = type;
 
-  if (pieces->empty()) {
-    status_ = util::InternalError("no pieces are loaded.");
-    return;
+  // Same pieces as InitializePieces() adds to the trie.
+  std::vector<std::pair<absl::string_view, int>> pieces;
+  for (int i = 0; i < model_proto_->pieces_size(); ++i) {
+    const auto &sp = model_proto_->pieces(i);
+    if (sp.type() == ModelProto::SentencePiece::NORMAL ||
+        sp.type() == ModelProto::SentencePiece::USER_DEFINED ||
+        sp.type() == ModelProto::SentencePiece::UNUSED) {
+      pieces.emplace_back(sp.piece(), i);
+    }
   }
 
-  // sort by sentencepiece since DoubleArray::build()
-  // only accepts sorted strings.
-  sort(pieces->begin(), pieces->end());
+  BuildTrie(&pieces);
+  return status();
+}
 
-  // Makes key/value set for DoubleArrayTrie.
-  std::vector<const char *> key(pieces->size());
-  std::vector<int> value(pieces->size());
-  for (size_t i = 0; i < pieces->size(); ++i) {
-    key[i] = (*pieces)[i].first.data();  // sorted piece.
-    value[i] = (*pieces)[i].second;      // vocab_id
-  }
+void Model::BuildTrie(std::vector<std::pair<absl::string_view, int>> *pieces) {
+  if (!status().ok()) return;
 
-  trie_ = absl::make_unique<Darts::DoubleArray>();
-  if (trie_->build(key.size(), const_cast<char **>(&key[0]), nullptr,
-                   &value[0]) != 0) {
-    status_ = util::InternalError("cannot build double-array.");
-    return;
+  std::vector<float> scores(model_proto_->pieces_size());
+  for (int i = 0; i < model_proto_->pieces_size(); ++i) {
+    scores[i] = GetScoreInlined(i);
   }
 
+  trie_ = MakePieceTrie(trie_type_);
+  status_ = trie_->Build(pieces, scores);
+  if (!status_.ok()) return;
+
   // Computes the maximum number of shared prefixes in the trie.
   const int kMaxTrieResultsSize = 1024;
-  std::vector<Darts::DoubleArray::result_pair_type> results(
-      kMaxTrieResultsSize);
+  std::vector<PieceTrie::Result> results(kMaxTrieResultsSize);
   trie_results_size_ = 0;
   for (const auto &p : *pieces) {
-    const int num_nodes = trie_->commonPrefixSearch(
-        p.first.data(), results.data(), results.size(), p.first.size());
+    const int num_nodes =
+        trie_->CommonPrefixSearch(p.first, results.data(), results.size());
     trie_results_size_ = std::max(trie_results_size_, num_nodes);
   }
 
@@ -495,14 +507,28 @@ Model::Model(const ModelProto &model_proto) {
   std::vector<std::pair<absl::string_view, int>> pieces;
   for (const auto &it : pieces_) pieces.emplace_back(it.first, it.second);
 
+  if (pieces.size() >= kMinPiecesForScoreOrderedTrie) {
+    trie_type_ = PieceTrieType::kScoreOrdered;
+  }
+
   BuildTrie(&pieces);
 }
 
 Model::~Model() {}
 
 EncodeResult Model::Encode(absl::string_view normalized) const {
+  return EncodeInternal(normalized, nullptr);
+}
+
+EncodeResult Model::EncodeWithMask(absl::string_view normalized,
+                                   const VocabularyMask &mask) const {
+  return EncodeInternal(normalized, &mask);
+}
+
+EncodeResult Model::EncodeInternal(absl::string_view normalized,
+                                   const VocabularyMask *mask) const {
   if (encoder_version_ == EncoderVersion::kOptimized) {
-    return EncodeOptimized(normalized);
+    return EncodeOptimized(normalized, mask);
   }
 
   if (!status().ok() || normalized.empty()) {
@@ -511,7 +537,7 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
 
   Lattice lattice;
   lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  PopulateNodes(&lattice, mask);
 
   EncodeResult results;
   for (const auto *node : lattice.Viterbi()) {
@@ -523,6 +549,18 @@ EncodeResult Model::Encode(absl::string_view normalized) const {
 
 NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
                                      int nbest_size) const {
+  return NBestEncodeInternal(normalized, nbest_size, nullptr);
+}
+
+NBestEncodeResult Model::NBestEncodeWithMask(
+    absl::string_view normalized, int nbest_size,
+    const VocabularyMask &mask) const {
+  return NBestEncodeInternal(normalized, nbest_size, &mask);
+}
+
+NBestEncodeResult Model::NBestEncodeInternal(
+    absl::string_view normalized, int nbest_size,
+    const VocabularyMask *mask) const {
   if (!status().ok() || normalized.empty()) {
     return {{{}, 0.0}};
   }
@@ -531,7 +569,7 @@ NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
 
   Lattice lattice;
   lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  PopulateNodes(&lattice, mask);
 
   NBestEncodeResult nbest_results;
   for (const auto &nbest : lattice.NBest(nbest_size)) {
@@ -549,16 +587,36 @@ NBestEncodeResult Model::NBestEncode(absl::string_view normalized,
 
 EncodeResult Model::SampleEncode(absl::string_view normalized,
                                  float theta) const {
+  return SampleEncodeInternal(normalized, theta, nullptr, nullptr);
+}
+
+EncodeResult Model::SampleEncode(
+    absl::string_view normalized, float theta,
+    random::PhiloxRandomGenerator *rand_gen) const {
+  return SampleEncodeInternal(normalized, theta, rand_gen, nullptr);
+}
+
+EncodeResult Model::SampleEncodeWithMask(
+    absl::string_view normalized, float theta,
+    random::PhiloxRandomGenerator *rand_gen,
+    const VocabularyMask &mask) const {
+  return SampleEncodeInternal(normalized, theta, rand_gen, &mask);
+}
+
+EncodeResult Model::SampleEncodeInternal(
+    absl::string_view normalized, float theta,
+    random::PhiloxRandomGenerator *rand_gen,
+    const VocabularyMask *mask) const {
   if (!status().ok() || normalized.empty()) {
     return {};
   }
 
   Lattice lattice;
   lattice.SetSentence(normalized);
-  PopulateNodes(&lattice);
+  PopulateNodes(&lattice, mask);
 
   EncodeResult results;
-  for (const auto *node : lattice.Sample(theta)) {
+  for (const auto *node : lattice.Sample(theta, rand_gen)) {
     results.emplace_back(node->piece, node->id);
   }
 
@@ -597,7 +655,8 @@ bool Model::VerifyOutputsEquivalent(absl::string_view expected,
   return true;
 }
 
-EncodeResult Model::EncodeOptimized(absl::string_view normalized) const {
+EncodeResult Model::EncodeOptimized(absl::string_view normalized,
+                                    const VocabularyMask *mask) const {
   // An optimized Viterbi algorithm for unigram language models. Benchmarking
   // results show that it generates almost identical outputs and achieves 2.1x
   // speedup on average for 102 languages compared to the original
@@ -653,23 +712,81 @@ EncodeResult Model::EncodeOptimized(absl::string_view normalized) const {
   if (!status().ok() || normalized.empty()) {
     return {};
   }
-  // Represents the last node of the best path.
-  struct BestPathNode {
-    int id = -1;  // The vocab id. (maybe -1 for UNK)
-    float best_path_score =
-        0;  // The total score of the best path ending at this node.
-    int starts_at =
-        -1;  // The starting position (in utf-8) of this node. The entire best
-             // path can be constructed by backtracking along this link.
-  };
+  std::vector<BestPathNode> best_path_ends_at;
+  ComputeBestPathOptimized(normalized, mask, &best_path_ends_at);
+
+  // Backtrack to identify the best path.
+  EncodeResult results;
+  int ends_at = normalized.size();
+  while (ends_at > 0) {
+    const auto &node = best_path_ends_at[ends_at];
+    results.emplace_back(
+        normalized.substr(node.starts_at, ends_at - node.starts_at), node.id);
+    ends_at = node.starts_at;
+  }
+  std::reverse(results.begin(), results.end());
+  return results;
+}
+
+int Model::CountTokens(absl::string_view normalized) const {
+  if (encoder_version_ != EncoderVersion::kOptimized) {
+    return ModelInterface::CountTokens(normalized);
+  }
+
+  if (!status().ok() || normalized.empty()) {
+    return 0;
+  }
+  std::vector<BestPathNode> best_path_ends_at;
+  ComputeBestPathOptimized(normalized, nullptr, &best_path_ends_at);
+
+  // Backtracks the best path in the same way as EncodeOptimized(), but only
+  // counts the pieces. Unknown runs are merged (or split into bytes) as in
+  // SentencePieceProcessor.
+  const bool byte_fallback = ByteFallbackEnabled();
+  int count = 0;
+  bool is_next_unk = false;
+  int ends_at = normalized.size();
+  while (ends_at > 0) {
+    const auto &node = best_path_ends_at[ends_at];
+    const bool is_unk = IsUnknownInlined(node.id);
+    if (is_unk && byte_fallback) {
+      count += ends_at - node.starts_at;
+    } else if (!is_unk || !is_next_unk) {
+      ++count;
+    }
+    is_next_unk = is_unk;
+    ends_at = node.starts_at;
+  }
+  return count;
+}
+
+void Model::ComputeBestPathOptimized(
+    absl::string_view normalized, const VocabularyMask *mask,
+    std::vector<BestPathNode> *best_path_ends_at) const {
+  if (trie_type_ == PieceTrieType::kScoreOrdered) {
+    ComputeBestPathOptimizedImpl<ScoreOrderedTrie>(normalized, mask,
+                                                   best_path_ends_at);
+  } else {
+    ComputeBestPathOptimizedImpl<DoubleArrayTrie>(normalized, mask,
+                                                  best_path_ends_at);
+  }
+}
+
+template <typename Trie>
+void Model::ComputeBestPathOptimizedImpl(
+    absl::string_view normalized, const VocabularyMask *mask,
+    std::vector<BestPathNode> *best_path_ends_at_ptr) const {
+  const auto &trie = static_cast<const Trie &>(*trie_);
   const int size = normalized.size();
   const float unk_score = min_score() - kUnkPenalty;
   // The ends are exclusive.
-  std::vector<BestPathNode> best_path_ends_at(size + 1);
+  best_path_ends_at_ptr->assign(size + 1, BestPathNode());
+  auto &best_path_ends_at = *best_path_ends_at_ptr;
+
   // Generate lattice on-the-fly (not stored) and update best_path_ends_at.
   int starts_at = 0;
   while (starts_at < size) {
-    std::size_t node_pos = 0;
+    auto node = trie.root();
     std::size_t key_pos = starts_at;
     const auto best_path_score_till_here =
         best_path_ends_at[starts_at].best_path_score;
@@ -678,11 +795,11 @@ EncodeResult Model::EncodeOptimized(absl::string_view normalized) const {
         std::min<int>(string_util::OneCharLen(normalized.data() + starts_at),
                       size - starts_at);
     while (key_pos < size) {
-      const int ret =
-          trie_->traverse(normalized.data(), node_pos, key_pos, key_pos + 1);
-      if (ret == -2) break;
+      int ret = -1;
+      if (!trie.Next(&node, normalized[key_pos], &ret)) break;
+      ++key_pos;
       if (ret >= 0) {
-        if (IsUnusedInlined(ret)) continue;
+        if (IsUnusedInlined(ret, mask)) continue;
         // Update the best path node.
         auto &target_node = best_path_ends_at[key_pos];
         const auto length = (key_pos - starts_at);
@@ -717,17 +834,6 @@ EncodeResult Model::EncodeOptimized(absl::string_view normalized) const {
     // Move by one unicode character.
     starts_at += mblen;
   }
-  // Backtrack to identify the best path.
-  EncodeResult results;
-  int ends_at = size;
-  while (ends_at > 0) {
-    const auto &node = best_path_ends_at[ends_at];
-    results.emplace_back(
-        normalized.substr(node.starts_at, ends_at - node.starts_at), node.id);
-    ends_at = node.starts_at;
-  }
-  std::reverse(results.begin(), results.end());
-  return results;
 }
 }  // namespace unigram
 }  // namespace sentencepiece
@@ -23,8 +23,8 @@
 #include "common.h"
 #include "freelist.h"
 #include "model_interface.h"
+#include "piece_trie.h"
 #include "sentencepiece_model.pb.h"
-#include "third_party/darts_clone/darts.h"
 
 namespace sentencepiece {
 namespace unigram {
@@ -93,6 +93,11 @@ class Lattice {
   // `theta` is a smoothing parameter.
   std::vector<Node *> Sample(float theta);
 
+  // Same as above, but draws random numbers from `rand_gen`.
+  // Uses the thread-local generator when `rand_gen` is nullptr.
+  std::vector<Node *> Sample(float theta,
+                             random::PhiloxRandomGenerator *rand_gen);
+
   // Populates marginal probability of every node in this lattice.
   // |freq| is the frequency of the sentence.
   //  for (auto *node : all_nodes_) {
@@ -127,10 +132,28 @@ class Model : public ModelInterface {
   EncodeResult SampleEncode(absl::string_view normalized,
                             float theta) const override;
 
+  EncodeResult SampleEncode(
+      absl::string_view normalized, float theta,
+      random::PhiloxRandomGenerator *rand_gen) const override;
+
+  EncodeResult EncodeWithMask(absl::string_view normalized,
+                              const VocabularyMask &mask) const override;
+
+  NBestEncodeResult NBestEncodeWithMask(
+      absl::string_view normalized, int nbest_size,
+      const VocabularyMask &mask) const override;
+
+  EncodeResult SampleEncodeWithMask(
+      absl::string_view normalized, float theta,
+      random::PhiloxRandomGenerator *rand_gen,
+      const VocabularyMask &mask) const override;
+
   bool IsSampleEncodeAvailable() const override { return true; }
 
   bool IsNBestEncodeAvailable() const override { return true; }
 
+  bool IsVocabularyMaskAvailable() const override { return true; }
+
   // Returns the minimum score in sentence pieces.
   // min_score() - 10 is used for the cost of unknown sentence.
   float min_score() const { return min_score_; }
@@ -141,12 +164,25 @@ class Model : public ModelInterface {
 
   // Populates all sentence pieces to the |lattice|.
   // After calling this function, lattice.Viterbi() returns the
-  // best segmentation.
-  void PopulateNodes(Lattice *lattice) const;
+  // best segmentation. The pieces disallowed by |mask| are skipped.
+  void PopulateNodes(Lattice *lattice,
+                     const VocabularyMask *mask = nullptr) const;
 
   // Returns a vocab id of |piece|.
   int PieceToId(absl::string_view piece) const override;
 
+  // Rebuilds the trie of the pieces with `type`. kScoreOrdered is faster to
+  // search, especially when the trie is larger than the cache, but slower to
+  // build. A model loaded from a ModelProto uses kScoreOrdered when it has
+  // 16384 or more pieces, and kDoubleArray otherwise. The trainer always
+  // uses kDoubleArray, as it rebuilds the trie on every EM step.
+  util::Status SetPieceTrieType(PieceTrieType type);
+
+  PieceTrieType GetPieceTrieType() const { return trie_type_; }
+
+  // Counts the pieces on the best path without creating the EncodeResult.
+  int CountTokens(absl::string_view normalized) const override;
+
   // Verifies if two outputs are equivalent by comparing their scores.
   bool VerifyOutputsEquivalent(absl::string_view expected,
                                absl::string_view actual) const override;
@@ -164,11 +200,49 @@ class Model : public ModelInterface {
   // 5. Does not depend on `class Lattice` nor call `SetSentence()`,
   // `PopulateNodes()`, or `Viterbi()`. It does everything in one function.
   // For detailed explanations please see the comments inside the function body.
-  EncodeResult EncodeOptimized(absl::string_view normalized) const;
+  EncodeResult EncodeOptimized(absl::string_view normalized,
+                               const VocabularyMask *mask) const;
+
+  // Implementations of Encode, NBestEncode and SampleEncode. `mask` is
+  // nullptr when the vocabulary is not restricted.
+  EncodeResult EncodeInternal(absl::string_view normalized,
+                              const VocabularyMask *mask) const;
+
+  NBestEncodeResult NBestEncodeInternal(absl::string_view normalized,
+                                        int nbest_size,
+                                        const VocabularyMask *mask) const;
+
+  EncodeResult SampleEncodeInternal(absl::string_view normalized, float theta,
+                                    random::PhiloxRandomGenerator *rand_gen,
+                                    const VocabularyMask *mask) const;
+
+  // Represents the last node of the best path.
+  struct BestPathNode {
+    int id = -1;  // The vocab id. (maybe -1 for UNK)
+    float best_path_score =
+        0;  // The total score of the best path ending at this node.
+    int starts_at =
+        -1;  // The starting position (in utf-8) of this node. The entire best
+             // path can be constructed by backtracking along this link.
+  };
+
+  // Runs the forward pass of EncodeOptimized() and stores the best path
+  // ending at each utf-8 position to `best_path_ends_at`.
+  // `normalized` must not be empty.
+  void ComputeBestPathOptimized(
+      absl::string_view normalized, const VocabularyMask *mask,
+      std::vector<BestPathNode> *best_path_ends_at) const;
+
+  // ComputeBestPathOptimized() for `trie_` of type `Trie`.
+  template <typename Trie>
+  void ComputeBestPathOptimizedImpl(
+      absl::string_view normalized, const VocabularyMask *mask,
+      std::vector<BestPathNode> *best_path_ends_at) const;
 
   float min_score_ = 0.0;
   float max_score_ = 0.0;
-  std::unique_ptr<Darts::DoubleArray> trie_;
+  PieceTrieType trie_type_ = PieceTrieType::kDoubleArray;
+  std::unique_ptr<PieceTrie> trie_;
 
   // Maximum size of the return value of Trie, which corresponds
   // to the maximum size of shared common prefix in the sentence pieces.
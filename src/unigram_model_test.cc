@@ -676,6 +676,120 @@ TEST_P(UnigramModelTest, EncodeWithUnusedTest) {
   }
 }
 
+TEST_P(UnigramModelTest, ChangePieceTypesTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, "abcd", 10.0);  // 3
+  AddPiece(&model_proto, "abc", 5.0);    // 4
+  AddPiece(&model_proto, "ab", 2.0);     // 5
+  AddPiece(&model_proto, "cd", 1.0);     // 6
+  AddPiece(&model_proto, "a", 0.0);      // 7
+  AddPiece(&model_proto, "b", 0.0);      // 8
+  AddPiece(&model_proto, "c", 0.0);      // 9
+  AddPiece(&model_proto, "d", 0.0);      // 10
+  AddPiece(&model_proto, "xy", -1.0);    // 11
+  AddPiece(&model_proto, "x", 0.0);      // 12
+  AddPiece(&model_proto, "y", 0.0);      // 13
+  model_proto.mutable_pieces(11)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+
+  auto ToString = [](const EncodeResult &result) {
+    std::vector<std::string> pieces;
+    for (const auto &p : result) pieces.emplace_back(p.first);
+    return absl::StrJoin(pieces, " ");
+  };
+
+  // The model refers to `model_proto`, so the changes of the types are
+  // visible to the model, as SetVocabulary() relies on.
+  Model model(model_proto);
+  EXPECT_TRUE(model.SetEncoderVersion(encoder_version_).ok());
+  EXPECT_EQ("abcd xy", ToString(model.Encode("abcdxy")));
+  EXPECT_EQ(2, model.CountTokens("abcdxy"));
+
+  model_proto.mutable_pieces(3)->set_type(ModelProto::SentencePiece::UNUSED);
+  EXPECT_EQ("abc d xy", ToString(model.Encode("abcdxy")));
+  EXPECT_EQ(3, model.CountTokens("abcdxy"));
+
+  model_proto.mutable_pieces(3)->set_type(ModelProto::SentencePiece::NORMAL);
+  model_proto.mutable_pieces(11)->set_type(ModelProto::SentencePiece::NORMAL);
+  EXPECT_EQ("abcd x y", ToString(model.Encode("abcdxy")));
+  EXPECT_EQ(3, model.CountTokens("abcdxy"));
+}
+
+TEST_P(UnigramModelTest, PieceTrieTypeTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+
+  AddPiece(&model_proto, "abcd", 10.0);  // 3
+  AddPiece(&model_proto, "abc", 5.0);    // 4
+  AddPiece(&model_proto, "ab", 2.0);     // 5
+  AddPiece(&model_proto, "cd", 1.0);     // 6
+  AddPiece(&model_proto, "a", 0.0);      // 7
+  AddPiece(&model_proto, "b", 0.0);      // 8
+  AddPiece(&model_proto, "c", 0.0);      // 9
+  AddPiece(&model_proto, "d", 0.0);      // 10
+  AddPiece(&model_proto, "xy", 0.0);     // 11
+  AddPiece(&model_proto, "bcd", -1.0);   // 12
+  model_proto.mutable_pieces(11)->set_type(
+      ModelProto::SentencePiece::USER_DEFINED);
+  model_proto.mutable_pieces(6)->set_type(ModelProto::SentencePiece::UNUSED);
+
+  Model expected(model_proto);
+  Model model(model_proto);
+  EXPECT_TRUE(expected.SetEncoderVersion(encoder_version_).ok());
+  EXPECT_TRUE(model.SetEncoderVersion(encoder_version_).ok());
+  EXPECT_TRUE(model.SetPieceTrieType(PieceTrieType::kScoreOrdered).ok());
+  EXPECT_TRUE(PieceTrieType::kScoreOrdered == model.GetPieceTrieType());
+
+  for (const auto *input :
+       {"abcd", "abcdxyabqcd", "bcdcdab", "xyxyz", "dcbaabcd", "q"}) {
+    const auto expected_result = expected.Encode(input);
+    const auto result = model.Encode(input);
+    EXPECT_EQ(expected_result.size(), result.size());
+    for (size_t i = 0; i < result.size(); ++i) {
+      EXPECT_EQ(expected_result[i].first, result[i].first);
+      EXPECT_EQ(expected_result[i].second, result[i].second);
+    }
+    EXPECT_EQ(expected.CountTokens(input), model.CountTokens(input));
+  }
+
+  for (const auto *piece : {"abcd", "cd", "xy", "bcd", "<s>", "q", "abcde"}) {
+    EXPECT_EQ(expected.PieceToId(piece), model.PieceToId(piece));
+  }
+
+  // Switches back to the double array.
+  EXPECT_TRUE(model.SetPieceTrieType(PieceTrieType::kDoubleArray).ok());
+  EXPECT_EQ(3, model.PieceToId("abcd"));
+  EXPECT_EQ(1, model.Encode("abcd").size());
+}
+
+TEST(UnigramModelTest, PieceTrieTypeByVocabSizeTest) {
+  ModelProto model_proto = MakeBaseModelProto();
+  AddPiece(&model_proto, "a", 0.0);
+  AddPiece(&model_proto, "b", 0.0);
+
+  // Small models keep the double array.
+  {
+    Model model(model_proto);
+    EXPECT_TRUE(model.status().ok());
+    EXPECT_TRUE(PieceTrieType::kDoubleArray == model.GetPieceTrieType());
+  }
+
+  // Large models are loaded with the score-ordered trie.
+  for (int i = 0; i < 16384; ++i) {
+    AddPiece(&model_proto, absl::StrCat("ab", i), -1.0 - i * 0.001);
+  }
+  Model model(model_proto);
+  EXPECT_TRUE(model.status().ok());
+  EXPECT_TRUE(PieceTrieType::kScoreOrdered == model.GetPieceTrieType());
+  EXPECT_EQ(5, model.PieceToId("ab0"));
+  EXPECT_EQ(1, model.Encode("ab10").size());
+
+  // The type can still be overridden.
+  EXPECT_TRUE(model.SetPieceTrieType(PieceTrieType::kDoubleArray).ok());
+  EXPECT_TRUE(PieceTrieType::kDoubleArray == model.GetPieceTrieType());
+  EXPECT_EQ(5, model.PieceToId("ab0"));
+}
+
 TEST_P(UnigramModelTest, VerifyOutputsEquivalent) {
   ModelProto model_proto = MakeBaseModelProto();
 
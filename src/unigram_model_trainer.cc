@@ -98,6 +98,7 @@ void TrainerModel::SetSentencePieces(SentencePieces &&sentencepieces) {
 // Returns seed sentencepieces for EM training.
 template <typename node_int_type>
 TrainerModel::SentencePieces Trainer::MakeSeedSentencePieces() const {
+  PhaseProfiler::ScopedPhase phase(&profiler_, "make_seed_sentencepieces");
   CHECK(!sentences_.empty());
   CHECK(!required_chars_.empty());
 
@@ -136,8 +137,11 @@ TrainerModel::SentencePieces Trainer::MakeSeedSentencePieces() const {
   constexpr node_int_type kAlphabetSize = 0x110000;  // All UCS4 range.
   node_int_type node_num = 0;
   LOG(INFO) << "Making suffix array...";
-  CHECK_EQ(0, esaxx(array.begin(), SA.begin(), L.begin(), R.begin(), D.begin(),
-                    n, kAlphabetSize, node_num));
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "suffix_array");
+    CHECK_EQ(0, esaxx(array.begin(), SA.begin(), L.begin(), R.begin(),
+                      D.begin(), n, kAlphabetSize, node_num));
+  }
 
   LOG(INFO) << "Extracting frequent sub strings...";
   std::vector<std::pair<node_int_type, node_int_type>> substr_index;
@@ -492,6 +496,8 @@ util::Status Trainer::Train() {
   while (true) {
     // Sub-EM iteration.
     for (int iter = 0; iter < trainer_spec_.num_sub_iterations(); ++iter) {
+      PhaseProfiler::ScopedPhase phase(&profiler_, "em_sub_iter");
+
       // Executes E step
       float objective = 0.0;
       int64 num_tokens = 0;
@@ -514,12 +520,16 @@ util::Status Trainer::Train() {
     }
 
     // Prunes pieces.
+    PhaseProfiler::ScopedPhase phase(&profiler_, "prune_sentencepieces");
     auto new_sentencepieces = PruneSentencePieces(model);
     model.SetSentencePieces(std::move(new_sentencepieces));
   }  // end of EM iteration
 
   // Finally, adjusts the size of sentencepices to be |vocab_size|.
-  final_pieces_ = FinalizeSentencePieces(model);
+  {
+    PhaseProfiler::ScopedPhase phase(&profiler_, "finalize_sentencepieces");
+    final_pieces_ = FinalizeSentencePieces(model);
+  }
 
   return Save();
 }
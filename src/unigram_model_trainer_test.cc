@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include "filesystem.h"
 #include "sentencepiece_model.pb.h"
 #include "sentencepiece_processor.h"
 #include "sentencepiece_trainer.h"
@@ -21,6 +22,8 @@
 #include "unigram_model_trainer.h"
 #include "util.h"
 
+ABSL_DECLARE_FLAG(bool, save_trace);
+
 namespace sentencepiece {
 namespace unigram {
 namespace {
@@ -49,8 +52,10 @@ TEST(UnigramTrainerTest, EndToEndTest) {
               " --input=", input,
               " --vocab_size=8000 --normalization_rule_name=identity",
               " --model_type=unigram --user_defined_symbols=<user>",
-              " --control_symbols=<ctrl> --max_sentence_length=2048"))
+              " --control_symbols=<ctrl> --max_sentence_length=2048",
+              " --save_trace"))
           .ok());
+  absl::SetFlag(&FLAGS_save_trace, false);
 
   SentencePieceProcessor sp;
   EXPECT_TRUE(sp.Load(util::JoinPath(absl::GetFlag(FLAGS_test_tmpdir),
@@ -58,6 +63,20 @@ TEST(UnigramTrainerTest, EndToEndTest) {
                   .ok());
   EXPECT_EQ(8000, sp.GetPieceSize());
 
+  // With --save_trace, the phase trace is saved next to the model.
+  {
+    auto input = filesystem::NewReadableFile(util::JoinPath(
+        absl::GetFlag(FLAGS_test_tmpdir), "tmp_model.trace.json"));
+    EXPECT_TRUE(input->status().ok());
+    std::string trace;
+    EXPECT_TRUE(input->ReadAll(&trace));
+    for (const char *name : {"\"load_sentences\"", "\"suffix_array\"",
+                             "\"em_sub_iter\"", "\"prune_sentencepieces\"",
+                             "\"save\""}) {
+      EXPECT_NE(std::string::npos, trace.find(name));
+    }
+  }
+
   const int cid = sp.PieceToId("<ctrl>");
   const int uid = sp.PieceToId("<user>");
   EXPECT_TRUE(sp.IsControl(cid));
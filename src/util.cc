@@ -273,4 +273,57 @@ std::string WideToUtf8(const std::wstring &input) {
 }
 }  // namespace win32
 #endif
+
+WorkerPool::~WorkerPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto &worker : workers_) {
+    worker.join();
+  }
+}
+
+void WorkerPool::Run(int n, const std::function<void(int)> &fn) {
+  if (n <= 0) return;
+
+  // The closures signal `done_cv` while holding `done_mutex`, so both
+  // outlive the last notification.
+  std::mutex done_mutex;
+  std::condition_variable done_cv;
+  int pending = n - 1;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (workers_.size() < static_cast<size_t>(n - 1)) {
+      workers_.emplace_back([this]() { Loop(); });
+    }
+    for (int i = 1; i < n; ++i) {
+      queue_.emplace_back([&, i]() {
+        fn(i);
+        std::lock_guard<std::mutex> done_lock(done_mutex);
+        if (--pending == 0) done_cv.notify_one();
+      });
+    }
+  }
+  cv_.notify_all();
+
+  fn(0);
+  std::unique_lock<std::mutex> done_lock(done_mutex);
+  done_cv.wait(done_lock, [&pending]() { return pending == 0; });
+}
+
+void WorkerPool::Loop() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
 }  // namespace sentencepiece
@@ -19,8 +19,11 @@
 #include <string.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <random>
 #include <sstream>
 #include <string>
@@ -304,6 +307,82 @@ namespace random {
 
 std::mt19937 *GetRandomGenerator();
 
+// Counter-based random number generator (Philox4x32-10).
+// http://www.thesalmons.org/john/random123/papers/random123sc11.pdf
+// Each (seed, stream) pair identifies an independent random stream, which
+// is computed from a counter without any shared state. Using the sentence
+// index as `stream` makes sampling reproducible regardless of which thread
+// processes the sentence. Satisfies UniformRandomBitGenerator, so it can
+// be used with the std:: distributions.
+class PhiloxRandomGenerator {
+ public:
+  using result_type = uint32;
+
+  PhiloxRandomGenerator(uint64 seed, uint64 stream) {
+    key_[0] = static_cast<uint32>(seed);
+    key_[1] = static_cast<uint32>(seed >> 32);
+    counter_[0] = 0;
+    counter_[1] = 0;
+    counter_[2] = static_cast<uint32>(stream);
+    counter_[3] = static_cast<uint32>(stream >> 32);
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return 0xFFFFFFFF; }
+
+  result_type operator()() {
+    if (index_ == 4) Generate();
+    return output_[index_++];
+  }
+
+  // Stores the next `size` outputs to `output`. Same as calling operator()
+  // `size` times.
+  void Fill(uint32 *output, size_t size) {
+    size_t i = 0;
+    for (; i < size && index_ < 4; ++i) output[i] = output_[index_++];
+    for (; i + 4 <= size; i += 4) {
+      Generate();
+      std::copy(output_, output_ + 4, output + i);
+      index_ = 4;
+    }
+    for (; i < size; ++i) output[i] = operator()();
+  }
+
+  // Returns a uniform random number in [0, 1).
+  float Uniform() {
+    return static_cast<float>(operator()() >> 8) * (1.0f / 16777216.0f);
+  }
+
+ private:
+  void Generate() {
+    constexpr uint64 kMul0 = 0xD2511F53;
+    constexpr uint64 kMul1 = 0xCD9E8D57;
+    constexpr uint32 kWeyl0 = 0x9E3779B9;
+    constexpr uint32 kWeyl1 = 0xBB67AE85;
+    uint32 c[4] = {counter_[0], counter_[1], counter_[2], counter_[3]};
+    uint32 k[2] = {key_[0], key_[1]};
+    for (int round = 0; round < 10; ++round) {
+      const uint64 p0 = kMul0 * c[0];
+      const uint64 p1 = kMul1 * c[2];
+      const uint32 c1 = c[1];
+      c[0] = static_cast<uint32>(p1 >> 32) ^ c1 ^ k[0];
+      c[1] = static_cast<uint32>(p1);
+      c[2] = static_cast<uint32>(p0 >> 32) ^ c[3] ^ k[1];
+      c[3] = static_cast<uint32>(p0);
+      k[0] += kWeyl0;
+      k[1] += kWeyl1;
+    }
+    std::copy(c, c + 4, output_);
+    if (++counter_[0] == 0) ++counter_[1];
+    index_ = 0;
+  }
+
+  uint32 key_[2];
+  uint32 counter_[4];
+  uint32 output_[4];
+  int index_ = 4;
+};
+
 template <typename T>
 class ReservoirSampler {
  public:
@@ -448,5 +527,27 @@ class ThreadPool {
  private:
   std::vector<std::thread> tasks_;
 };
+
+// Unlike ThreadPool, which starts a thread for each closure, WorkerPool
+// starts its threads on demand and reuses them across calls.
+class WorkerPool {
+ public:
+  WorkerPool() = default;
+  ~WorkerPool();
+
+  // Calls fn(0), ..., fn(n - 1) and returns when all of them are done.
+  // fn(0) runs on the calling thread and the others on the workers. At
+  // least n - 1 workers are kept. Thread-safe.
+  void Run(int n, const std::function<void(int)> &fn);
+
+ private:
+  void Loop();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::thread> workers_;
+  bool stop_ = false;
+};
 }  // namespace sentencepiece
 #endif  // UTIL_H_
@@ -12,7 +12,11 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.!
 
+#include <atomic>
 #include <map>
+#include <set>
+#include <thread>
+#include <vector>
 
 #include "filesystem.h"
 #include "testharness.h"
@@ -424,6 +428,50 @@ TEST(UtilTest, ReservoirSamplerTest) {
   EXPECT_EQ(10000, sampler.total_size());
 }
 
+TEST(UtilTest, PhiloxRandomGeneratorTest) {
+  // Known answer from the reference implementation (Random123).
+  random::PhiloxRandomGenerator gen(0, 0);
+  EXPECT_EQ(0x6627e8d5, gen());
+  EXPECT_EQ(0xe169c58d, gen());
+  EXPECT_EQ(0xbc57ac4c, gen());
+  EXPECT_EQ(0x9b00dbd8, gen());
+
+  auto get_stream = [](uint64 seed, uint64 stream) {
+    random::PhiloxRandomGenerator gen(seed, stream);
+    std::vector<uint32> result(100);
+    for (auto &v : result) v = gen();
+    return result;
+  };
+
+  EXPECT_EQ(get_stream(1, 2), get_stream(1, 2));
+  EXPECT_NE(get_stream(1, 2), get_stream(1, 3));
+  EXPECT_NE(get_stream(1, 2), get_stream(2, 2));
+
+  // Fill() continues the same stream from any position.
+  const auto expected = get_stream(1, 2);
+  for (const size_t skip : {0, 1, 3, 4, 5}) {
+    random::PhiloxRandomGenerator gen(1, 2);
+    std::vector<uint32> result;
+    for (size_t i = 0; i < skip; ++i) result.push_back(gen());
+    for (const size_t size : {0, 1, 2, 4, 7, 13}) {
+      std::vector<uint32> block(size);
+      gen.Fill(block.data(), size);
+      result.insert(result.end(), block.begin(), block.end());
+    }
+    EXPECT_TRUE(std::equal(result.begin(), result.end(), expected.begin()));
+  }
+
+  random::PhiloxRandomGenerator gen2(1234, 5);
+  double sum = 0.0;
+  constexpr int kTrial = 100000;
+  for (int i = 0; i < kTrial; ++i) {
+    const float v = gen2.Uniform();
+    EXPECT_TRUE(v >= 0.0 && v < 1.0);
+    sum += v;
+  }
+  EXPECT_NEAR(0.5, sum / kTrial, 0.01);
+}
+
 TEST(UtilTest, StrSplitAsCSVTest) {
   {
     const auto v = util::StrSplitAsCSV("foo,bar,buz");
@@ -448,4 +496,52 @@ TEST(UtilTest, StrSplitAsCSVTest) {
     EXPECT_EQ("1,2,3,4", v[1]);
   }
 }
+
+TEST(UtilTest, WorkerPoolTest) {
+  WorkerPool pool;
+  int calls = 0;
+  pool.Run(0, [&calls](int n) { ++calls; });
+  EXPECT_EQ(0, calls);
+
+  // fn(0) runs on the calling thread and the workers are reused. Each call
+  // waits for the others, so that every call runs on a different thread.
+  auto RunOnThreads = [&pool](std::vector<std::thread::id> *ids) {
+    std::atomic<int> started(0);
+    pool.Run(ids->size(), [ids, &started](int n) {
+      (*ids)[n] = std::this_thread::get_id();
+      ++started;
+      while (started < static_cast<int>(ids->size())) {
+        std::this_thread::yield();
+      }
+    });
+  };
+  std::vector<std::thread::id> first(4), second(4);
+  RunOnThreads(&first);
+  RunOnThreads(&second);
+  EXPECT_EQ(std::this_thread::get_id(), first[0]);
+  EXPECT_EQ(std::this_thread::get_id(), second[0]);
+  std::set<std::thread::id> workers(first.begin() + 1, first.end());
+  EXPECT_EQ(3, workers.size());
+  for (int n = 1; n < 4; ++n) {
+    EXPECT_EQ(1, workers.count(second[n]));
+  }
+
+  // Concurrent calls.
+  std::vector<std::vector<int>> results(8, std::vector<int>(16, 0));
+  {
+    ThreadPool callers(results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      callers.Schedule([&pool, &results, i]() {
+        pool.Run(results[i].size(), [&results, i](int n) {
+          results[i][n] = static_cast<int>(i) * n;
+        });
+      });
+    }
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    for (size_t n = 0; n < results[i].size(); ++n) {
+      EXPECT_EQ(static_cast<int>(i * n), results[i][n]);
+    }
+  }
+}
 }  // namespace sentencepiece